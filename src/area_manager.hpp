@@ -0,0 +1,407 @@
+#ifndef AREA_MANAGER_HPP
+#define AREA_MANAGER_HPP
+
+#include "assembly_timer.hpp"
+#include "problem_recorder.hpp"
+#include "region.hpp"
+
+#include <osmium/area/problem_reporter.hpp>
+#include <osmium/area/stats.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/tag.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/relations/relations_manager.hpp>
+#include <osmium/tags/tags_filter.hpp>
+#include <osmium/thread/pool.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace detail {
+
+    // Not all assemblers have a problem reporter in their config, these
+    // functions hide the difference.
+
+    template <typename TConfig>
+    auto get_problem_reporter(const TConfig& config, int /*dummy*/) -> decltype(config.problem_reporter) {
+        return config.problem_reporter;
+    }
+
+    template <typename TConfig>
+    osmium::area::ProblemReporter* get_problem_reporter(const TConfig& /*config*/, long /*dummy*/) {
+        return nullptr;
+    }
+
+    template <typename TConfig>
+    auto set_problem_reporter(TConfig& config, osmium::area::ProblemReporter* reporter, int /*dummy*/) -> decltype(config.problem_reporter = reporter, void()) {
+        config.problem_reporter = reporter;
+    }
+
+    template <typename TConfig>
+    void set_problem_reporter(TConfig& /*config*/, osmium::area::ProblemReporter* /*reporter*/, long /*dummy*/) {
+    }
+
+} // namespace detail
+
+/**
+ * Manager for area relations and closed ways. This works like the
+ * osmium::area::MultipolygonManager, but it can optionally hand off the
+ * assembly of areas to a pool of worker threads. In that case closed ways
+ * and complete relations (together with their member ways) are copied into
+ * work buffers which are assembled by the workers. The results are put back
+ * into the output buffer in the order the work was submitted, so the output
+ * is the same as in the single-threaded case.
+ *
+ * When using worker threads, call finish() after the second pass to get
+ * all outstanding areas.
+ *
+ * If a timer is set, every assembler run is timed. If a region is set, only
+ * closed ways and relations which can intersect the region are assembled.
+ */
+template <typename TAssembler>
+class AreaManager : public osmium::relations::RelationsManager<AreaManager<TAssembler>, false, true, false> {
+
+    using assembler_config_type = typename TAssembler::config_type;
+
+    // Hand off work to worker threads if the work buffer is this large
+    enum : std::size_t {
+        initial_buffer_size = 1024UL * 1024UL,
+        max_work_size = 1024UL * 512UL,
+        max_work_items = 1000
+    };
+
+    struct result_type {
+        osmium::memory::Buffer buffer{initial_buffer_size, osmium::memory::Buffer::auto_grow::yes};
+        osmium::area::area_stats stats{};
+        ProblemRecorder problems{};
+        std::unique_ptr<AssemblyTimer> timer{};
+    };
+
+    assembler_config_type m_assembler_config;
+    osmium::area::area_stats m_stats;
+    osmium::TagsFilter m_filter;
+
+    std::unique_ptr<osmium::thread::Pool> m_pool;
+    std::deque<std::future<result_type>> m_results;
+    std::size_t m_max_results = 0;
+
+    osmium::memory::Buffer m_work{};
+    std::size_t m_work_items = 0;
+
+    AssemblyTimer* m_timer = nullptr;
+    const Region* m_region = nullptr;
+    bool m_closed_by_ref = false;
+
+    static AssemblyTimer::clock::time_point start_timer(const AssemblyTimer* timer) noexcept {
+        return timer ? AssemblyTimer::clock::now() : AssemblyTimer::clock::time_point{};
+    }
+
+    static result_type assemble(const assembler_config_type& config, const osmium::memory::Buffer& work, bool timing, std::size_t max_slowest) {
+        result_type result;
+        if (timing) {
+            result.timer = std::make_unique<AssemblyTimer>(max_slowest);
+        }
+
+        assembler_config_type worker_config{config};
+        if (detail::get_problem_reporter(config, 0)) {
+            detail::set_problem_reporter(worker_config, &result.problems, 0);
+        }
+
+        std::vector<const osmium::Way*> members;
+
+        auto it = work.cbegin<osmium::OSMObject>();
+        const auto end = work.cend<osmium::OSMObject>();
+        while (it != end) {
+            if (it->type() == osmium::item_type::way) {
+                const auto& way = static_cast<const osmium::Way&>(*it);
+                ++it;
+                const auto start = start_timer(result.timer.get());
+                try {
+                    TAssembler assembler{worker_config};
+                    assembler(way, result.buffer);
+                    result.stats += assembler.stats();
+                } catch (const osmium::invalid_location&) {
+                    // XXX ignore
+                }
+                if (result.timer) {
+                    result.timer->add_way(AssemblyTimer::elapsed(start));
+                }
+                continue;
+            }
+
+            const auto& relation = static_cast<const osmium::Relation&>(*it);
+            ++it;
+            members.clear();
+            for (const auto& member : relation.members()) {
+                if (member.ref() != 0) {
+                    members.push_back(&static_cast<const osmium::Way&>(*it));
+                    ++it;
+                }
+            }
+            const auto start = start_timer(result.timer.get());
+            try {
+                TAssembler assembler{worker_config};
+                assembler(relation, members, result.buffer);
+                result.stats += assembler.stats();
+            } catch (const osmium::invalid_location&) {
+                // XXX ignore
+            }
+            if (result.timer) {
+                result.timer->add_relation(relation, members, AssemblyTimer::elapsed(start));
+            }
+        }
+
+        return result;
+    }
+
+    bool in_region(const osmium::Relation& relation) {
+        std::vector<const osmium::NodeRefList*> ways;
+        for (const auto& member : relation.members()) {
+            if (member.ref() != 0) {
+                ways.push_back(&this->get_member_way(member.ref())->nodes());
+            }
+        }
+        return m_region->intersects(ways);
+    }
+
+    void new_work_buffer() {
+        m_work = osmium::memory::Buffer{initial_buffer_size, osmium::memory::Buffer::auto_grow::yes};
+        m_work_items = 0;
+    }
+
+    void submit_work() {
+        if (m_work_items == 0) {
+            return;
+        }
+
+        m_results.push_back(m_pool->submit([config = m_assembler_config, work = std::move(m_work),
+                                            timing = m_timer != nullptr, max_slowest = m_timer ? m_timer->max_slowest() : 0]() {
+            return assemble(config, work, timing, max_slowest);
+        }));
+        new_work_buffer();
+
+        // Don't let the workers get too far ahead of us.
+        drain(m_results.size() > m_max_results);
+    }
+
+    void added_work() {
+        ++m_work_items;
+        if (m_work_items >= max_work_items || m_work.committed() >= max_work_size) {
+            submit_work();
+        }
+    }
+
+    // Move all results that are ready (or the first result if wait_for_one
+    // is set) into the output buffer keeping the order.
+    void drain(bool wait_for_one) {
+        while (!m_results.empty()) {
+            auto& future = m_results.front();
+            if (!wait_for_one && future.wait_for(std::chrono::seconds{0}) != std::future_status::ready) {
+                return;
+            }
+            wait_for_one = false;
+
+            auto result = future.get();
+            m_results.pop_front();
+
+            m_stats += result.stats;
+            if (m_timer && result.timer) {
+                *m_timer += *result.timer;
+            }
+            auto* reporter = detail::get_problem_reporter(m_assembler_config, 0);
+            if (reporter) {
+                result.problems.replay(*reporter);
+            }
+            if (result.buffer.committed() > 0) {
+                this->buffer().add_buffer(result.buffer);
+                this->buffer().commit();
+                this->possibly_flush();
+            }
+        }
+    }
+
+public:
+
+    /**
+     * Create manager. Only relations and closed ways with at least one tag
+     * matching the filter are assembled. If num_threads is larger than 0,
+     * assembly will be done by that many worker threads.
+     */
+    AreaManager(const assembler_config_type& assembler_config, const osmium::TagsFilter& filter, int num_threads = 0) :
+        m_assembler_config(assembler_config),
+        m_filter(filter) {
+        if (num_threads > 0) {
+            m_max_results = static_cast<std::size_t>(num_threads) * 4;
+            m_pool = std::make_unique<osmium::thread::Pool>(num_threads, m_max_results);
+            new_work_buffer();
+        }
+    }
+
+    /**
+     * Create manager assembling all relations and closed ways.
+     */
+    explicit AreaManager(const assembler_config_type& assembler_config, int num_threads = 0) :
+        AreaManager(assembler_config, osmium::TagsFilter{true}, num_threads) {
+    }
+
+    const osmium::area::area_stats& stats() const noexcept {
+        return m_stats;
+    }
+
+    /**
+     * Time all assembler runs. The timer must outlive the manager.
+     */
+    void set_timer(AssemblyTimer* timer) noexcept {
+        m_timer = timer;
+    }
+
+    /**
+     * Only assemble areas intersecting the region. The region must outlive
+     * the manager.
+     */
+    void set_region(const Region* region) noexcept {
+        m_region = region;
+    }
+
+    /**
+     * Only assemble areas from ways whose first and last node are the
+     * same, not from all ways whose ends have the same location. Use this
+     * if the ways needed were selected before the locations were known
+     * (see is_needed_way()), otherwise areas could be missing nodes.
+     */
+    void set_closed_by_ref(bool closed_by_ref) noexcept {
+        m_closed_by_ref = closed_by_ref;
+    }
+
+    bool new_relation(const osmium::Relation& relation) const {
+        const char* type = relation.tags().get_value_by_key("type");
+
+        // ignore relations without "type" tag
+        if (type == nullptr) {
+            return false;
+        }
+
+        if ((!std::strcmp(type, "multipolygon")) || (!std::strcmp(type, "boundary"))) {
+            return std::any_of(relation.tags().cbegin(), relation.tags().cend(), std::cref(m_filter));
+        }
+
+        return false;
+    }
+
+    bool new_member(const osmium::Relation& /*relation*/, const osmium::RelationMember& member, std::size_t /*n*/) const noexcept {
+        return member.type() == osmium::item_type::way;
+    }
+
+    void complete_relation(const osmium::Relation& relation) {
+        if (m_region && !in_region(relation)) {
+            return;
+        }
+
+        if (m_pool) {
+            m_work.add_item(relation);
+            m_work.commit();
+            for (const auto& member : relation.members()) {
+                if (member.ref() != 0) {
+                    m_work.add_item(*this->get_member_way(member.ref()));
+                    m_work.commit();
+                }
+            }
+            added_work();
+            return;
+        }
+
+        std::vector<const osmium::Way*> ways;
+        ways.reserve(relation.members().size());
+        for (const auto& member : relation.members()) {
+            if (member.ref() != 0) {
+                ways.push_back(this->get_member_way(member.ref()));
+            }
+        }
+
+        const auto start = start_timer(m_timer);
+        try {
+            TAssembler assembler{m_assembler_config};
+            assembler(relation, ways, this->buffer());
+            m_stats += assembler.stats();
+        } catch (const osmium::invalid_location&) {
+            // XXX ignore
+        }
+        if (m_timer) {
+            m_timer->add_relation(relation, ways, AssemblyTimer::elapsed(start));
+        }
+    }
+
+    void after_way(const osmium::Way& way) {
+        // you need at least 4 nodes to make up a polygon
+        if (way.nodes().size() <= 3) {
+            return;
+        }
+
+        try {
+            if (!way.nodes().front().location() || !way.nodes().back().location()) {
+                throw osmium::invalid_location{"invalid location"};
+            }
+            if (way.ends_have_same_location() && (!m_closed_by_ref || way.is_closed())) {
+                if (way.tags().has_tag("area", "no")) {
+                    return;
+                }
+
+                if (std::none_of(way.tags().cbegin(), way.tags().cend(), std::cref(m_filter))) {
+                    return;
+                }
+
+                if (m_region && !m_region->intersects({&way.nodes()})) {
+                    return;
+                }
+
+                if (m_pool) {
+                    m_work.add_item(way);
+                    m_work.commit();
+                    added_work();
+                    return;
+                }
+
+                const auto start = start_timer(m_timer);
+                TAssembler assembler{m_assembler_config};
+                assembler(way, this->buffer());
+                m_stats += assembler.stats();
+                if (m_timer) {
+                    m_timer->add_way(AssemblyTimer::elapsed(start));
+                }
+                this->possibly_flush();
+            }
+        } catch (const osmium::invalid_location&) {
+            // XXX ignore
+        }
+    }
+
+    /**
+     * Wait for all worker threads to finish their work and flush the
+     * output. Call this after the second pass.
+     */
+    void finish() {
+        if (!m_pool) {
+            return;
+        }
+
+        submit_work();
+        while (!m_results.empty()) {
+            drain(true);
+        }
+        this->flush_output();
+    }
+
+}; // class AreaManager
+
+#endif // AREA_MANAGER_HPP
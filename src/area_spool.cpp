@@ -0,0 +1,193 @@
+/*****************************************************************************
+
+  OSM Area Tools - Area spool
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "area_spool.hpp"
+
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/writer_options.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    constexpr const char spool_magic[8] = {'O', 'A', 'T', 'S', 'P', 'O', 'O', 'L'};
+    constexpr const uint32_t spool_version = 1;
+
+    constexpr const std::size_t index_block_size = 64UL * 1024UL;
+
+    static_assert(sizeof(spool_header) == 64, "spool header must be 64 bytes");
+    static_assert(sizeof(spool_index_entry) == 16, "spool index entry must be 16 bytes");
+
+    bool id_order(const spool_index_entry& lhs, const spool_index_entry& rhs) noexcept {
+        return lhs.id < rhs.id;
+    }
+
+    void write_entries(int fd, const std::vector<spool_index_entry>& entries) {
+        osmium::io::detail::reliable_write(fd, reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(spool_index_entry));
+    }
+
+    std::string index_filename(const std::string& filename) {
+        return filename + ".idx.tmp";
+    }
+
+} // anonymous namespace
+
+AreaSpoolWriter::AreaSpoolWriter(const std::string& filename) :
+    m_filename(filename),
+    m_fd(osmium::io::detail::open_for_writing(filename, osmium::io::overwrite::allow)),
+    m_index_fd(::open(index_filename(filename).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666)) { // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+    if (m_index_fd < 0) {
+        ::close(m_fd);
+        throw std::system_error{errno, std::system_category(), "Can not open temporary file '" + index_filename(filename) + "'"};
+    }
+    const spool_header header{};
+    osmium::io::detail::reliable_write(m_fd, reinterpret_cast<const char*>(&header), sizeof(header));
+    m_way_index.reserve(index_block_size);
+}
+
+AreaSpoolWriter::~AreaSpoolWriter() noexcept {
+    if (m_index_fd >= 0) {
+        ::close(m_index_fd);
+        ::unlink(index_filename(m_filename).c_str());
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+void AreaSpoolWriter::flush_way_index() {
+    write_entries(m_index_fd, m_way_index);
+    m_way_index_count += m_way_index.size();
+    m_way_index.clear();
+}
+
+void AreaSpoolWriter::write(const osmium::memory::Buffer& buffer) {
+    if (!buffer || buffer.committed() == 0) {
+        return;
+    }
+
+    for (auto it = buffer.cbegin<osmium::Area>(); it != buffer.cend<osmium::Area>(); ++it) {
+        const auto offset = m_data_size + static_cast<uint64_t>(reinterpret_cast<const unsigned char*>(&*it) - buffer.data());
+        // Areas from ways usually come in order, their index entries can
+        // be written out directly.
+        if (it->from_way() && it->id() > m_last_way_area) {
+            m_last_way_area = it->id();
+            m_way_index.push_back(spool_index_entry{it->id(), offset});
+            if (m_way_index.size() == index_block_size) {
+                flush_way_index();
+            }
+        } else {
+            m_other_index.push_back(spool_index_entry{it->id(), offset});
+        }
+    }
+
+    osmium::io::detail::reliable_write(m_fd, reinterpret_cast<const char*>(buffer.data()), buffer.committed());
+    m_data_size += buffer.committed();
+}
+
+void AreaSpoolWriter::close() {
+    flush_way_index();
+    std::sort(m_other_index.begin(), m_other_index.end(), id_order);
+
+    // Merge the sorted way index from the temporary file with the other
+    // index entries.
+    {
+        const ReadOnlyMapping mapping{m_index_fd, m_way_index_count * sizeof(spool_index_entry), 0};
+        const auto* ways = mapping.get<spool_index_entry>();
+        const auto* ways_end = ways ? ways + m_way_index_count : nullptr;
+
+        std::vector<spool_index_entry> block;
+        block.reserve(index_block_size);
+        auto other = m_other_index.cbegin();
+        while (ways != ways_end || other != m_other_index.cend()) {
+            if (other == m_other_index.cend() || (ways != ways_end && ways->id < other->id)) {
+                block.push_back(*ways++);
+            } else {
+                block.push_back(*other++);
+            }
+            if (block.size() == index_block_size) {
+                write_entries(m_fd, block);
+                block.clear();
+            }
+        }
+        write_entries(m_fd, block);
+    }
+
+    ::close(m_index_fd);
+    m_index_fd = -1;
+    ::unlink(index_filename(m_filename).c_str());
+
+    spool_header header{};
+    std::memcpy(header.magic, spool_magic, sizeof(spool_magic));
+    header.version = spool_version;
+    header.data_size = m_data_size;
+    header.index_count = m_way_index_count + m_other_index.size();
+
+    if (::lseek(m_fd, 0, SEEK_SET) != 0) {
+        throw std::system_error{errno, std::system_category(), "Seek failed on spool file"};
+    }
+    osmium::io::detail::reliable_write(m_fd, reinterpret_cast<const char*>(&header), sizeof(header));
+    osmium::io::detail::reliable_close(m_fd);
+    m_fd = -1;
+}
+
+AreaSpoolReader::AreaSpoolReader(const std::string& filename) {
+    const int fd = ::open(filename.c_str(), O_RDONLY); // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(), "Can not open spool file '" + filename + "'"};
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(spool_header)) {
+        ::close(fd);
+        throw std::runtime_error{"Not a spool file: '" + filename + "'"};
+    }
+
+    try {
+        m_mapping = std::make_unique<ReadOnlyMapping>(fd, static_cast<std::size_t>(st.st_size), 0);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+
+    std::memcpy(&m_header, m_mapping->get<spool_header>(), sizeof(spool_header));
+    if (std::memcmp(m_header.magic, spool_magic, sizeof(spool_magic)) != 0 || m_header.version != spool_version) {
+        throw std::runtime_error{"Not a spool file or unknown version: '" + filename + "'"};
+    }
+    if (sizeof(spool_header) + m_header.data_size + m_header.index_count * sizeof(spool_index_entry) != static_cast<uint64_t>(st.st_size)) {
+        throw std::runtime_error{"Spool file '" + filename + "' is truncated"};
+    }
+}
+
+osmium::memory::Buffer AreaSpoolReader::buffer() const {
+    if (m_header.data_size == 0) {
+        return osmium::memory::Buffer{};
+    }
+    // The buffer doesn't own the memory and is never written to, so it is
+    // okay to use it on the read-only mapping.
+    return osmium::memory::Buffer{const_cast<unsigned char*>(data()), static_cast<std::size_t>(m_header.data_size)}; // NOLINT(cppcoreguidelines-pro-type-const-cast)
+}
+
+const osmium::Area* AreaSpoolReader::get(osmium::object_id_type id) const noexcept {
+    const auto* begin = index_begin();
+    const auto* end = begin + m_header.index_count;
+    const auto* it = std::lower_bound(begin, end, spool_index_entry{id, 0}, id_order);
+    if (it == end || it->id != id) {
+        return nullptr;
+    }
+    return reinterpret_cast<const osmium::Area*>(data() + it->offset);
+}
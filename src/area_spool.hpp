@@ -0,0 +1,122 @@
+#ifndef AREA_SPOOL_HPP
+#define AREA_SPOOL_HPP
+
+#include "read_only_mapping.hpp"
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/area.hpp>
+#include <osmium/osm/types.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * An area spool file contains assembled areas in the internal format of
+ * osmium::memory::Buffer, so they can be analyzed several times without
+ * reading the OSM data and assembling them again. The file can be mapped
+ * into memory and used directly.
+ *
+ * header - spool_header (64 bytes)
+ * data   - the areas as osmium items (data_size bytes)
+ * index  - spool_index_entry for each area sorted by area ID
+ */
+
+struct spool_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t data_size;
+    uint64_t index_count;
+    uint64_t padding[4];
+};
+
+struct spool_index_entry {
+    int64_t id;
+    uint64_t offset; // into data section
+};
+
+/**
+ * Writes buffers with areas into a spool file. The areas from ways must
+ * come in order of their IDs (as they do when assembled from sorted
+ * input), their index entries are kept in a temporary file. The index
+ * entries of the areas from relations are kept in memory.
+ */
+class AreaSpoolWriter {
+
+    std::string m_filename;
+    int m_fd;
+    int m_index_fd;
+    uint64_t m_data_size = 0;
+    osmium::object_id_type m_last_way_area = 0;
+    std::vector<spool_index_entry> m_way_index;
+    std::vector<spool_index_entry> m_other_index;
+    uint64_t m_way_index_count = 0;
+
+    void flush_way_index();
+
+public:
+
+    explicit AreaSpoolWriter(const std::string& filename);
+
+    AreaSpoolWriter(const AreaSpoolWriter&) = delete;
+    AreaSpoolWriter& operator=(const AreaSpoolWriter&) = delete;
+
+    AreaSpoolWriter(AreaSpoolWriter&&) = delete;
+    AreaSpoolWriter& operator=(AreaSpoolWriter&&) = delete;
+
+    ~AreaSpoolWriter() noexcept;
+
+    void write(const osmium::memory::Buffer& buffer);
+
+    /**
+     * Write the index and header. The file is not valid before this is
+     * called.
+     */
+    void close();
+
+}; // class AreaSpoolWriter
+
+/**
+ * Gives access to the areas in a spool file mapped into memory.
+ */
+class AreaSpoolReader {
+
+    std::unique_ptr<ReadOnlyMapping> m_mapping;
+    spool_header m_header{};
+
+    const unsigned char* data() const noexcept {
+        return m_mapping->get<unsigned char>() + sizeof(spool_header);
+    }
+
+    const spool_index_entry* index_begin() const noexcept {
+        return reinterpret_cast<const spool_index_entry*>(data() + m_header.data_size);
+    }
+
+public:
+
+    explicit AreaSpoolReader(const std::string& filename);
+
+    /**
+     * The number of areas in the spool.
+     */
+    std::size_t size() const noexcept {
+        return static_cast<std::size_t>(m_header.index_count);
+    }
+
+    /**
+     * A buffer with all areas. The buffer refers to the mapped memory, it
+     * is only valid as long as this reader exists and must not be changed.
+     */
+    osmium::memory::Buffer buffer() const;
+
+    /**
+     * Get the area with the given ID or nullptr if it is not in the spool.
+     */
+    const osmium::Area* get(osmium::object_id_type id) const noexcept;
+
+}; // class AreaSpoolReader
+
+#endif // AREA_SPOOL_HPP
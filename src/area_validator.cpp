@@ -0,0 +1,516 @@
+/*****************************************************************************
+
+  OSM Area Tools - Native area validator
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "area_validator.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    __extension__ using int128_type = __int128;
+
+    // Sign of the cross product (q - p) x (r - p): 1 if r is left of the
+    // line p-q, -1 if it is right of it, and 0 if the points are collinear.
+    // Differences of coordinates need 33 bits, so the products are
+    // calculated with 128 bit integers to get exact results.
+    int orientation(osmium::Location p, osmium::Location q, osmium::Location r) noexcept {
+        const int128_type a = static_cast<int128_type>(static_cast<int64_t>(q.x()) - p.x()) *
+                              (static_cast<int64_t>(r.y()) - p.y());
+        const int128_type b = static_cast<int128_type>(static_cast<int64_t>(q.y()) - p.y()) *
+                              (static_cast<int64_t>(r.x()) - p.x());
+        return (a > b) - (a < b);
+    }
+
+    // Is point r, which is collinear with p and q, on the segment p-q?
+    bool on_segment(osmium::Location p, osmium::Location q, osmium::Location r) noexcept {
+        return std::min(p.x(), q.x()) <= r.x() && r.x() <= std::max(p.x(), q.x()) &&
+               std::min(p.y(), q.y()) <= r.y() && r.y() <= std::max(p.y(), q.y());
+    }
+
+    enum class loop_location {
+        outside,
+        boundary,
+        inside
+    };
+
+    // Crossing number test for a closed list of locations.
+    loop_location location_in_loop(osmium::Location point, const std::vector<osmium::Location>& loop) noexcept {
+        bool inside = false;
+        for (std::size_t i = 1; i < loop.size(); ++i) {
+            const auto first = loop[i - 1];
+            const auto second = loop[i];
+            const int o = orientation(first, second, point);
+            if (o == 0 && on_segment(first, second, point)) {
+                return loop_location::boundary;
+            }
+            if ((first.y() > point.y()) != (second.y() > point.y())) {
+                if ((second.y() > first.y()) ? (o > 0) : (o < 0)) {
+                    inside = !inside;
+                }
+            }
+        }
+        return inside ? loop_location::inside : loop_location::outside;
+    }
+
+    // Is the first point of loop1 not on the boundary of loop2 inside loop2?
+    // The loops don't cross, so this is enough to find out whether loop1 is
+    // inside loop2.
+    bool loop_inside(const std::vector<osmium::Location>& loop1, const std::vector<osmium::Location>& loop2) noexcept {
+        for (const auto point : loop1) {
+            const auto location = location_in_loop(point, loop2);
+            if (location != loop_location::boundary) {
+                return location == loop_location::inside;
+            }
+        }
+        return false;
+    }
+
+} // anonymous namespace
+
+const char* AreaValidator::add_ring(const osmium::NodeRefList& ring, uint32_t polygon, bool outer) {
+    ring_info info{m_segments.size(), 0, polygon, outer, 0, 0, 0, 0};
+    const auto ring_id = static_cast<uint32_t>(m_rings.size());
+
+    osmium::Location last{};
+    for (const auto& node_ref : ring) {
+        const auto location = node_ref.location();
+        if (!location.valid()) {
+            return "invalid location";
+        }
+        if (last.valid() && location != last) {
+            m_segments.push_back(segment{last, location,
+                                         std::min(last.x(), location.x()),
+                                         std::max(last.x(), location.x()),
+                                         ring_id,
+                                         info.num_segments});
+            ++info.num_segments;
+        }
+        if (!last.valid()) {
+            info.min_x = info.max_x = location.x();
+            info.min_y = info.max_y = location.y();
+        } else {
+            info.min_x = std::min(info.min_x, location.x());
+            info.min_y = std::min(info.min_y, location.y());
+            info.max_x = std::max(info.max_x, location.x());
+            info.max_y = std::max(info.max_y, location.y());
+        }
+        last = location;
+    }
+
+    if (info.num_segments < 3) {
+        return "ring with fewer than three different points";
+    }
+
+    if (m_segments[info.first_segment].first != m_segments.back().second) {
+        return "ring not closed";
+    }
+
+    m_rings.push_back(info);
+    return nullptr;
+}
+
+const char* AreaValidator::check_segment_pair(const segment& s1, const segment& s2) {
+    if (s1.ring == s2.ring) {
+        const auto n = m_rings[s1.ring].num_segments;
+        const bool adjacent = (s1.index + 1) % n == s2.index || (s2.index + 1) % n == s1.index;
+        if (adjacent) {
+            // Adjacent segments share a point. They are only a problem if
+            // the ring goes back on itself.
+            const bool s1_first = (s1.index + 1) % n == s2.index;
+            const auto& a = s1_first ? s1 : s2;
+            const auto& b = s1_first ? s2 : s1;
+            if (orientation(a.first, a.second, b.second) == 0 &&
+                !on_segment(a.first, b.second, a.second)) {
+                return "spike in ring";
+            }
+            return nullptr;
+        }
+    }
+
+    const int d1 = orientation(s2.first, s2.second, s1.first);
+    const int d2 = orientation(s2.first, s2.second, s1.second);
+    const int d3 = orientation(s1.first, s1.second, s2.first);
+    const int d4 = orientation(s1.first, s1.second, s2.second);
+
+    osmium::Location touch_location{};
+
+    if (d1 == 0 && d2 == 0 && d3 == 0 && d4 == 0) {
+        // Collinear segments, find out whether they overlap.
+        const auto lo = std::max(std::min(s1.first, s1.second), std::min(s2.first, s2.second));
+        const auto hi = std::min(std::max(s1.first, s1.second), std::max(s2.first, s2.second));
+        if (lo < hi) {
+            return "overlapping segments";
+        }
+        if (hi < lo) {
+            return nullptr;
+        }
+        touch_location = lo;
+    } else if (d1 * d2 < 0 && d3 * d4 < 0) {
+        return "crossing segments";
+    } else if (d1 == 0 && on_segment(s2.first, s2.second, s1.first)) {
+        touch_location = s1.first;
+    } else if (d2 == 0 && on_segment(s2.first, s2.second, s1.second)) {
+        touch_location = s1.second;
+    } else if (d3 == 0 && on_segment(s1.first, s1.second, s2.first)) {
+        touch_location = s2.first;
+    } else if (d4 == 0 && on_segment(s1.first, s1.second, s2.second)) {
+        touch_location = s2.second;
+    } else {
+        return nullptr;
+    }
+
+    // Whether a ring may touch itself depends on the rings formed by the
+    // touch, this is checked later.
+    if (s1.ring == s2.ring) {
+        m_self_touches.push_back(touch{s1.ring, s1.ring, touch_location});
+        return nullptr;
+    }
+
+    const auto ring1 = std::min(s1.ring, s2.ring);
+    const auto ring2 = std::max(s1.ring, s2.ring);
+
+    // Rings of different polygons can touch in any number of points.
+    if (m_rings[ring1].polygon == m_rings[ring2].polygon) {
+        for (const auto& t : m_touches) {
+            if (t.ring1 == ring1 && t.ring2 == ring2 && t.location != touch_location) {
+                return "rings touch in more than one point";
+            }
+        }
+    }
+
+    m_touches.push_back(touch{ring1, ring2, touch_location});
+    return nullptr;
+}
+
+const char* AreaValidator::check_segments() {
+    m_order.resize(m_segments.size());
+    for (std::size_t i = 0; i < m_order.size(); ++i) {
+        m_order[i] = i;
+    }
+    std::sort(m_order.begin(), m_order.end(), [this](std::size_t a, std::size_t b) {
+        return m_segments[a].min_x < m_segments[b].min_x;
+    });
+
+    // Sweep from left to right keeping a list of segments that overlap the
+    // current x coordinate.
+    m_active.clear();
+    for (const auto n : m_order) {
+        const auto& seg = m_segments[n];
+        m_active.erase(std::remove_if(m_active.begin(), m_active.end(), [&](std::size_t a) {
+            return m_segments[a].max_x < seg.min_x;
+        }), m_active.end());
+
+        const auto seg_min_y = std::min(seg.first.y(), seg.second.y());
+        const auto seg_max_y = std::max(seg.first.y(), seg.second.y());
+        for (const auto a : m_active) {
+            const auto& other = m_segments[a];
+            if (std::max(other.first.y(), other.second.y()) < seg_min_y ||
+                std::min(other.first.y(), other.second.y()) > seg_max_y) {
+                continue;
+            }
+            const char* problem = check_segment_pair(other, seg);
+            if (problem) {
+                return problem;
+            }
+        }
+        m_active.push_back(n);
+    }
+
+    return nullptr;
+}
+
+// Split the ring at the location where it touches itself into two loops.
+// The location can be a point of the ring or inside one of its segments.
+// If the ring goes through the location more than twice, the second loop
+// is left empty.
+void AreaValidator::split_ring(uint32_t ring, osmium::Location location) {
+    const auto& info = m_rings[ring];
+
+    m_loop1.clear();
+    m_loop2.clear();
+
+    // All points of the ring starting from the first time it goes through
+    // the location are collected into m_loop1 first.
+    std::size_t count = 0;
+    std::size_t split = 0;
+    for (std::size_t i = info.first_segment; i < info.first_segment + info.num_segments; ++i) {
+        const auto& seg = m_segments[i];
+        if (seg.first == location) {
+            ++count;
+            if (count == 2) {
+                split = m_loop2.size();
+            }
+        }
+        (count == 0 ? m_loop1 : m_loop2).push_back(seg.first);
+        if (seg.first != location && seg.second != location &&
+            orientation(seg.first, seg.second, location) == 0 &&
+            on_segment(seg.first, seg.second, location)) {
+            ++count;
+            if (count == 2) {
+                split = m_loop2.size();
+            }
+            (count == 0 ? m_loop1 : m_loop2).push_back(location);
+        }
+    }
+
+    if (count != 2) {
+        m_loop2.clear();
+        return;
+    }
+
+    // m_loop2 now starts with the location, then goes around the ring to
+    // the location again (at split) and on to the end, m_loop1 has the
+    // points from the start of the ring up to the location.
+    std::vector<osmium::Location> rest{m_loop2.begin() + static_cast<std::ptrdiff_t>(split), m_loop2.end()};
+    rest.insert(rest.end(), m_loop1.begin(), m_loop1.end());
+    rest.push_back(location);
+
+    m_loop2.resize(split + 1);
+    m_loop1 = std::move(rest);
+}
+
+const char* AreaValidator::check_self_touch(const touch* begin, const touch* end, const touch& self_touch) {
+    split_ring(self_touch.ring1, self_touch.location);
+    if (m_loop2.empty()) {
+        return "ring touches itself";
+    }
+
+    // If the loops touch in another point, the interior is split.
+    for (const auto* other = begin; other != end; ++other) {
+        if (other->location != self_touch.location &&
+            location_in_loop(other->location, m_loop1) == loop_location::boundary &&
+            location_in_loop(other->location, m_loop2) == loop_location::boundary) {
+            return "ring touches itself";
+        }
+    }
+
+    // An outer ring can touch itself to form a hole, in that case one loop
+    // is inside the other. An inner ring can touch itself to form two holes
+    // touching in a point, in that case the loops are outside each other.
+    const bool nested = loop_inside(m_loop1, m_loop2) || loop_inside(m_loop2, m_loop1);
+    if (nested != m_rings[self_touch.ring1].outer) {
+        return "ring touches itself";
+    }
+
+    return nullptr;
+}
+
+const char* AreaValidator::check_self_touches() {
+    if (!m_self_touching_ring_forming_hole_valid && !m_self_touches.empty()) {
+        return "ring touches itself";
+    }
+
+    std::sort(m_self_touches.begin(), m_self_touches.end(), [](const touch& lhs, const touch& rhs) {
+        return std::tie(lhs.ring1, lhs.location) < std::tie(rhs.ring1, rhs.location);
+    });
+    m_self_touches.erase(std::unique(m_self_touches.begin(), m_self_touches.end(), [](const touch& lhs, const touch& rhs) {
+        return lhs.ring1 == rhs.ring1 && lhs.location == rhs.location;
+    }), m_self_touches.end());
+
+    const auto* begin = m_self_touches.data();
+    const auto* end = begin + m_self_touches.size();
+    while (begin != end) {
+        const auto* ring_end = std::find_if(begin, end, [begin](const touch& t) {
+            return t.ring1 != begin->ring1;
+        });
+        for (const auto* t = begin; t != ring_end; ++t) {
+            const char* problem = check_self_touch(begin, ring_end, *t);
+            if (problem) {
+                return problem;
+            }
+        }
+        begin = ring_end;
+    }
+
+    return nullptr;
+}
+
+bool AreaValidator::touches(uint32_t ring1, uint32_t ring2) const noexcept {
+    if (ring1 > ring2) {
+        std::swap(ring1, ring2);
+    }
+    return std::any_of(m_touches.cbegin(), m_touches.cend(), [&](const touch& t) {
+        return t.ring1 == ring1 && t.ring2 == ring2;
+    });
+}
+
+AreaValidator::point_location AreaValidator::location_in_ring(osmium::Location point, uint32_t ring) const noexcept {
+    const auto& info = m_rings[ring];
+    if (point.x() < info.min_x || point.x() > info.max_x ||
+        point.y() < info.min_y || point.y() > info.max_y) {
+        return point_location::outside;
+    }
+
+    // Crossing number test
+    bool inside = false;
+    for (std::size_t i = info.first_segment; i < info.first_segment + info.num_segments; ++i) {
+        const auto& seg = m_segments[i];
+        const int o = orientation(seg.first, seg.second, point);
+        if (o == 0 && on_segment(seg.first, seg.second, point)) {
+            return point_location::boundary;
+        }
+        if ((seg.first.y() > point.y()) != (seg.second.y() > point.y())) {
+            // segment goes upwards: point is left of it if orientation is positive
+            if ((seg.second.y() > seg.first.y()) ? (o > 0) : (o < 0)) {
+                inside = !inside;
+            }
+        }
+    }
+
+    return inside ? point_location::inside : point_location::outside;
+}
+
+AreaValidator::point_location AreaValidator::location_in_polygon(osmium::Location point, uint32_t outer_ring) const noexcept {
+    const auto location = location_in_ring(point, outer_ring);
+    if (location != point_location::inside) {
+        return location;
+    }
+
+    const auto polygon = m_rings[outer_ring].polygon;
+    for (auto ring = outer_ring + 1; ring < m_rings.size() && m_rings[ring].polygon == polygon; ++ring) {
+        switch (location_in_ring(point, ring)) {
+            case point_location::inside:
+                return point_location::outside;
+            case point_location::boundary:
+                return point_location::boundary;
+            case point_location::outside:
+                break;
+        }
+    }
+
+    return point_location::inside;
+}
+
+const char* AreaValidator::check_ring_pair(uint32_t ring1, uint32_t ring2) const {
+    const auto& r1 = m_rings[ring1];
+    const auto& r2 = m_rings[ring2];
+    const bool all = touches(ring1, ring2);
+
+    const auto in_ring = [this](uint32_t ring) {
+        return [this, ring](osmium::Location point) {
+            return location_in_ring(point, ring);
+        };
+    };
+
+    if (r1.polygon == r2.polygon) {
+        if (r1.outer != r2.outer) {
+            const auto inner = r1.outer ? ring2 : ring1;
+            const auto outer = r1.outer ? ring1 : ring2;
+            if (any_point_at(m_rings[inner], all, point_location::outside, in_ring(outer))) {
+                return "inner ring outside outer ring";
+            }
+        } else if (any_point_at(r1, all, point_location::inside, in_ring(ring2)) ||
+                   any_point_at(r2, all, point_location::inside, in_ring(ring1))) {
+            return "nested inner rings";
+        }
+        return nullptr;
+    }
+
+    if (r1.outer && r2.outer) {
+        const auto in_polygon = [this](uint32_t ring) {
+            return [this, ring](osmium::Location point) {
+                return location_in_polygon(point, ring);
+            };
+        };
+        if (any_point_at(r1, all, point_location::inside, in_polygon(ring2)) ||
+            any_point_at(r2, all, point_location::inside, in_polygon(ring1))) {
+            return "outer ring inside other polygon";
+        }
+    }
+
+    return nullptr;
+}
+
+const char* AreaValidator::check_containment() {
+    // An inner ring can only be inside its outer ring if its bounding box
+    // is inside that of the outer ring. The other case is not found by the
+    // sweep below.
+    const ring_info* outer = nullptr;
+    for (const auto& ring : m_rings) {
+        if (ring.outer) {
+            outer = &ring;
+        } else if (ring.min_x < outer->min_x || ring.max_x > outer->max_x ||
+                   ring.min_y < outer->min_y || ring.max_y > outer->max_y) {
+            return "inner ring outside outer ring";
+        }
+    }
+
+    m_order.resize(m_rings.size());
+    for (std::size_t i = 0; i < m_order.size(); ++i) {
+        m_order[i] = i;
+    }
+    std::sort(m_order.begin(), m_order.end(), [this](std::size_t a, std::size_t b) {
+        return m_rings[a].min_x < m_rings[b].min_x;
+    });
+
+    // Only rings with overlapping bounding boxes can be inside each other.
+    m_active.clear();
+    for (const auto n : m_order) {
+        const auto& ring = m_rings[n];
+        m_active.erase(std::remove_if(m_active.begin(), m_active.end(), [&](std::size_t a) {
+            return m_rings[a].max_x < ring.min_x;
+        }), m_active.end());
+
+        for (const auto a : m_active) {
+            const auto& other = m_rings[a];
+            if (other.max_y < ring.min_y || other.min_y > ring.max_y) {
+                continue;
+            }
+            const char* problem = check_ring_pair(static_cast<uint32_t>(a), static_cast<uint32_t>(n));
+            if (problem) {
+                return problem;
+            }
+        }
+        m_active.push_back(n);
+    }
+
+    return nullptr;
+}
+
+const char* AreaValidator::check(const osmium::Area& area) {
+    m_segments.clear();
+    m_rings.clear();
+    m_touches.clear();
+    m_self_touches.clear();
+
+    uint32_t polygon = 0;
+    for (const auto& outer : area.outer_rings()) {
+        const char* problem = add_ring(outer, polygon, true);
+        if (problem) {
+            return problem;
+        }
+        for (const auto& inner : area.inner_rings(outer)) {
+            problem = add_ring(inner, polygon, false);
+            if (problem) {
+                return problem;
+            }
+        }
+        ++polygon;
+    }
+
+    if (m_rings.empty()) {
+        return "area without rings";
+    }
+
+    const char* problem = check_segments();
+    if (problem) {
+        return problem;
+    }
+
+    problem = check_self_touches();
+    if (problem) {
+        return problem;
+    }
+
+    return check_containment();
+}
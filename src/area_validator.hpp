@@ -0,0 +1,139 @@
+#ifndef AREA_VALIDATOR_HPP
+#define AREA_VALIDATOR_HPP
+
+#include <osmium/osm/area.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node_ref_list.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Checks validity of areas (in the OGC simple features sense) working
+ * directly on the rings of an osmium::Area without creating OGR or GEOS
+ * geometries. Segment intersections are found with a sweep-line over the
+ * segments of all rings, coordinates are compared exactly in the integer
+ * coordinates used by osmium::Location.
+ *
+ * An area is invalid if
+ * - a ring has fewer than three different points or isn't closed,
+ * - segments cross or overlap,
+ * - a ring touches itself in a way that disconnects the interior: an outer
+ *   ring may touch itself in a point to form a hole and an inner ring may
+ *   touch itself to form two holes touching in a point (this is what GEOS
+ *   allows with setSelfTouchingRingFormingHoleValid(true), it can be
+ *   switched off to get the default GEOS rules),
+ * - an inner ring touches its outer ring or another inner ring of the same
+ *   polygon in more than one point,
+ * - an inner ring is not inside its outer ring, or inside another inner ring,
+ * - an outer ring is inside the interior of another polygon.
+ *
+ * Not thread-safe, use one validator per thread. The validator keeps its
+ * buffers between calls to avoid allocations.
+ */
+class AreaValidator {
+
+    struct segment {
+        osmium::Location first;
+        osmium::Location second;
+        int32_t min_x;
+        int32_t max_x;
+        uint32_t ring;
+        uint32_t index;
+    };
+
+    struct ring_info {
+        std::size_t first_segment;
+        uint32_t num_segments;
+        uint32_t polygon;
+        bool outer;
+        int32_t min_x;
+        int32_t min_y;
+        int32_t max_x;
+        int32_t max_y;
+    };
+
+    struct touch {
+        uint32_t ring1;
+        uint32_t ring2;
+        osmium::Location location;
+    };
+
+    enum class point_location {
+        outside,
+        boundary,
+        inside
+    };
+
+    std::vector<segment> m_segments;
+    std::vector<ring_info> m_rings;
+    std::vector<touch> m_touches;
+    std::vector<touch> m_self_touches;
+    std::vector<osmium::Location> m_loop1;
+    std::vector<osmium::Location> m_loop2;
+    std::vector<std::size_t> m_order;
+    std::vector<std::size_t> m_active;
+
+    bool m_self_touching_ring_forming_hole_valid = true;
+
+    const char* add_ring(const osmium::NodeRefList& ring, uint32_t polygon, bool outer);
+
+    const char* check_segment_pair(const segment& s1, const segment& s2);
+
+    const char* check_segments();
+
+    void split_ring(uint32_t ring, osmium::Location location);
+
+    const char* check_self_touch(const touch* begin, const touch* end, const touch& self_touch);
+
+    const char* check_self_touches();
+
+    bool touches(uint32_t ring1, uint32_t ring2) const noexcept;
+
+    point_location location_in_ring(osmium::Location point, uint32_t ring) const noexcept;
+
+    point_location location_in_polygon(osmium::Location point, uint32_t outer_ring) const noexcept;
+
+    // Is any point of the ring at the wanted location according to func?
+    // If all is false, only the first point not on the boundary is tested.
+    // If the rings don't touch, this is enough, because we already know
+    // that no segments cross.
+    template <typename TFunc>
+    bool any_point_at(const ring_info& ring, bool all, point_location wanted, TFunc&& func) const {
+        for (std::size_t i = ring.first_segment; i < ring.first_segment + ring.num_segments; ++i) {
+            const auto location = func(m_segments[i].first);
+            if (location == wanted) {
+                return true;
+            }
+            if (!all && location != point_location::boundary) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    const char* check_ring_pair(uint32_t ring1, uint32_t ring2) const;
+
+    const char* check_containment();
+
+public:
+
+    /**
+     * Set whether rings touching themselves to form holes are valid
+     * (default: true). If this is false, any ring touching itself is
+     * invalid as in the default GEOS and OGR checks.
+     */
+    void set_self_touching_ring_forming_hole_valid(bool valid) noexcept {
+        m_self_touching_ring_forming_hole_valid = valid;
+    }
+
+    /**
+     * Check the area. Returns nullptr if the area is valid, a description
+     * of the (first found) problem otherwise.
+     */
+    const char* check(const osmium::Area& area);
+
+}; // class AreaValidator
+
+#endif // AREA_VALIDATOR_HPP
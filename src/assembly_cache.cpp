@@ -0,0 +1,246 @@
+/*****************************************************************************
+
+  OSM Area Tools - Assembly cache
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "assembly_cache.hpp"
+
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/writer_options.hpp>
+#include <osmium/version.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    constexpr const char cache_magic[8] = {'O', 'A', 'T', 'C', 'A', 'C', 'H', 'E'};
+
+    // Increase this when the format of the entries changes.
+    constexpr const uint32_t cache_version = 2;
+
+    constexpr const uint32_t osmium_version = LIBOSMIUM_VERSION_MAJOR * 10000 +
+                                              LIBOSMIUM_VERSION_MINOR * 100 +
+                                              LIBOSMIUM_VERSION_PATCH;
+
+    static_assert(sizeof(cache_header) == 64, "cache header must be 64 bytes");
+    static_assert(sizeof(cache_index_entry) == 40, "cache index entry must be 40 bytes");
+
+    // FNV-1a hash of the compiler version and the sizes of basic types.
+    uint64_t build_stamp() noexcept {
+        uint64_t hash = 14695981039346656037ULL;
+        const auto add = [&hash](unsigned char c) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        };
+        for (const char* p = __VERSION__; *p; ++p) {
+            add(static_cast<unsigned char>(*p));
+        }
+        add(sizeof(std::size_t));
+        add(sizeof(void*));
+        return hash;
+    }
+
+    bool id_order(const cache_index_entry& lhs, const cache_index_entry& rhs) noexcept {
+        return lhs.id < rhs.id;
+    }
+
+    std::string tmp_filename(const std::string& filename) {
+        return filename + ".tmp";
+    }
+
+    std::string new_filename(const std::string& filename) {
+        return filename + ".new";
+    }
+
+    uint64_t padded_size(uint64_t size) noexcept {
+        return size + (8 - size % 8) % 8;
+    }
+
+    void write_padded(int fd, const char* data, std::size_t size) {
+        static const std::array<char, 8> zeros{};
+        osmium::io::detail::reliable_write(fd, data, size);
+        osmium::io::detail::reliable_write(fd, zeros.data(), static_cast<std::size_t>(padded_size(size) - size));
+    }
+
+    std::unique_ptr<ReadOnlyMapping> map_file(const std::string& filename, std::size_t size) {
+        const int fd = ::open(filename.c_str(), O_RDONLY); // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+        if (fd < 0) {
+            throw std::system_error{errno, std::system_category(), "Can not open '" + filename + "'"};
+        }
+        std::unique_ptr<ReadOnlyMapping> mapping;
+        try {
+            mapping = std::make_unique<ReadOnlyMapping>(fd, size, 0);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        return mapping;
+    }
+
+    // An entry which could go into the new cache file.
+    struct candidate {
+        const cache_index_entry* entry;
+        const char* data;
+        uint64_t run;
+    };
+
+} // anonymous namespace
+
+AssemblyCache::AssemblyCache(std::string filename, std::size_t max_size) :
+    m_filename(std::move(filename)),
+    m_max_size(max_size),
+    m_fd(osmium::io::detail::open_for_writing(tmp_filename(m_filename), osmium::io::overwrite::allow)) {
+    const int fd = ::open(m_filename.c_str(), O_RDONLY); // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+    if (fd < 0) {
+        return;
+    }
+
+    // A cache file that can't be used is just ignored, it will be
+    // replaced by the new one.
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(cache_header)) {
+        ::close(fd);
+        return;
+    }
+
+    try {
+        m_mapping = std::make_unique<ReadOnlyMapping>(fd, static_cast<std::size_t>(st.st_size), 0);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+
+    std::memcpy(&m_header, m_mapping->get<cache_header>(), sizeof(cache_header));
+    if (std::memcmp(m_header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+        m_header.version != cache_version ||
+        m_header.osmium_version != osmium_version ||
+        m_header.build != build_stamp() ||
+        sizeof(cache_header) + m_header.data_size + m_header.index_count * sizeof(cache_index_entry) != static_cast<uint64_t>(st.st_size)) {
+        m_mapping.reset();
+        m_header = cache_header{};
+        return;
+    }
+
+    m_used.resize(m_header.index_count);
+}
+
+AssemblyCache::~AssemblyCache() noexcept {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        ::unlink(tmp_filename(m_filename).c_str());
+    }
+}
+
+std::pair<const char*, std::size_t> AssemblyCache::get(osmium::object_id_type id, uint64_t hash) {
+    if (m_mapping) {
+        const auto* begin = index_begin();
+        const auto* end = begin + m_header.index_count;
+        const auto* it = std::lower_bound(begin, end, cache_index_entry{id, 0, 0, 0, 0}, id_order);
+        if (it != end && it->id == id && it->hash == hash) {
+            const std::lock_guard<std::mutex> lock{m_mutex};
+            m_used[static_cast<std::size_t>(it - begin)] = true;
+            ++m_hits;
+            return {data() + it->offset, static_cast<std::size_t>(it->size)};
+        }
+    }
+
+    const std::lock_guard<std::mutex> lock{m_mutex};
+    ++m_misses;
+    return {nullptr, 0};
+}
+
+void AssemblyCache::put(osmium::object_id_type id, uint64_t hash, const std::string& entry_data) {
+    const std::lock_guard<std::mutex> lock{m_mutex};
+    write_padded(m_fd, entry_data.data(), entry_data.size());
+    m_index.push_back(cache_index_entry{id, hash, m_data_size, entry_data.size(), m_header.run + 1});
+    m_data_size += padded_size(entry_data.size());
+}
+
+void AssemblyCache::close() {
+    const std::lock_guard<std::mutex> lock{m_mutex};
+    const uint64_t run = m_header.run + 1;
+
+    osmium::io::detail::reliable_close(m_fd);
+    m_fd = -1;
+    const auto added_entries = map_file(tmp_filename(m_filename), static_cast<std::size_t>(m_data_size));
+
+    std::vector<candidate> candidates;
+    std::vector<int64_t> added;
+    added.reserve(m_index.size());
+    for (const auto& entry : m_index) {
+        candidates.push_back(candidate{&entry, added_entries->get<char>() + entry.offset, run});
+        added.push_back(entry.id);
+    }
+    std::sort(added.begin(), added.end());
+
+    // Old entries used in this run count as used now, entries replaced in
+    // this run are dropped.
+    if (m_mapping) {
+        const auto* old_index = index_begin();
+        for (std::size_t n = 0; n < m_header.index_count; ++n) {
+            const auto& entry = old_index[n];
+            if (!std::binary_search(added.cbegin(), added.cend(), entry.id)) {
+                candidates.push_back(candidate{&entry, data() + entry.offset, m_used[n] ? run : entry.run});
+            }
+        }
+    }
+
+    // Keep the entries used most recently as long as the file stays below
+    // the maximum size.
+    std::stable_sort(candidates.begin(), candidates.end(), [](const candidate& lhs, const candidate& rhs) {
+        return lhs.run > rhs.run;
+    });
+
+    const int fd = osmium::io::detail::open_for_writing(new_filename(m_filename), osmium::io::overwrite::allow);
+    cache_header header{};
+    osmium::io::detail::reliable_write(fd, reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<cache_index_entry> index;
+    uint64_t data_size = 0;
+    for (const auto& c : candidates) {
+        const auto size = padded_size(c.entry->size);
+        if (sizeof(cache_header) + data_size + size + (index.size() + 1) * sizeof(cache_index_entry) > m_max_size) {
+            break;
+        }
+        write_padded(fd, c.data, static_cast<std::size_t>(c.entry->size));
+        index.push_back(cache_index_entry{c.entry->id, c.entry->hash, data_size, c.entry->size, c.run});
+        data_size += size;
+    }
+
+    std::sort(index.begin(), index.end(), id_order);
+    osmium::io::detail::reliable_write(fd, reinterpret_cast<const char*>(index.data()), index.size() * sizeof(cache_index_entry));
+
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.osmium_version = osmium_version;
+    header.run = run;
+    header.data_size = data_size;
+    header.index_count = index.size();
+    header.build = build_stamp();
+
+    if (::lseek(fd, 0, SEEK_SET) != 0) {
+        throw std::system_error{errno, std::system_category(), "Seek failed on cache file"};
+    }
+    osmium::io::detail::reliable_write(fd, reinterpret_cast<const char*>(&header), sizeof(header));
+    osmium::io::detail::reliable_close(fd);
+
+    m_mapping.reset();
+    ::unlink(tmp_filename(m_filename).c_str());
+    if (std::rename(new_filename(m_filename).c_str(), m_filename.c_str()) != 0) {
+        throw std::system_error{errno, std::system_category(), "Can not rename '" + new_filename(m_filename) + "'"};
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef ASSEMBLY_CACHE_HPP
+#define ASSEMBLY_CACHE_HPP
+
+#include "read_only_mapping.hpp"
+
+#include <osmium/osm/types.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * An assembly cache file keeps the results of assembling relations from
+ * one run to the next. Each entry belongs to a relation ID and has the
+ * hash of everything the result depends on, an entry is only used if the
+ * hash is the same.
+ *
+ * header - cache_header (64 bytes)
+ * data   - the entries, each padded to a multiple of 8 bytes
+ * index  - cache_index_entry for each entry sorted by relation ID
+ *
+ * The entries contain osmium buffers and problem records in the memory
+ * layout of the program that wrote them, so a cache file is only used by
+ * a program built with the same compiler and libosmium version.
+ *
+ * The old cache file is mapped into memory for lookups, new entries are
+ * written into a temporary file next to it. In close() the new cache file
+ * is written from the entries used or added in this run and the entries
+ * from earlier runs, most recently used first, as long as the file stays
+ * below its maximum size. It then replaces the old file.
+ */
+
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t osmium_version; // libosmium version the file was written with
+    uint64_t run;
+    uint64_t data_size;
+    uint64_t index_count;
+    uint64_t build;          // stamp of the compiler used
+    uint64_t padding[2];
+};
+
+struct cache_index_entry {
+    int64_t id;
+    uint64_t hash;
+    uint64_t offset; // into data section
+    uint64_t size;
+    uint64_t run;    // run this entry was last used in
+};
+
+class AssemblyCache {
+
+    std::string m_filename;
+    std::size_t m_max_size;
+
+    // The cache from the last run
+    std::unique_ptr<ReadOnlyMapping> m_mapping;
+    cache_header m_header{};
+    std::vector<bool> m_used;
+
+    // The entries added in this run (offsets are into the temporary file)
+    int m_fd;
+    uint64_t m_data_size = 0;
+    std::vector<cache_index_entry> m_index;
+
+    std::size_t m_hits = 0;
+    std::size_t m_misses = 0;
+
+    std::mutex m_mutex;
+
+    const char* data() const noexcept {
+        return m_mapping ? m_mapping->get<char>() + sizeof(cache_header) : nullptr;
+    }
+
+    const cache_index_entry* index_begin() const noexcept {
+        return reinterpret_cast<const cache_index_entry*>(data() + m_header.data_size);
+    }
+
+
+public:
+
+    /**
+     * Open the cache in filename. If the file doesn't exist or can't be
+     * used, the cache starts out empty.
+     */
+    AssemblyCache(std::string filename, std::size_t max_size);
+
+    AssemblyCache(const AssemblyCache&) = delete;
+    AssemblyCache& operator=(const AssemblyCache&) = delete;
+
+    AssemblyCache(AssemblyCache&&) = delete;
+    AssemblyCache& operator=(AssemblyCache&&) = delete;
+
+    ~AssemblyCache() noexcept;
+
+    /**
+     * Look up the entry for the relation. Returns the data and its size or
+     * nullptr if there is no entry with this hash. The data stays valid
+     * until the cache is closed. Can be called from several threads.
+     */
+    std::pair<const char*, std::size_t> get(osmium::object_id_type id, uint64_t hash);
+
+    /**
+     * Add an entry for the relation. Can be called from several threads.
+     */
+    void put(osmium::object_id_type id, uint64_t hash, const std::string& entry_data);
+
+    std::size_t hits() const noexcept {
+        return m_hits;
+    }
+
+    std::size_t misses() const noexcept {
+        return m_misses;
+    }
+
+    /**
+     * Write the new cache file with at most the maximum size. It is not
+     * used if this isn't called.
+     */
+    void close();
+
+}; // class AssemblyCache
+
+#endif // ASSEMBLY_CACHE_HPP
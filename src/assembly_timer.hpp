@@ -0,0 +1,185 @@
+#ifndef ASSEMBLY_TIMER_HPP
+#define ASSEMBLY_TIMER_HPP
+
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+/**
+ * Collects the time needed for each assembler run: A histogram of the
+ * times with buckets for powers of two microseconds (separately for areas
+ * from ways and from relations) and the N relations which took longest to
+ * assemble. Timers from several worker threads can be added up.
+ */
+class AssemblyTimer {
+
+public:
+
+    using clock = std::chrono::steady_clock;
+
+    enum : std::size_t {
+        num_buckets = 40
+    };
+
+    struct relation_time {
+        uint64_t microseconds;
+        osmium::object_id_type id;
+        std::size_t members;
+        std::size_t segments;
+    };
+
+private:
+
+    std::array<uint64_t, num_buckets> m_ways{};
+    std::array<uint64_t, num_buckets> m_relations{};
+    uint64_t m_way_time = 0;
+    uint64_t m_relation_time = 0;
+
+    // Min-heap on the time, so the fastest of the slowest is on top.
+    std::vector<relation_time> m_slowest;
+    std::size_t m_max_slowest;
+
+    static bool slower(const relation_time& lhs, const relation_time& rhs) noexcept {
+        return lhs.microseconds > rhs.microseconds;
+    }
+
+    // Bucket 0 is for times below one microsecond, bucket n for times
+    // from 2^(n-1) to 2^n-1 microseconds.
+    static std::size_t bucket(uint64_t microseconds) noexcept {
+        std::size_t n = 0;
+        while (microseconds > 0 && n < num_buckets - 1) {
+            microseconds >>= 1U;
+            ++n;
+        }
+        return n;
+    }
+
+    void add_slowest(const relation_time& time) {
+        if (m_max_slowest == 0) {
+            return;
+        }
+        if (m_slowest.size() < m_max_slowest) {
+            m_slowest.push_back(time);
+            std::push_heap(m_slowest.begin(), m_slowest.end(), slower);
+        } else if (time.microseconds > m_slowest.front().microseconds) {
+            std::pop_heap(m_slowest.begin(), m_slowest.end(), slower);
+            m_slowest.back() = time;
+            std::push_heap(m_slowest.begin(), m_slowest.end(), slower);
+        }
+    }
+
+public:
+
+    explicit AssemblyTimer(std::size_t max_slowest) :
+        m_max_slowest(max_slowest) {
+        m_slowest.reserve(max_slowest);
+    }
+
+    static uint64_t elapsed(clock::time_point start) noexcept {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count());
+    }
+
+    std::size_t max_slowest() const noexcept {
+        return m_max_slowest;
+    }
+
+    const std::array<uint64_t, num_buckets>& way_histogram() const noexcept {
+        return m_ways;
+    }
+
+    const std::array<uint64_t, num_buckets>& relation_histogram() const noexcept {
+        return m_relations;
+    }
+
+    void add_way(uint64_t microseconds) noexcept {
+        ++m_ways[bucket(microseconds)];
+        m_way_time += microseconds;
+    }
+
+    void add_relation(const osmium::Relation& relation, const std::vector<const osmium::Way*>& members, uint64_t microseconds) {
+        ++m_relations[bucket(microseconds)];
+        m_relation_time += microseconds;
+
+        std::size_t segments = 0;
+        for (const auto* way : members) {
+            if (!way->nodes().empty()) {
+                segments += way->nodes().size() - 1;
+            }
+        }
+        add_slowest(relation_time{microseconds, relation.id(), relation.members().size(), segments});
+    }
+
+    AssemblyTimer& operator+=(const AssemblyTimer& other) {
+        for (std::size_t i = 0; i < num_buckets; ++i) {
+            m_ways[i] += other.m_ways[i];
+            m_relations[i] += other.m_relations[i];
+        }
+        m_way_time += other.m_way_time;
+        m_relation_time += other.m_relation_time;
+        for (const auto& time : other.m_slowest) {
+            add_slowest(time);
+        }
+        return *this;
+    }
+
+    /**
+     * The slowest relations, slowest first.
+     */
+    std::vector<relation_time> slowest() const {
+        std::vector<relation_time> result{m_slowest};
+        std::sort(result.begin(), result.end(), slower);
+        return result;
+    }
+
+    /**
+     * Lower and upper bound of the times in a bucket in microseconds.
+     */
+    static std::pair<uint64_t, uint64_t> bucket_range(std::size_t n) noexcept {
+        if (n == 0) {
+            return {0, 0};
+        }
+        return {1ULL << (n - 1), (1ULL << n) - 1};
+    }
+
+    void print(std::ostream& out) const {
+        out << "Assembly times (microseconds):\n"
+            << "  total for ways:      " << m_way_time << '\n'
+            << "  total for relations: " << m_relation_time << '\n'
+            << "            from -           to         ways    relations\n";
+        for (std::size_t i = 0; i < num_buckets; ++i) {
+            if (m_ways[i] == 0 && m_relations[i] == 0) {
+                continue;
+            }
+            const auto range = bucket_range(i);
+            out << "  " << std::setw(14) << range.first << " - " << std::setw(12) << range.second
+                << ' ' << std::setw(12) << m_ways[i]
+                << ' ' << std::setw(12) << m_relations[i] << '\n';
+        }
+
+        const auto times = slowest();
+        if (times.empty()) {
+            return;
+        }
+        out << "Slowest relations:\n"
+            << "     microseconds  relation_id   members   segments\n";
+        for (const auto& time : times) {
+            out << "  " << std::setw(15) << time.microseconds
+                << ' ' << std::setw(12) << time.id
+                << ' ' << std::setw(9) << time.members
+                << ' ' << std::setw(10) << time.segments << '\n';
+        }
+    }
+
+}; // class AssemblyTimer
+
+#endif // ASSEMBLY_TIMER_HPP
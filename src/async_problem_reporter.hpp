@@ -0,0 +1,133 @@
+#ifndef ASYNC_PROBLEM_REPORTER_HPP
+#define ASYNC_PROBLEM_REPORTER_HPP
+
+#include "async_writer.hpp"
+#include "problem_recorder.hpp"
+
+#include <osmium/area/problem_reporter.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node_ref.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <cstddef>
+#include <utility>
+
+/**
+ * Problem reporter that records the problems in batches and hands the
+ * batches off to a thread which reports them to the real problem reporter.
+ * This keeps slow problem reporters (writing to a database or formatting
+ * output) out of the assembly.
+ *
+ * All problems must be reported from the same thread. The real problem
+ * reporter is only used from the background thread (or from the reporting
+ * thread if the queue size is 0), so it must not be used by anything
+ * else until close() was called.
+ */
+class AsyncProblemReporter : public ProblemRecorder {
+
+    enum : std::size_t {
+        batch_size = 1000
+    };
+
+    AsyncWriter<ProblemRecorder> m_writer;
+
+    void flush_if_full() {
+        if (size() >= batch_size) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (empty()) {
+            return;
+        }
+        m_writer.push(ProblemRecorder{std::move(static_cast<ProblemRecorder&>(*this))});
+        clear();
+    }
+
+public:
+
+    AsyncProblemReporter(osmium::area::ProblemReporter& reporter, std::size_t queue_size) :
+        m_writer(queue_size, [&reporter](ProblemRecorder& batch) {
+            batch.replay(reporter);
+        }) {
+    }
+
+    /**
+     * Report all outstanding problems and wait for the background thread.
+     */
+    void close() {
+        flush();
+        m_writer.close();
+    }
+
+    void report_duplicate_node(osmium::object_id_type node_id1, osmium::object_id_type node_id2, osmium::Location location) override {
+        flush_if_full();
+        ProblemRecorder::report_duplicate_node(node_id1, node_id2, location);
+    }
+
+    void report_touching_ring(osmium::object_id_type node_id, osmium::Location location) override {
+        flush_if_full();
+        ProblemRecorder::report_touching_ring(node_id, location);
+    }
+
+    void report_intersection(osmium::object_id_type way1_id, osmium::Location way1_seg_start, osmium::Location way1_seg_end,
+                             osmium::object_id_type way2_id, osmium::Location way2_seg_start, osmium::Location way2_seg_end, osmium::Location intersection) override {
+        flush_if_full();
+        ProblemRecorder::report_intersection(way1_id, way1_seg_start, way1_seg_end, way2_id, way2_seg_start, way2_seg_end, intersection);
+    }
+
+    void report_duplicate_segment(const osmium::NodeRef& nr1, const osmium::NodeRef& nr2) override {
+        flush_if_full();
+        ProblemRecorder::report_duplicate_segment(nr1, nr2);
+    }
+
+    void report_overlapping_segment(const osmium::NodeRef& nr1, const osmium::NodeRef& nr2) override {
+        flush_if_full();
+        ProblemRecorder::report_overlapping_segment(nr1, nr2);
+    }
+
+    void report_ring_not_closed(const osmium::NodeRef& nr, const osmium::Way* way) override {
+        flush_if_full();
+        ProblemRecorder::report_ring_not_closed(nr, way);
+    }
+
+    void report_role_should_be_outer(osmium::object_id_type way_id, osmium::Location seg_start, osmium::Location seg_end) override {
+        flush_if_full();
+        ProblemRecorder::report_role_should_be_outer(way_id, seg_start, seg_end);
+    }
+
+    void report_role_should_be_inner(osmium::object_id_type way_id, osmium::Location seg_start, osmium::Location seg_end) override {
+        flush_if_full();
+        ProblemRecorder::report_role_should_be_inner(way_id, seg_start, seg_end);
+    }
+
+    void report_way_in_multiple_rings(const osmium::Way& way) override {
+        flush_if_full();
+        ProblemRecorder::report_way_in_multiple_rings(way);
+    }
+
+    void report_inner_with_same_tags(const osmium::Way& way) override {
+        flush_if_full();
+        ProblemRecorder::report_inner_with_same_tags(way);
+    }
+
+    void report_invalid_location(osmium::object_id_type way_id, osmium::object_id_type node_id) override {
+        flush_if_full();
+        ProblemRecorder::report_invalid_location(way_id, node_id);
+    }
+
+    void report_duplicate_way(const osmium::Way& way) override {
+        flush_if_full();
+        ProblemRecorder::report_duplicate_way(way);
+    }
+
+    void report_way(const osmium::Way& way) override {
+        flush_if_full();
+        ProblemRecorder::report_way(way);
+    }
+
+}; // class AsyncProblemReporter
+
+#endif // ASYNC_PROBLEM_REPORTER_HPP
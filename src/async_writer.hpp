@@ -0,0 +1,124 @@
+#ifndef ASYNC_WRITER_HPP
+#define ASYNC_WRITER_HPP
+
+#include "bounded_queue.hpp"
+#include "problem_recorder.hpp"
+
+#include <osmium/memory/buffer.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+
+/**
+ * A buffer with assembled areas and the problems found while assembling
+ * them.
+ */
+struct output_chunk {
+    osmium::memory::Buffer buffer{};
+    ProblemRecorder problems{};
+};
+
+/**
+ * Hands off items through a bounded queue to a writer thread which calls
+ * the write function on them. If the queue size is 0, no thread is started
+ * and the write function is called directly from push().
+ *
+ * If the write function throws, the exception is re-thrown in the calling
+ * thread on the next push() or from close().
+ */
+template <typename T>
+class AsyncWriter {
+
+    std::function<void(T&)> m_write;
+    std::unique_ptr<BoundedQueue<T>> m_queue;
+    std::thread m_thread;
+    std::exception_ptr m_exception;
+    std::atomic<bool> m_failed{false};
+
+    void run() {
+        T item;
+        while (m_queue->pop(item)) {
+            if (m_failed) {
+                continue; // keep draining so the producer never blocks
+            }
+            try {
+                m_write(item);
+            } catch (...) {
+                m_exception = std::current_exception();
+                m_failed = true;
+            }
+        }
+    }
+
+public:
+
+    AsyncWriter(std::size_t queue_size, std::function<void(T&)> write) :
+        m_write(std::move(write)) {
+        if (queue_size > 0) {
+            m_queue = std::make_unique<BoundedQueue<T>>(queue_size);
+            m_thread = std::thread{&AsyncWriter::run, this};
+        }
+    }
+
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    AsyncWriter(AsyncWriter&&) = delete;
+    AsyncWriter& operator=(AsyncWriter&&) = delete;
+
+    ~AsyncWriter() noexcept {
+        if (m_thread.joinable()) {
+            m_queue->close();
+            m_thread.join();
+        }
+    }
+
+    bool is_async() const noexcept {
+        return static_cast<bool>(m_queue);
+    }
+
+    void push(T&& item) {
+        if (!m_queue) {
+            m_write(item);
+            return;
+        }
+        if (m_failed) {
+            close();
+        }
+        m_queue->push(std::move(item));
+    }
+
+    /**
+     * Wait for the writer thread to write all items.
+     */
+    void close() {
+        if (m_thread.joinable()) {
+            m_queue->close();
+            m_thread.join();
+        }
+        if (m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+    }
+
+    template <typename TOutput>
+    void print_stats(TOutput& out) const {
+        if (!m_queue) {
+            return;
+        }
+        out << "Output queue:\n"
+            << "  max size:      " << m_queue->max_size() << '\n'
+            << "  max depth:     " << m_queue->max_depth() << '\n'
+            << "  average depth: " << m_queue->average_depth() << '\n'
+            << "  assembly stalled on full queue: " << m_queue->push_wait().count() << "ms\n"
+            << "  writer idle on empty queue:     " << m_queue->pop_wait().count() << "ms\n";
+    }
+
+}; // class AsyncWriter
+
+#endif // ASYNC_WRITER_HPP
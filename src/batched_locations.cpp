@@ -0,0 +1,48 @@
+/*****************************************************************************
+
+  OSM Area Tools - Batched location lookups
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "batched_locations.hpp"
+
+#include <osmium/osm/way.hpp>
+
+#include <algorithm>
+#include <iterator>
+
+void BatchedLocations::operator()(osmium::memory::Buffer& buffer) {
+    // Sparse indexes have to be sorted before lookups, the location
+    // handler usually does this when it sees the first way.
+    if (m_must_sort) {
+        m_index.sort();
+        m_must_sort = false;
+    }
+
+    m_refs.clear();
+    for (auto& way : buffer.select<osmium::Way>()) {
+        for (auto& node_ref : way.nodes()) {
+            if (node_ref.ref() >= 0) {
+                m_refs.emplace_back(node_ref.positive_ref(), &node_ref);
+            } else {
+                node_ref.set_location(osmium::Location{});
+            }
+        }
+    }
+
+    std::sort(m_refs.begin(), m_refs.end(), [](const std::pair<osmium::unsigned_object_id_type, osmium::NodeRef*>& lhs,
+                                               const std::pair<osmium::unsigned_object_id_type, osmium::NodeRef*>& rhs) {
+        return lhs.first < rhs.first;
+    });
+
+    osmium::Location location;
+    for (auto it = m_refs.cbegin(); it != m_refs.cend(); ++it) {
+        if (it == m_refs.cbegin() || it->first != std::prev(it)->first) {
+            location = m_index.get_noexcept(it->first);
+            ++m_lookups;
+        }
+        it->second->set_location(location);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef BATCHED_LOCATIONS_HPP
+#define BATCHED_LOCATIONS_HPP
+
+#include <osmium/index/map.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node_ref.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/visitor.hpp>
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * Adds the node locations from a location index to all ways in a buffer
+ * at once. This is an alternative to the way() function of the
+ * osmium::handler::NodeLocationsForWays handler if the index already
+ * contains all nodes before the ways are read.
+ *
+ * Instead of looking up the nodes in the order they appear in the ways,
+ * the node references of all ways in the buffer are sorted by ID first.
+ * The lookups then go through the index in order and each node is looked
+ * up only once. With large indexes this avoids most of the cache and TLB
+ * misses.
+ *
+ * Like the location handler in the tools, missing nodes and nodes with
+ * negative IDs are not an error, they get an undefined location.
+ */
+class BatchedLocations {
+
+    using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
+
+    index_type& m_index;
+    std::vector<std::pair<osmium::unsigned_object_id_type, osmium::NodeRef*>> m_refs;
+    std::size_t m_lookups = 0;
+    bool m_must_sort = true;
+
+public:
+
+    explicit BatchedLocations(index_type& index) :
+        m_index(index) {
+    }
+
+    /**
+     * Add locations to all ways in the buffer.
+     */
+    void operator()(osmium::memory::Buffer& buffer);
+
+    /**
+     * Don't sort the index before the first lookup, because it is already
+     * sorted, for instance by a location handler which has seen ways.
+     */
+    void set_sorted() noexcept {
+        m_must_sort = false;
+    }
+
+    /**
+     * Number of index lookups done so far.
+     */
+    std::size_t lookups() const noexcept {
+        return m_lookups;
+    }
+
+}; // class BatchedLocations
+
+/**
+ * Like osmium::apply() on a reader, but the node locations are added to
+ * the ways in each buffer before the handlers see it.
+ */
+template <typename... THandlers>
+void apply_with_locations(osmium::io::Reader& reader, BatchedLocations& locations, THandlers&&... handlers) {
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        locations(buffer);
+        osmium::apply(buffer, handlers...);
+    }
+}
+
+#endif // BATCHED_LOCATIONS_HPP
@@ -0,0 +1,125 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/**
+ * Simple thread-safe queue with a maximum size. Pushing into a full queue
+ * blocks until there is space again. Keeps some statistics about how full
+ * the queue was and how long producer and consumer had to wait.
+ */
+template <typename T>
+class BoundedQueue {
+
+    using clock = std::chrono::steady_clock;
+
+    std::size_t m_max_size;
+    std::deque<T> m_queue;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+    bool m_closed = false;
+
+    std::size_t m_pushes = 0;
+    std::size_t m_depth_sum = 0;
+    std::size_t m_max_depth = 0;
+    clock::duration m_push_wait{};
+    clock::duration m_pop_wait{};
+
+public:
+
+    explicit BoundedQueue(std::size_t max_size) :
+        m_max_size(max_size > 0 ? max_size : 1) {
+    }
+
+    /**
+     * Add item to the queue. Blocks if the queue is full.
+     */
+    void push(T&& item) {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        if (m_queue.size() >= m_max_size) {
+            const auto start = clock::now();
+            m_not_full.wait(lock, [this] { return m_queue.size() < m_max_size; });
+            m_push_wait += clock::now() - start;
+        }
+        m_queue.push_back(std::move(item));
+
+        ++m_pushes;
+        m_depth_sum += m_queue.size();
+        if (m_queue.size() > m_max_depth) {
+            m_max_depth = m_queue.size();
+        }
+
+        lock.unlock();
+        m_not_empty.notify_one();
+    }
+
+    /**
+     * Get the next item from the queue. Blocks if the queue is empty.
+     * Returns false if the queue was closed and there are no more items.
+     */
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        if (m_queue.empty() && !m_closed) {
+            const auto start = clock::now();
+            m_not_empty.wait(lock, [this] { return !m_queue.empty() || m_closed; });
+            m_pop_wait += clock::now() - start;
+        }
+        if (m_queue.empty()) {
+            return false;
+        }
+        item = std::move(m_queue.front());
+        m_queue.pop_front();
+
+        lock.unlock();
+        m_not_full.notify_one();
+        return true;
+    }
+
+    /**
+     * Close the queue. No more items can be pushed, pop() will return
+     * false once all items have been taken out.
+     */
+    void close() {
+        {
+            const std::lock_guard<std::mutex> lock{m_mutex};
+            m_closed = true;
+        }
+        m_not_empty.notify_all();
+    }
+
+    std::size_t max_size() const noexcept {
+        return m_max_size;
+    }
+
+    std::size_t max_depth() const {
+        const std::lock_guard<std::mutex> lock{m_mutex};
+        return m_max_depth;
+    }
+
+    double average_depth() const {
+        const std::lock_guard<std::mutex> lock{m_mutex};
+        return m_pushes == 0 ? 0.0 : static_cast<double>(m_depth_sum) / static_cast<double>(m_pushes);
+    }
+
+    /// Time the producer was blocked because the queue was full.
+    std::chrono::milliseconds push_wait() const {
+        const std::lock_guard<std::mutex> lock{m_mutex};
+        return std::chrono::duration_cast<std::chrono::milliseconds>(m_push_wait);
+    }
+
+    /// Time the consumer was blocked because the queue was empty.
+    std::chrono::milliseconds pop_wait() const {
+        const std::lock_guard<std::mutex> lock{m_mutex};
+        return std::chrono::duration_cast<std::chrono::milliseconds>(m_pop_wait);
+    }
+
+}; // class BoundedQueue
+
+#endif // BOUNDED_QUEUE_HPP
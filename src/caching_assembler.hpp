@@ -0,0 +1,228 @@
+#ifndef CACHING_ASSEMBLER_HPP
+#define CACHING_ASSEMBLER_HPP
+
+#include "assembly_cache.hpp"
+#include "problem_recorder.hpp"
+
+#include <osmium/area/stats.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/tag.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Older libosmium versions don't have the ignore_invalid_locations
+ * setting in the assembler config.
+ */
+template <typename T, typename = void>
+struct has_ignore_invalid_locations : std::false_type {
+};
+
+template <typename T>
+struct has_ignore_invalid_locations<T, decltype(void(std::declval<T&>().ignore_invalid_locations))> : std::true_type {
+};
+
+template <typename TAssembler>
+struct caching_assembler_config : public TAssembler::config_type {
+
+    /**
+     * Cache for the results of assembling relations. If this is nullptr,
+     * nothing is cached.
+     */
+    AssemblyCache* cache = nullptr;
+
+}; // struct caching_assembler_config
+
+/**
+ * Assembler which looks up the result of assembling a relation in an
+ * assembly cache before handing it to the TAssembler. The cache entry for
+ * a relation is only used if the relation, its member ways with all node
+ * locations, and the assembler settings are the same as when it was
+ * written. An entry contains the areas created (if any), the stats, and
+ * the problems found, so the output is the same as without the cache.
+ * Areas from closed ways are not cached, they are cheap to assemble.
+ */
+template <typename TAssembler>
+class CachingAssembler {
+
+    static_assert(std::is_trivially_copyable<osmium::area::area_stats>::value, "area stats must be trivially copyable");
+
+    // 64 bit FNV-1a hash
+    class hasher {
+
+        uint64_t m_hash = 14695981039346656037ULL;
+
+    public:
+
+        void add(const void* data, std::size_t size) noexcept {
+            const auto* bytes = static_cast<const unsigned char*>(data);
+            for (std::size_t n = 0; n < size; ++n) {
+                m_hash ^= bytes[n];
+                m_hash *= 1099511628211ULL;
+            }
+        }
+
+        void add(const char* str) noexcept {
+            add(str, std::strlen(str) + 1);
+        }
+
+        template <typename T>
+        void add(T value) noexcept {
+            add(&value, sizeof(value));
+        }
+
+        uint64_t value() const noexcept {
+            return m_hash;
+        }
+
+    }; // class hasher
+
+    using config_type_base = typename TAssembler::config_type;
+
+    caching_assembler_config<TAssembler> m_config;
+    osmium::area::area_stats m_stats;
+
+    uint64_t hash(const osmium::Relation& relation, const std::vector<const osmium::Way*>& members) const noexcept {
+        hasher h;
+
+        h.add(m_config.check_roles);
+        h.add(m_config.create_empty_areas);
+        h.add(m_config.create_new_style_polygons);
+        h.add(m_config.create_old_style_polygons);
+        h.add(m_config.keep_type_tag);
+        if constexpr (has_ignore_invalid_locations<config_type_base>::value) {
+            h.add(m_config.ignore_invalid_locations);
+        }
+
+        h.add(relation.id());
+        h.add(relation.version());
+        h.add(relation.changeset());
+        h.add(relation.timestamp().seconds_since_epoch());
+        h.add(relation.uid());
+        h.add(relation.user());
+        for (const auto& tag : relation.tags()) {
+            h.add(tag.key());
+            h.add(tag.value());
+        }
+        for (const auto& member : relation.members()) {
+            h.add(member.type());
+            h.add(member.ref());
+            h.add(member.role());
+        }
+
+        for (const auto* way : members) {
+            h.add(way->id());
+            for (const auto& tag : way->tags()) {
+                h.add(tag.key());
+                h.add(tag.value());
+            }
+            for (const auto& node_ref : way->nodes()) {
+                h.add(node_ref.ref());
+                h.add(node_ref.location().x());
+                h.add(node_ref.location().y());
+            }
+        }
+
+        return h.value();
+    }
+
+    bool use_entry(const char* data, osmium::memory::Buffer& out_buffer) {
+        uint64_t result = 0;
+        osmium::area::area_stats stats{};
+        uint64_t areas_size = 0;
+
+        std::memcpy(&result, data, sizeof(result));
+        data += sizeof(result);
+        std::memcpy(&stats, data, sizeof(stats));
+        data += sizeof(stats);
+        std::memcpy(&areas_size, data, sizeof(areas_size));
+        data += sizeof(areas_size);
+
+        if (areas_size > 0) {
+            std::memcpy(out_buffer.reserve_space(areas_size), data, areas_size);
+            out_buffer.commit();
+            data += areas_size;
+        }
+
+        if (m_config.problem_reporter) {
+            ProblemRecorder problems;
+            problems.load(data);
+            problems.replay(*m_config.problem_reporter);
+        }
+
+        m_stats += stats;
+        return result != 0;
+    }
+
+public:
+
+    using config_type = caching_assembler_config<TAssembler>;
+
+    explicit CachingAssembler(const config_type& config) :
+        m_config(config) {
+    }
+
+    bool operator()(const osmium::Way& way, osmium::memory::Buffer& out_buffer) {
+        TAssembler assembler{m_config};
+        const bool result = assembler(way, out_buffer);
+        m_stats += assembler.stats();
+        return result;
+    }
+
+    bool operator()(const osmium::Relation& relation, const std::vector<const osmium::Way*>& members, osmium::memory::Buffer& out_buffer) {
+        if (!m_config.cache) {
+            TAssembler assembler{m_config};
+            const bool result = assembler(relation, members, out_buffer);
+            m_stats += assembler.stats();
+            return result;
+        }
+
+        const auto key = hash(relation, members);
+        const auto entry = m_config.cache->get(relation.id(), key);
+        if (entry.first) {
+            return use_entry(entry.first, out_buffer);
+        }
+
+        // The problems are always recorded, so that they are in the cache
+        // even if nobody is interested in them in this run.
+        ProblemRecorder problems;
+        config_type_base config{m_config};
+        config.problem_reporter = &problems;
+
+        const auto start = out_buffer.committed();
+        TAssembler assembler{config};
+        const uint64_t result = assembler(relation, members, out_buffer) ? 1 : 0;
+        const auto& stats = assembler.stats();
+        m_stats += stats;
+
+        if (m_config.problem_reporter) {
+            problems.replay(*m_config.problem_reporter);
+        }
+
+        const uint64_t areas_size = out_buffer.committed() - start;
+        std::string entry_data;
+        entry_data.append(reinterpret_cast<const char*>(&result), sizeof(result));
+        entry_data.append(reinterpret_cast<const char*>(&stats), sizeof(stats));
+        entry_data.append(reinterpret_cast<const char*>(&areas_size), sizeof(areas_size));
+        entry_data.append(reinterpret_cast<const char*>(out_buffer.data() + start), areas_size);
+        problems.save(entry_data);
+        m_config.cache->put(relation.id(), key, entry_data);
+
+        return result != 0;
+    }
+
+    const osmium::area::area_stats& stats() const noexcept {
+        return m_stats;
+    }
+
+}; // class CachingAssembler
+
+#endif // CACHING_ASSEMBLER_HPP
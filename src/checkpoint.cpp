@@ -0,0 +1,157 @@
+/*****************************************************************************
+
+  OSM Area Tools - Checkpoints
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "checkpoint.hpp"
+
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/pbf_output.hpp>
+#include <osmium/io/writer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/relation.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    constexpr const char* relations_file_name = "relations.osm.pbf";
+    constexpr const char* locations_file_name = "locations.idx";
+    constexpr const char* checkpoint_file_name = "checkpoint";
+
+    // Suffix of the files while they are written.
+    constexpr const char* tmp_suffix = ".tmp";
+
+    // Size and modification time of the input file, enough to notice
+    // that a checkpoint was written for a different file.
+    std::string describe_input(const osmium::io::File& input_file) {
+        if (input_file.filename().empty()) {
+            throw std::runtime_error{"Can not use checkpoints when reading from STDIN"};
+        }
+
+        struct stat st{};
+        if (::stat(input_file.filename().c_str(), &st) != 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can not stat '"} + input_file.filename() + "'"};
+        }
+
+        return std::to_string(st.st_size) + ' ' + std::to_string(st.st_mtime);
+    }
+
+    void rename_file(const std::string& from, const std::string& to) {
+        if (std::rename(from.c_str(), to.c_str()) != 0) {
+            throw std::system_error{errno, std::system_category(), "Can not rename '" + from + "'"};
+        }
+    }
+
+} // anonymous namespace
+
+Checkpoint::Checkpoint(std::string directory, const osmium::io::File& input_file, std::string filter_expression, bool resume) :
+    m_directory(std::move(directory)),
+    m_input(describe_input(input_file)),
+    m_filter_expression(std::move(filter_expression)) {
+    if (::mkdir(m_directory.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw std::system_error{errno, std::system_category(), "Can not create directory '" + m_directory + "'"};
+    }
+
+    if (!resume) {
+        remove();
+        return;
+    }
+
+    std::ifstream file{m_directory + '/' + checkpoint_file_name};
+    int stage = 0;
+    std::string input;
+    std::string filter_expression_used;
+    if (!(file >> stage) || !std::getline(file >> std::ws, input) || !std::getline(file, filter_expression_used)) {
+        return;
+    }
+    if (input != m_input || filter_expression_used != m_filter_expression) {
+        throw std::runtime_error{"Checkpoint in '" + m_directory + "' was written for a different input file or filter"};
+    }
+    if (stage >= static_cast<int>(checkpoint_stage::relations) && stage <= static_cast<int>(checkpoint_stage::locations)) {
+        m_stage = static_cast<checkpoint_stage>(stage);
+    }
+}
+
+void Checkpoint::set_stage(checkpoint_stage stage) {
+    const std::string filename{m_directory + '/' + checkpoint_file_name};
+    {
+        std::ofstream file{filename + tmp_suffix};
+        file << static_cast<int>(stage) << '\n'
+             << m_input << '\n'
+             << m_filter_expression << '\n';
+        file.close();
+        if (!file) {
+            throw std::runtime_error{"Can not write checkpoint file '" + filename + "'"};
+        }
+    }
+    rename_file(filename + tmp_suffix, filename);
+    m_stage = stage;
+}
+
+std::string Checkpoint::locations_file() const {
+    return m_directory + '/' + locations_file_name;
+}
+
+void Checkpoint::read_relations(const osmium::io::File& input_file,
+                                const relation_filter_type& filter,
+                                const std::function<void(const osmium::memory::Buffer&)>& callback) {
+    const std::string filename{m_directory + '/' + relations_file_name};
+
+    if (has_relations()) {
+        osmium::io::Reader reader{filename, osmium::osm_entity_bits::relation};
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            callback(buffer);
+        }
+        reader.close();
+        return;
+    }
+
+    {
+        osmium::io::Reader reader{input_file, osmium::osm_entity_bits::relation};
+        osmium::io::Writer writer{osmium::io::File{filename + tmp_suffix, "pbf"}, osmium::io::overwrite::allow};
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            for (const auto& relation : buffer.select<osmium::Relation>()) {
+                if (filter(relation)) {
+                    writer(relation);
+                }
+            }
+            callback(buffer);
+        }
+        writer.close();
+        reader.close();
+    }
+
+    rename_file(filename + tmp_suffix, filename);
+    set_stage(checkpoint_stage::relations);
+}
+
+void Checkpoint::save_locations(const osmium::io::File& input_file,
+                                const std::string& location_index_type,
+                                osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>& index) {
+    const auto filename = locations_file();
+    save_location_index(filename + tmp_suffix, input_file, location_index_type, index);
+    rename_file(filename + tmp_suffix, filename);
+    set_stage(checkpoint_stage::locations);
+}
+
+void Checkpoint::remove() {
+    for (const char* name : {checkpoint_file_name, relations_file_name, locations_file_name}) {
+        const std::string filename{m_directory + '/' + name};
+        ::unlink(filename.c_str());
+        ::unlink((filename + tmp_suffix).c_str());
+    }
+    m_stage = checkpoint_stage::none;
+}
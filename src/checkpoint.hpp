@@ -0,0 +1,145 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "index_file.hpp"
+#include "update_state.hpp"
+
+#include <osmium/handler.hpp>
+#include <osmium/index/map.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/visitor.hpp>
+
+#include <functional>
+#include <string>
+#include <utility>
+
+/*
+ * A checkpoint directory makes it possible to resume oat_create_areas
+ * after it was interrupted. It contains:
+ *
+ * relations.osm.pbf - all area relations, written in the first pass
+ * locations.idx     - the location index, written in the second pass once
+ *                     all nodes were read (see save_location_index())
+ * checkpoint        - the last stage reached together with size and
+ *                     modification time of the input file and the filter
+ *                     expression used
+ *
+ * The state of the multipolygon manager in the second pass (the member
+ * ways of incomplete relations) can't be saved, so the ways are always
+ * read again when resuming.
+ */
+
+enum class checkpoint_stage : int {
+    none      = 0,
+    relations = 1,
+    locations = 2
+};
+
+class Checkpoint {
+
+    std::string m_directory;
+    std::string m_input;
+    std::string m_filter_expression;
+    checkpoint_stage m_stage = checkpoint_stage::none;
+
+    void set_stage(checkpoint_stage stage);
+
+    void read_relations(const osmium::io::File& input_file,
+                        const relation_filter_type& filter,
+                        const std::function<void(const osmium::memory::Buffer&)>& callback);
+
+public:
+
+    /**
+     * Open the checkpoint directory, it is created if it doesn't exist.
+     * If resume is set, the stage reached by an earlier run is read from
+     * the directory. It is only used if it was written for the same input
+     * file and filter expression. Otherwise an existing checkpoint is
+     * discarded.
+     */
+    Checkpoint(std::string directory, const osmium::io::File& input_file, std::string filter_expression, bool resume);
+
+    checkpoint_stage stage() const noexcept {
+        return m_stage;
+    }
+
+    bool has_relations() const noexcept {
+        return m_stage >= checkpoint_stage::relations;
+    }
+
+    bool has_locations() const noexcept {
+        return m_stage >= checkpoint_stage::locations;
+    }
+
+    std::string locations_file() const;
+
+    /**
+     * Do the first pass for the manager. The relations are read from the
+     * checkpoint if it has them, otherwise they are read from the input
+     * file and the area relations are written into the checkpoint.
+     */
+    template <typename TManager>
+    void read_relations(const osmium::io::File& input_file, TManager& manager) {
+        read_relations(input_file, [&manager](const osmium::Relation& relation) {
+            return manager.new_relation(relation);
+        }, [&manager](const osmium::memory::Buffer& buffer) {
+            osmium::apply(buffer, manager);
+        });
+        manager.prepare_for_lookup();
+    }
+
+    /**
+     * Save the location index into the checkpoint. Only the index types
+     * supported by save_location_index() can be saved.
+     */
+    void save_locations(const osmium::io::File& input_file,
+                        const std::string& location_index_type,
+                        osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>& index);
+
+    /**
+     * Remove the checkpoint files after a successful run.
+     */
+    void remove();
+
+}; // class Checkpoint
+
+/**
+ * Handler saving the location index into the checkpoint when it sees the
+ * first way, ie. after all nodes were read. It has to come before the
+ * handlers using the ways in the second pass. Does nothing if the
+ * checkpoint is nullptr or already has the locations.
+ */
+class LocationsCheckpoint : public osmium::handler::Handler {
+
+    Checkpoint* m_checkpoint;
+    const osmium::io::File& m_input_file;
+    std::string m_location_index_type;
+    osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>& m_index;
+
+public:
+
+    LocationsCheckpoint(Checkpoint* checkpoint,
+                        const osmium::io::File& input_file,
+                        std::string location_index_type,
+                        osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>& index) :
+        m_checkpoint(checkpoint && !checkpoint->has_locations() ? checkpoint : nullptr),
+        m_input_file(input_file),
+        m_location_index_type(std::move(location_index_type)),
+        m_index(index) {
+    }
+
+    void way(const osmium::Way& /*way*/) {
+        if (m_checkpoint) {
+            m_checkpoint->save_locations(m_input_file, m_location_index_type, m_index);
+            m_checkpoint = nullptr;
+        }
+    }
+
+}; // class LocationsCheckpoint
+
+#endif // CHECKPOINT_HPP
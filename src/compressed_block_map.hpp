@@ -0,0 +1,360 @@
+#ifndef COMPRESSED_BLOCK_MAP_HPP
+#define COMPRESSED_BLOCK_MAP_HPP
+
+#include <osmium/index/index.hpp>
+#include <osmium/index/map.hpp>
+#include <osmium/osm/location.hpp>
+
+#ifdef OAT_WITH_LZ4
+# include <lz4.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Location index which stores locations in blocks of consecutive IDs. Each
+ * block is encoded as a bitmap of the IDs present followed by the zigzag
+ * and varint encoded deltas between consecutive locations. If compiled with
+ * LZ4 support, blocks are additionally LZ4 compressed if that makes them
+ * smaller. A small LRU cache keeps recently used blocks decoded.
+ *
+ * Works best if the locations are set in order of their IDs, which is the
+ * case for sorted OSM files. Setting locations in a block that has already
+ * been written re-encodes the block, the space used by the old version of
+ * the block is not reclaimed.
+ *
+ * Because lookups change the cache, this class is not thread-safe, not even
+ * for reading.
+ */
+template <typename TId, typename TValue>
+class CompressedBlockMap : public osmium::index::map::Map<TId, TValue> {
+
+    static_assert(std::is_same<TValue, osmium::Location>::value, "CompressedBlockMap only works for locations");
+
+    enum : std::size_t {
+        block_bits = 10,
+        ids_per_block = 1UL << block_bits,
+        bitmap_size = ids_per_block / 8,
+        max_encoded_size = bitmap_size + ids_per_block * 2 * 5,
+        min_chunk_size = 1024UL * 1024UL,
+        max_chunk_size = 64UL * 1024UL * 1024UL,
+        cache_size = 128
+    };
+
+    static constexpr const std::size_t no_block = std::numeric_limits<std::size_t>::max();
+
+    using block_type = std::array<osmium::Location, ids_per_block>;
+
+    // Header in front of each encoded block in the arena.
+    struct block_header {
+        uint32_t stored_size; // bytes stored after the header
+        uint32_t raw_size;    // size before compression, 0 if not compressed
+    };
+
+    struct cache_entry {
+        std::size_t block = no_block;
+        uint64_t last_use = 0;
+        block_type locations;
+    };
+
+    // Encoded blocks are appended to chunks of memory which never move.
+    // Offsets are stored as (chunk number + 1) << 32 | position in chunk,
+    // 0 means the block is empty.
+    std::vector<std::vector<char>> m_chunks;
+    std::vector<uint64_t> m_offsets;
+    std::size_t m_size = 0;
+
+    // The block currently being written to.
+    std::size_t m_open_block = no_block;
+    block_type m_open;
+
+    mutable std::vector<cache_entry> m_cache;
+    mutable std::unordered_map<std::size_t, std::size_t> m_cache_slots;
+    mutable std::size_t m_last_slot = 0;
+    mutable uint64_t m_use_counter = 0;
+    mutable std::vector<char> m_buffer;
+
+    static uint32_t zigzag(int32_t value) noexcept {
+        return (static_cast<uint32_t>(value) << 1U) ^ static_cast<uint32_t>(value >> 31); // NOLINT(hicpp-signed-bitwise)
+    }
+
+    static int32_t unzigzag(uint32_t value) noexcept {
+        return static_cast<int32_t>((value >> 1U) ^ -(value & 1U));
+    }
+
+    static void append_varint(std::vector<char>& out, uint32_t value) {
+        while (value >= 0x80U) {
+            out.push_back(static_cast<char>((value & 0x7fU) | 0x80U));
+            value >>= 7U;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    static uint32_t read_varint(const char** data, const char* end) {
+        uint32_t value = 0;
+        unsigned int shift = 0;
+        while (*data != end && shift < 35) {
+            const auto byte = static_cast<uint8_t>(**data);
+            ++*data;
+            value |= static_cast<uint32_t>(byte & 0x7fU) << shift;
+            if ((byte & 0x80U) == 0) {
+                return value;
+            }
+            shift += 7;
+        }
+        throw std::runtime_error{"Corrupt block in compressed_block index"};
+    }
+
+    static std::size_t block_of(const TId id) noexcept {
+        return static_cast<std::size_t>(id) >> block_bits;
+    }
+
+    static std::size_t pos_in_block(const TId id) noexcept {
+        return static_cast<std::size_t>(id) & (ids_per_block - 1);
+    }
+
+    bool has_block(std::size_t block) const noexcept {
+        return block < m_offsets.size() && m_offsets[block] != 0;
+    }
+
+    const char* block_data(std::size_t block) const noexcept {
+        const auto offset = m_offsets[block];
+        return m_chunks[(offset >> 32U) - 1].data() + (offset & 0xffffffffULL);
+    }
+
+    char* allocate(std::size_t size) {
+        if (m_chunks.empty() || m_chunks.back().capacity() - m_chunks.back().size() < size) {
+            const std::size_t chunk_size = m_chunks.empty() ? min_chunk_size
+                                                            : std::min(m_chunks.back().capacity() * 2, static_cast<std::size_t>(max_chunk_size));
+            m_chunks.emplace_back();
+            m_chunks.back().reserve(chunk_size);
+        }
+        auto& chunk = m_chunks.back();
+        const auto pos = chunk.size();
+        chunk.resize(pos + size);
+        return chunk.data() + pos;
+    }
+
+    void encode(std::size_t block, const block_type& locations) {
+        m_buffer.clear();
+        m_buffer.resize(bitmap_size);
+        int32_t x = 0;
+        int32_t y = 0;
+        for (std::size_t i = 0; i < ids_per_block; ++i) {
+            const auto& location = locations[i];
+            if (location == osmium::Location{}) {
+                continue;
+            }
+            m_buffer[i / 8] = static_cast<char>(static_cast<uint8_t>(m_buffer[i / 8]) | (1U << (i % 8)));
+            append_varint(m_buffer, zigzag(static_cast<int32_t>(static_cast<uint32_t>(location.x()) - static_cast<uint32_t>(x))));
+            append_varint(m_buffer, zigzag(static_cast<int32_t>(static_cast<uint32_t>(location.y()) - static_cast<uint32_t>(y))));
+            x = location.x();
+            y = location.y();
+        }
+
+        if (m_buffer.size() == bitmap_size) { // block is empty
+            m_offsets[block] = 0;
+            return;
+        }
+
+        block_header header{static_cast<uint32_t>(m_buffer.size()), 0};
+        const char* data = m_buffer.data();
+
+#ifdef OAT_WITH_LZ4
+        std::array<char, LZ4_COMPRESSBOUND(max_encoded_size)> compressed; // NOLINT(cppcoreguidelines-pro-type-member-init,hicpp-member-init)
+        const int compressed_size = LZ4_compress_default(m_buffer.data(), compressed.data(), static_cast<int>(m_buffer.size()), static_cast<int>(compressed.size()));
+        if (compressed_size > 0 && static_cast<std::size_t>(compressed_size) < m_buffer.size()) {
+            header.raw_size = header.stored_size;
+            header.stored_size = static_cast<uint32_t>(compressed_size);
+            data = compressed.data();
+        }
+#endif
+
+        if (m_chunks.size() >= std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error{"compressed_block index is full"};
+        }
+
+        char* out = allocate(sizeof(block_header) + header.stored_size);
+        std::memcpy(out, &header, sizeof(block_header));
+        std::memcpy(out + sizeof(block_header), data, header.stored_size);
+
+        const auto& chunk = m_chunks.back();
+        m_offsets[block] = (static_cast<uint64_t>(m_chunks.size()) << 32U) |
+                           static_cast<uint64_t>(out - chunk.data());
+    }
+
+    void decode(std::size_t block, block_type& locations) const {
+        locations.fill(osmium::Location{});
+        if (!has_block(block)) {
+            return;
+        }
+
+        const char* data = block_data(block);
+        block_header header; // NOLINT(cppcoreguidelines-pro-type-member-init,hicpp-member-init)
+        std::memcpy(&header, data, sizeof(block_header));
+        data += sizeof(block_header);
+
+#ifdef OAT_WITH_LZ4
+        if (header.raw_size != 0) {
+            m_buffer.resize(header.raw_size);
+            const int size = LZ4_decompress_safe(data, m_buffer.data(), static_cast<int>(header.stored_size), static_cast<int>(header.raw_size));
+            if (size != static_cast<int>(header.raw_size)) {
+                throw std::runtime_error{"Corrupt block in compressed_block index"};
+            }
+            data = m_buffer.data();
+            header.stored_size = header.raw_size;
+        }
+#else
+        if (header.raw_size != 0) {
+            throw std::runtime_error{"Corrupt block in compressed_block index"};
+        }
+#endif
+
+        const char* const end = data + header.stored_size;
+        const char* values = data + bitmap_size;
+        int32_t x = 0;
+        int32_t y = 0;
+        for (std::size_t i = 0; i < ids_per_block; ++i) {
+            if ((static_cast<uint8_t>(data[i / 8]) & (1U << (i % 8))) == 0) {
+                continue;
+            }
+            x = static_cast<int32_t>(static_cast<uint32_t>(x) + static_cast<uint32_t>(unzigzag(read_varint(&values, end))));
+            y = static_cast<int32_t>(static_cast<uint32_t>(y) + static_cast<uint32_t>(unzigzag(read_varint(&values, end))));
+            locations[i] = osmium::Location{x, y};
+        }
+    }
+
+    void drop_from_cache(std::size_t block) {
+        const auto it = m_cache_slots.find(block);
+        if (it != m_cache_slots.end()) {
+            m_cache[it->second].block = no_block;
+            m_cache_slots.erase(it);
+        }
+    }
+
+    const block_type& cached_block(std::size_t block) const {
+        if (m_last_slot < m_cache.size() && m_cache[m_last_slot].block == block) {
+            m_cache[m_last_slot].last_use = ++m_use_counter;
+            return m_cache[m_last_slot].locations;
+        }
+
+        const auto it = m_cache_slots.find(block);
+        if (it != m_cache_slots.end()) {
+            m_last_slot = it->second;
+        } else {
+            if (m_cache.size() < cache_size) {
+                m_cache.emplace_back();
+                m_last_slot = m_cache.size() - 1;
+            } else {
+                m_last_slot = 0;
+                for (std::size_t i = 1; i < m_cache.size(); ++i) {
+                    if (m_cache[i].last_use < m_cache[m_last_slot].last_use) {
+                        m_last_slot = i;
+                    }
+                }
+                m_cache_slots.erase(m_cache[m_last_slot].block);
+            }
+            auto& entry = m_cache[m_last_slot];
+            entry.block = no_block;
+            decode(block, entry.locations);
+            entry.block = block;
+            m_cache_slots[block] = m_last_slot;
+        }
+
+        m_cache[m_last_slot].last_use = ++m_use_counter;
+        return m_cache[m_last_slot].locations;
+    }
+
+    void close_open_block() {
+        if (m_open_block != no_block) {
+            encode(m_open_block, m_open);
+            m_open_block = no_block;
+        }
+    }
+
+    void open_block(std::size_t block) {
+        close_open_block();
+        if (block >= m_offsets.size()) {
+            m_offsets.resize(block + 1);
+        }
+        drop_from_cache(block);
+        decode(block, m_open);
+        m_open_block = block;
+    }
+
+public:
+
+    CompressedBlockMap() = default;
+
+    void set(const TId id, const TValue value) final {
+        const auto block = block_of(id);
+        if (block != m_open_block) {
+            open_block(block);
+        }
+        auto& location = m_open[pos_in_block(id)];
+        if (location == osmium::Location{}) {
+            ++m_size;
+        }
+        location = value;
+    }
+
+    TValue get(const TId id) const final {
+        const auto value = get_noexcept(id);
+        if (value == osmium::Location{}) {
+            throw osmium::not_found{id};
+        }
+        return value;
+    }
+
+    TValue get_noexcept(const TId id) const noexcept final {
+        const auto block = block_of(id);
+        if (block == m_open_block) {
+            return m_open[pos_in_block(id)];
+        }
+        if (!has_block(block)) {
+            return osmium::Location{};
+        }
+        try {
+            return cached_block(block)[pos_in_block(id)];
+        } catch (...) {
+            return osmium::Location{};
+        }
+    }
+
+    std::size_t size() const final {
+        return m_size;
+    }
+
+    std::size_t used_memory() const final {
+        std::size_t memory = sizeof(block_type) + m_offsets.capacity() * sizeof(uint64_t) +
+                             m_cache.capacity() * sizeof(cache_entry);
+        for (const auto& chunk : m_chunks) {
+            memory += chunk.capacity();
+        }
+        return memory;
+    }
+
+    void clear() final {
+        m_chunks.clear();
+        m_chunks.shrink_to_fit();
+        m_offsets.clear();
+        m_offsets.shrink_to_fit();
+        m_size = 0;
+        m_open_block = no_block;
+        m_cache.clear();
+        m_cache_slots.clear();
+        m_last_slot = 0;
+    }
+
+}; // class CompressedBlockMap
+
+#endif // COMPRESSED_BLOCK_MAP_HPP
@@ -0,0 +1,76 @@
+#ifndef ID_BITMAP_HPP
+#define ID_BITMAP_HPP
+
+#include <osmium/osm/types.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Set of positive object IDs stored as a bitmap. The bitmap is split into
+ * chunks which are only allocated when an ID in their range is set, so
+ * this works for small extracts as well as for the planet. Negative IDs
+ * are never in the set.
+ */
+class IdBitmap {
+
+    enum : std::size_t {
+        bits_per_chunk = 1UL << 16U,
+        words_per_chunk = bits_per_chunk / 64
+    };
+
+    std::vector<std::vector<uint64_t>> m_chunks;
+
+public:
+
+    void set(osmium::object_id_type id) {
+        if (id <= 0) {
+            return;
+        }
+        const auto uid = static_cast<std::size_t>(id);
+        const auto chunk = uid / bits_per_chunk;
+        if (chunk >= m_chunks.size()) {
+            m_chunks.resize(chunk + 1);
+        }
+        auto& words = m_chunks[chunk];
+        if (words.empty()) {
+            words.resize(words_per_chunk);
+        }
+        const auto bit = uid % bits_per_chunk;
+        words[bit / 64] |= (1ULL << (bit % 64));
+    }
+
+    bool get(osmium::object_id_type id) const noexcept {
+        if (id <= 0) {
+            return false;
+        }
+        const auto uid = static_cast<std::size_t>(id);
+        const auto chunk = uid / bits_per_chunk;
+        if (chunk >= m_chunks.size() || m_chunks[chunk].empty()) {
+            return false;
+        }
+        const auto bit = uid % bits_per_chunk;
+        return (m_chunks[chunk][bit / 64] & (1ULL << (bit % 64))) != 0;
+    }
+
+    bool empty() const noexcept {
+        return m_chunks.empty();
+    }
+
+    void clear() {
+        m_chunks.clear();
+        m_chunks.shrink_to_fit();
+    }
+
+    std::size_t used_memory() const noexcept {
+        std::size_t size = m_chunks.capacity() * sizeof(std::vector<uint64_t>);
+        for (const auto& words : m_chunks) {
+            size += words.capacity() * sizeof(uint64_t);
+        }
+        return size;
+    }
+
+}; // class IdBitmap
+
+#endif // ID_BITMAP_HPP
@@ -0,0 +1,307 @@
+/*****************************************************************************
+
+  OSM Area Tools - Location index files
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "index_file.hpp"
+#include "read_only_mapping.hpp"
+
+#include <osmium/index/index.hpp>
+#include <osmium/io/detail/read_write.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
+
+namespace {
+
+    constexpr const char index_file_magic[8] = {'O', 'A', 'T', 'L', 'I', 'D', 'X', '1'};
+
+    // Data starts at this offset in the file, must be a multiple of the
+    // page size so the data can be mapped directly.
+    constexpr const std::size_t data_offset = 64UL * 1024UL;
+
+    enum class index_kind : uint32_t {
+        dense_array = 1,
+        sparse_list = 2
+    };
+
+    struct fingerprint {
+        uint64_t file_size = 0;
+        int64_t file_mtime = 0;
+        uint64_t hash = 0;
+
+        bool operator==(const fingerprint& other) const noexcept {
+            return file_size == other.file_size &&
+                   file_mtime == other.file_mtime &&
+                   hash == other.hash;
+        }
+    };
+
+    struct index_file_header {
+        std::array<char, 8> magic;
+        index_kind kind;
+        uint32_t reserved;
+        fingerprint input;
+        uint64_t count;
+    };
+
+    struct sparse_element {
+        osmium::unsigned_object_id_type id;
+        osmium::Location location;
+    };
+
+    uint64_t fnv1a(const char* data, std::size_t size, uint64_t hash) noexcept {
+        for (std::size_t i = 0; i < size; ++i) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // The fingerprint is made from size and modification time of the input
+    // file and a hash over its first and last 64kB.
+    fingerprint create_fingerprint(const osmium::io::File& input_file) {
+        if (input_file.filename().empty()) {
+            throw std::runtime_error{"Can not use location index files when reading from STDIN"};
+        }
+
+        const int fd = ::open(input_file.filename().c_str(), O_RDONLY); // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+        if (fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can not open '"} + input_file.filename() + "'"};
+        }
+
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::system_error{errno, std::system_category(), "fstat failed"};
+        }
+
+        fingerprint fp;
+        fp.file_size = static_cast<uint64_t>(st.st_size);
+        fp.file_mtime = static_cast<int64_t>(st.st_mtime);
+        fp.hash = 14695981039346656037ULL;
+
+        constexpr const std::size_t chunk_size = 64UL * 1024UL;
+        std::vector<char> chunk(chunk_size);
+        const std::array<uint64_t, 2> offsets = {0, fp.file_size > chunk_size ? fp.file_size - chunk_size : 0};
+        for (const auto offset : offsets) {
+            const auto length = ::pread(fd, chunk.data(), chunk.size(), static_cast<off_t>(offset));
+            if (length < 0) {
+                ::close(fd);
+                throw std::system_error{errno, std::system_category(), "Read error"};
+            }
+            fp.hash = fnv1a(chunk.data(), static_cast<std::size_t>(length), fp.hash);
+        }
+
+        ::close(fd);
+        return fp;
+    }
+
+    [[noreturn]] void read_only_error() {
+        throw std::runtime_error{"Location index loaded from file is read-only"};
+    }
+
+    /**
+     * Location index backed by a dense array in a file.
+     */
+    class DenseIndexFile : public index_type {
+
+        ReadOnlyMapping m_mapping;
+        const osmium::Location* m_data;
+        std::size_t m_size;
+
+    public:
+
+        DenseIndexFile(int fd, std::size_t count) :
+            m_mapping(fd, count * sizeof(osmium::Location), data_offset),
+            m_data(m_mapping.get<osmium::Location>()),
+            m_size(count) {
+        }
+
+        void set(const osmium::unsigned_object_id_type /*id*/, const osmium::Location /*value*/) override {
+            read_only_error();
+        }
+
+        osmium::Location get(const osmium::unsigned_object_id_type id) const override {
+            const auto location = get_noexcept(id);
+            if (location == osmium::Location{}) {
+                throw osmium::not_found{id};
+            }
+            return location;
+        }
+
+        osmium::Location get_noexcept(const osmium::unsigned_object_id_type id) const noexcept override {
+            if (id >= m_size) {
+                return osmium::Location{};
+            }
+            return m_data[id];
+        }
+
+        std::size_t size() const override {
+            return m_size;
+        }
+
+        std::size_t used_memory() const override {
+            return m_size * sizeof(osmium::Location);
+        }
+
+        void clear() override {
+        }
+
+    }; // class DenseIndexFile
+
+    /**
+     * Location index backed by a sorted list of (id, location) pairs in a
+     * file.
+     */
+    class SparseIndexFile : public index_type {
+
+        ReadOnlyMapping m_mapping;
+        const sparse_element* m_begin;
+        const sparse_element* m_end;
+
+    public:
+
+        SparseIndexFile(int fd, std::size_t count) :
+            m_mapping(fd, count * sizeof(sparse_element), data_offset),
+            m_begin(m_mapping.get<sparse_element>()),
+            m_end(m_begin + count) {
+        }
+
+        void set(const osmium::unsigned_object_id_type /*id*/, const osmium::Location /*value*/) override {
+            read_only_error();
+        }
+
+        osmium::Location get(const osmium::unsigned_object_id_type id) const override {
+            const auto location = get_noexcept(id);
+            if (location == osmium::Location{}) {
+                throw osmium::not_found{id};
+            }
+            return location;
+        }
+
+        osmium::Location get_noexcept(const osmium::unsigned_object_id_type id) const noexcept override {
+            const auto* it = std::lower_bound(m_begin, m_end, id, [](const sparse_element& element, osmium::unsigned_object_id_type value) {
+                return element.id < value;
+            });
+            if (it == m_end || it->id != id) {
+                return osmium::Location{};
+            }
+            return it->location;
+        }
+
+        std::size_t size() const override {
+            return static_cast<std::size_t>(m_end - m_begin);
+        }
+
+        std::size_t used_memory() const override {
+            return size() * sizeof(sparse_element);
+        }
+
+        void clear() override {
+        }
+
+    }; // class SparseIndexFile
+
+} // anonymous namespace
+
+void save_location_index(const std::string& filename,
+                         const osmium::io::File& input_file,
+                         const std::string& location_index_type,
+                         index_type& index) {
+    index_file_header header{};
+    std::copy(std::begin(index_file_magic), std::end(index_file_magic), header.magic.begin());
+    header.input = create_fingerprint(input_file);
+
+    const int fd = osmium::io::detail::open_for_writing(filename, osmium::io::overwrite::allow);
+
+    // Write placeholder header, will be overwritten once we know the count.
+    const std::vector<char> padding(data_offset);
+    osmium::io::detail::reliable_write(fd, padding.data(), padding.size());
+
+    std::size_t element_size = 0;
+    try {
+        if (location_index_type.find("dense") == 0) {
+            header.kind = index_kind::dense_array;
+            element_size = sizeof(osmium::Location);
+            index.dump_as_array(fd);
+        } else {
+            header.kind = index_kind::sparse_list;
+            element_size = sizeof(sparse_element);
+            index.sort();
+            index.dump_as_list(fd);
+        }
+    } catch (const std::runtime_error&) {
+        ::close(fd);
+        throw std::runtime_error{"Location index of type '" + location_index_type + "' can not be saved (use a dense_* or sparse_* index type)"};
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::system_error{errno, std::system_category(), "fstat failed"};
+    }
+    header.count = (static_cast<std::size_t>(st.st_size) - data_offset) / element_size;
+
+    if (::pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+        ::close(fd);
+        throw std::system_error{errno, std::system_category(), "Write failed"};
+    }
+
+    if (::close(fd) != 0) {
+        throw std::system_error{errno, std::system_category(), "Close failed"};
+    }
+}
+
+std::unique_ptr<index_type> load_location_index(const std::string& filename, const osmium::io::File& input_file) {
+    const int fd = ::open(filename.c_str(), O_RDONLY); // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(), std::string{"Can not open location index file '"} + filename + "'"};
+    }
+
+    index_file_header header{};
+    if (::pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+        !std::equal(header.magic.begin(), header.magic.end(), std::begin(index_file_magic))) {
+        ::close(fd);
+        throw std::runtime_error{"File '" + filename + "' is not a location index file"};
+    }
+
+    if (!(header.input == create_fingerprint(input_file))) {
+        ::close(fd);
+        throw std::runtime_error{"Location index file '" + filename + "' was not created from input file '" + input_file.filename() + "'"};
+    }
+
+    std::unique_ptr<index_type> index;
+    try {
+        if (header.kind == index_kind::dense_array) {
+            index = std::make_unique<DenseIndexFile>(fd, header.count);
+        } else {
+            index = std::make_unique<SparseIndexFile>(fd, header.count);
+        }
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+
+    // The mapping stays valid after the file is closed.
+    ::close(fd);
+
+    return index;
+}
@@ -0,0 +1,30 @@
+#ifndef INDEX_FILE_HPP
+#define INDEX_FILE_HPP
+
+#include <osmium/index/map.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/types.hpp>
+
+#include <memory>
+#include <string>
+
+/**
+ * Save the contents of a location index into a file together with a
+ * fingerprint of the OSM input file it was created from. Only the dense
+ * (dense_*) and sparse (sparse_*) index types can be saved.
+ */
+void save_location_index(const std::string& filename,
+                         const osmium::io::File& input_file,
+                         const std::string& location_index_type,
+                         osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>& index);
+
+/**
+ * Open a location index file created by save_location_index(). The file
+ * is mapped into memory read-only. Throws if the fingerprint in the index
+ * file doesn't match the input file.
+ */
+std::unique_ptr<osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>>
+load_location_index(const std::string& filename, const osmium::io::File& input_file);
+
+#endif // INDEX_FILE_HPP
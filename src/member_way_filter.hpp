@@ -0,0 +1,158 @@
+#ifndef MEMBER_WAY_FILTER_HPP
+#define MEMBER_WAY_FILTER_HPP
+
+#include "id_bitmap.hpp"
+#include "needed_nodes.hpp"
+
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <cstddef>
+
+/**
+ * Handler sitting in front of the second pass handler of a multipolygon
+ * manager which only passes on the ways the manager can do something
+ * with: member ways of the relations it collected and closed ways which
+ * could be areas by themselves. Most ways in a file are neither, the
+ * manager would have to look up each of them in its member database
+ * only to find out that it doesn't need it. This filter rejects them
+ * with a single bit test.
+ *
+ * Member ways are stored by the manager until their relation is complete,
+ * for large relations this can take most of the second pass. Member ways
+ * which can not be areas by themselves are passed on as a copy with only
+ * the ID and the nodes, because the assembler doesn't look at their tags
+ * or metadata anyway. This does not work for old style multipolygons
+ * where the tags can come from the ways.
+ *
+ * Ways with IDs <= 0 (from files edited in JOSM, for instance) can't be
+ * stored in the bitmap, so they are always treated as member ways.
+ *
+ * The ways must already have their locations when they get here. Call
+ * collect() after the first pass, until then everything is passed
+ * through.
+ */
+template <typename THandler>
+class MemberWayFilter : public osmium::handler::Handler {
+
+    THandler& m_handler;
+    IdBitmap m_member_ways;
+    osmium::memory::Buffer m_buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+    std::size_t m_rejected = 0;
+    std::size_t m_compacted = 0;
+    std::size_t m_bytes_saved = 0;
+    bool m_enabled = false;
+    bool m_members_only = false;
+    bool m_closed_by_ref = false;
+
+    // This is the same check the multipolygon manager does for ways that
+    // are not in any relation.
+    bool could_be_area(const osmium::Way& way) const noexcept {
+        const auto& nodes = way.nodes();
+        return nodes.size() > 3 &&
+               nodes.front().location() &&
+               nodes.back().location() &&
+               way.ends_have_same_location() &&
+               (!m_closed_by_ref || way.is_closed());
+    }
+
+    osmium::Way& compact(const osmium::Way& way) {
+        m_buffer.clear();
+        {
+            osmium::builder::WayBuilder builder{m_buffer};
+            builder.set_id(way.id());
+            builder.add_item(way.nodes());
+        }
+        m_buffer.commit();
+
+        auto& compact_way = m_buffer.get<osmium::Way>(0);
+        ++m_compacted;
+        m_bytes_saved += way.byte_size() - compact_way.byte_size();
+        return compact_way;
+    }
+
+public:
+
+    explicit MemberWayFilter(THandler& handler) :
+        m_handler(handler) {
+    }
+
+    template <typename TManager>
+    void collect(TManager& manager) {
+        add_member_ways(manager, m_member_ways);
+        m_enabled = true;
+    }
+
+    /**
+     * Only pass on member ways, all of them without tags. No areas are
+     * built from ways then. Use this when the ways are read again for
+     * relations that were not handled in the first round.
+     */
+    void set_members_only() noexcept {
+        m_members_only = true;
+    }
+
+    /**
+     * Only pass on ways as possible areas if their first and last node are
+     * the same. Use together with AreaManager::set_closed_by_ref().
+     */
+    void set_closed_by_ref(bool closed_by_ref) noexcept {
+        m_closed_by_ref = closed_by_ref;
+    }
+
+    void node(const osmium::Node& node) {
+        m_handler.node(node);
+    }
+
+    void way(osmium::Way& way) {
+        if (!m_enabled || (!m_members_only && could_be_area(way))) {
+            m_handler.way(way);
+        } else if (way.id() <= 0 || m_member_ways.get(way.id())) {
+            // Ways with IDs <= 0 can't be in the bitmap, they are passed
+            // on in case they are members. The manager ignores them if not.
+            m_handler.way(compact(way));
+        } else {
+            ++m_rejected;
+        }
+    }
+
+    void relation(const osmium::Relation& relation) {
+        m_handler.relation(relation);
+    }
+
+    void flush() {
+        m_handler.flush();
+    }
+
+    /**
+     * Number of ways not passed on to the handler.
+     */
+    std::size_t rejected() const noexcept {
+        return m_rejected;
+    }
+
+    /**
+     * Number of member ways passed on without tags and metadata.
+     */
+    std::size_t compacted() const noexcept {
+        return m_compacted;
+    }
+
+    /**
+     * Number of bytes the compacted member ways are smaller.
+     */
+    std::size_t bytes_saved() const noexcept {
+        return m_bytes_saved;
+    }
+
+    std::size_t used_memory() const noexcept {
+        return m_member_ways.used_memory();
+    }
+
+}; // class MemberWayFilter
+
+#endif // MEMBER_WAY_FILTER_HPP
@@ -0,0 +1,140 @@
+/*****************************************************************************
+
+  OSM Area Tools - Metrics
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "metrics.hpp"
+
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+namespace {
+
+    // Resident set size of this process from /proc (Linux only), 0 if
+    // unknown.
+    uint64_t resident_memory() {
+        std::ifstream statm{"/proc/self/statm"};
+        uint64_t size = 0;
+        uint64_t resident = 0;
+        if (!(statm >> size >> resident)) {
+            return 0;
+        }
+        return resident * static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+    }
+
+    void write_metric(std::ostream& out, const char* name, const char* type, const char* help) {
+        out << "# HELP oat_" << name << ' ' << help << '\n'
+            << "# TYPE oat_" << name << ' ' << type << '\n';
+    }
+
+} // anonymous namespace
+
+MetricsWriter::~MetricsWriter() noexcept {
+    try {
+        close();
+    } catch (...) {
+        // ignore errors in destructor
+    }
+}
+
+void MetricsWriter::open(const std::string& filename, std::chrono::seconds interval) {
+    m_filename = filename;
+    m_interval = interval;
+    write();
+    m_thread = std::thread{&MetricsWriter::run, this};
+}
+
+void MetricsWriter::close() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        const std::lock_guard<std::mutex> lock{m_mutex};
+        m_done = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+    write();
+}
+
+void MetricsWriter::run() {
+    std::unique_lock<std::mutex> lock{m_mutex};
+    while (!m_cv.wait_for(lock, m_interval, [this] { return m_done; })) {
+        try {
+            write();
+        } catch (const std::exception&) {
+            // try again next time
+        }
+    }
+}
+
+void MetricsWriter::write() const {
+    const auto value = [this](metric m) {
+        return m_values[m].load(std::memory_order_relaxed);
+    };
+    const auto label = "{program=\"" + m_program + "\"}";
+    const auto type_label = [this](const char* type) {
+        return "{program=\"" + m_program + "\",type=\"" + type + "\"}";
+    };
+
+    // Write to temporary file and rename, so readers never see a
+    // partially written file.
+    const std::string tmp_filename{m_filename + ".tmp"};
+    {
+        std::ofstream out{tmp_filename};
+        if (!out) {
+            throw std::runtime_error{"Can not open metrics file '" + tmp_filename + "'"};
+        }
+
+        write_metric(out, "pass", "gauge", "Current pass through the input file.");
+        out << "oat_pass" << label << ' ' << value(pass) << '\n';
+
+        write_metric(out, "objects_read_total", "counter", "OSM objects read in the current pass.");
+        out << "oat_objects_read_total" << type_label("node") << ' ' << value(nodes) << '\n'
+            << "oat_objects_read_total" << type_label("way") << ' ' << value(ways) << '\n'
+            << "oat_objects_read_total" << type_label("relation") << ' ' << value(relations) << '\n';
+
+        write_metric(out, "bytes_read_total", "counter", "Bytes read from the input file in the current pass.");
+        out << "oat_bytes_read_total" << label << ' ' << value(bytes_read) << '\n';
+
+        write_metric(out, "input_bytes", "gauge", "Size of the input file.");
+        out << "oat_input_bytes" << label << ' ' << value(input_bytes) << '\n';
+
+        write_metric(out, "pending_relations", "gauge", "Relations waiting for member ways in the multipolygon manager.");
+        out << "oat_pending_relations" << label << ' ' << value(pending_relations) << '\n';
+
+        write_metric(out, "areas_total", "counter", "Areas assembled.");
+        out << "oat_areas_total" << label << ' ' << value(areas) << '\n';
+
+        write_metric(out, "problems_total", "counter", "Problems found while assembling areas.");
+        out << "oat_problems_total" << label << ' ' << value(problems) << '\n';
+
+        write_metric(out, "resident_memory_bytes", "gauge", "Resident memory of the process.");
+        out << "oat_resident_memory_bytes" << label << ' ' << resident_memory() << '\n';
+
+        write_metric(out, "location_index_bytes", "gauge", "Memory used by the location index.");
+        out << "oat_location_index_bytes" << label << ' ' << value(location_index_bytes) << '\n';
+
+        write_metric(out, "elapsed_seconds", "gauge", "Time since the program started.");
+        out << "oat_elapsed_seconds" << label << ' '
+            << std::chrono::duration_cast<std::chrono::seconds>(clock::now() - m_start).count() << '\n';
+
+        write_metric(out, "last_update_timestamp_seconds", "gauge", "Time this file was written.");
+        out << "oat_last_update_timestamp_seconds" << label << ' ' << std::time(nullptr) << '\n';
+
+        if (!out) {
+            throw std::runtime_error{"Error writing metrics file '" + tmp_filename + "'"};
+        }
+    }
+
+    if (std::rename(tmp_filename.c_str(), m_filename.c_str()) != 0) {
+        throw std::runtime_error{"Can not rename metrics file to '" + m_filename + "'"};
+    }
+}
@@ -0,0 +1,250 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <osmium/area/stats.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/area.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+/**
+ * Values describing the progress of a running program. A background thread
+ * writes them periodically into a file in the Prometheus text exposition
+ * format (usable with the textfile collector of the node exporter), so
+ * that long runs can be monitored while they are still going.
+ *
+ * The values are set from the main thread, usually from a MetricsHandler.
+ * Until open() is called nothing is written.
+ */
+class MetricsWriter {
+
+public:
+
+    enum metric : std::size_t {
+        pass,
+        nodes,
+        ways,
+        relations,
+        bytes_read,
+        input_bytes,
+        pending_relations,
+        areas,
+        problems,
+        location_index_bytes,
+        num_metrics
+    };
+
+    using clock = std::chrono::steady_clock;
+
+private:
+
+    std::string m_program;
+    std::string m_filename;
+    std::chrono::seconds m_interval{10};
+    std::array<std::atomic<uint64_t>, num_metrics> m_values{};
+    clock::time_point m_start = clock::now();
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_done = false;
+    std::thread m_thread;
+
+    void run();
+
+    void write() const;
+
+public:
+
+    explicit MetricsWriter(std::string program) :
+        m_program(std::move(program)) {
+    }
+
+    MetricsWriter(const MetricsWriter&) = delete;
+    MetricsWriter& operator=(const MetricsWriter&) = delete;
+
+    MetricsWriter(MetricsWriter&&) = delete;
+    MetricsWriter& operator=(MetricsWriter&&) = delete;
+
+    ~MetricsWriter() noexcept;
+
+    /**
+     * Start writing the metrics into filename every interval.
+     */
+    void open(const std::string& filename, std::chrono::seconds interval);
+
+    /**
+     * Write the metrics a last time and stop the background thread.
+     */
+    void close();
+
+    bool enabled() const noexcept {
+        return !m_filename.empty();
+    }
+
+    std::chrono::seconds interval() const noexcept {
+        return m_interval;
+    }
+
+    void set(metric m, uint64_t value) noexcept {
+        m_values[m].store(value, std::memory_order_relaxed);
+    }
+
+    void add(metric m, uint64_t value) noexcept {
+        m_values[m].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /**
+     * Start a new pass through the input. The object counts and bytes
+     * read are reset.
+     */
+    void start_pass(uint64_t number) noexcept {
+        set(pass, number);
+        set(nodes, 0);
+        set(ways, 0);
+        set(relations, 0);
+        set(bytes_read, 0);
+    }
+
+    /**
+     * Add the areas in the buffer to the areas count.
+     */
+    void add_areas(const osmium::memory::Buffer& buffer) noexcept {
+        if (buffer) {
+            add(areas, static_cast<uint64_t>(std::distance(buffer.cbegin<osmium::Area>(), buffer.cend<osmium::Area>())));
+        }
+    }
+
+}; // class MetricsWriter
+
+/**
+ * Sum of all problems found by the assemblers.
+ */
+inline uint64_t count_problems(const osmium::area::area_stats& stats) noexcept {
+    return stats.duplicate_nodes +
+           stats.duplicate_segments +
+           stats.duplicate_ways +
+           stats.inner_with_same_tags +
+           stats.intersections +
+           stats.invalid_locations +
+           stats.open_rings +
+           stats.touching_rings +
+           stats.ways_in_multiple_rings +
+           stats.wrong_role;
+}
+
+namespace detail {
+
+    template <typename TManager>
+    auto pending_relations(TManager& manager, int /*dummy*/) -> decltype(manager.relations_database().count_relations()) {
+        return manager.relations_database().count_relations();
+    }
+
+    // The legacy multipolygon manager doesn't have a relations database.
+    template <typename TManager>
+    std::size_t pending_relations(TManager& /*manager*/, long /*dummy*/) {
+        return 0;
+    }
+
+} // namespace detail
+
+/**
+ * Set the metrics taken from the multipolygon manager.
+ */
+template <typename TManager>
+void sample_manager(MetricsWriter& metrics, TManager& manager) {
+    metrics.set(MetricsWriter::pending_relations, detail::pending_relations(manager, 0));
+    metrics.set(MetricsWriter::problems, count_problems(manager.stats()));
+}
+
+/**
+ * Handler counting the objects read. Every few thousand objects it checks
+ * whether the metrics are due and if so calls the sample function which
+ * can set other metrics that have to be taken from the main thread (like
+ * the number of bytes read or the memory used by the location index).
+ */
+class MetricsHandler : public osmium::handler::Handler {
+
+    MetricsWriter& m_metrics;
+    std::function<void()> m_sample;
+    std::array<uint64_t, 3> m_counts{};
+    uint64_t m_objects = 0;
+    MetricsWriter::clock::time_point m_next;
+
+    void count(std::size_t n) {
+        ++m_counts[n];
+        if ((++m_objects & 0xfffU) != 0 || !m_metrics.enabled()) {
+            return;
+        }
+        const auto now = MetricsWriter::clock::now();
+        if (now >= m_next) {
+            flush();
+            m_next = now + m_metrics.interval() / 2;
+        }
+    }
+
+public:
+
+    MetricsHandler(MetricsWriter& metrics, std::function<void()> sample) :
+        m_metrics(metrics),
+        m_sample(std::move(sample)),
+        m_next(MetricsWriter::clock::now()) {
+    }
+
+    void node(const osmium::Node& /*node*/) {
+        count(0);
+    }
+
+    void way(const osmium::Way& /*way*/) {
+        count(1);
+    }
+
+    void relation(const osmium::Relation& /*relation*/) {
+        count(2);
+    }
+
+    /**
+     * Publish the counts and call the sample function. Call this at the
+     * end of a pass.
+     */
+    void flush() {
+        m_metrics.set(MetricsWriter::nodes, m_counts[0]);
+        m_metrics.set(MetricsWriter::ways, m_counts[1]);
+        m_metrics.set(MetricsWriter::relations, m_counts[2]);
+        if (m_sample) {
+            m_sample();
+        }
+    }
+
+}; // class MetricsHandler
+
+/**
+ * Create a handler for the pass reading from reader which also samples
+ * the bytes read, the multipolygon manager, and the location index.
+ */
+template <typename TManager, typename TIndex>
+MetricsHandler make_metrics_handler(MetricsWriter& metrics, const osmium::io::Reader& reader, TManager& manager, const TIndex& index) {
+    return MetricsHandler{metrics, [&metrics, &reader, &manager, &index]() {
+        metrics.set(MetricsWriter::bytes_read, reader.offset());
+        metrics.set(MetricsWriter::input_bytes, reader.file_size());
+        metrics.set(MetricsWriter::location_index_bytes, index.used_memory());
+        sample_manager(metrics, manager);
+    }};
+}
+
+#endif // METRICS_HPP
@@ -0,0 +1,82 @@
+#ifndef NEEDED_NODES_HPP
+#define NEEDED_NODES_HPP
+
+#include "id_bitmap.hpp"
+#include "oat.hpp"
+
+#include <osmium/handler.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/relations/relations_database.hpp>
+
+#include <cstddef>
+
+/**
+ * Add the IDs of all member ways of the relations in the relations
+ * database of the manager to the member_ways set.
+ */
+template <typename TManager>
+void add_member_ways(TManager& manager, IdBitmap& member_ways) {
+    manager.relations_database().for_each_relation([&](const osmium::relations::RelationHandle& handle) {
+        for (const auto& member : handle->members()) {
+            if (member.type() == osmium::item_type::way) {
+                member_ways.set(member.ref());
+            }
+        }
+    });
+}
+
+/**
+ * Handler sitting in front of a location handler which can restrict the
+ * location index to the nodes that are actually needed for assembling
+ * areas, ie. the nodes of closed ways and of member ways of the relations
+ * in a relations manager. Call collect() after the first pass to find
+ * those nodes, this needs an extra read of the ways in the input file.
+ * Until collect() is called, everything is passed through.
+ */
+template <typename TLocationHandler>
+class NeededNodesFilter : public osmium::handler::Handler {
+
+    TLocationHandler& m_location_handler;
+    IdBitmap m_member_ways;
+    IdBitmap m_nodes;
+    bool m_enabled = false;
+
+public:
+
+    explicit NeededNodesFilter(TLocationHandler& location_handler) :
+        m_location_handler(location_handler) {
+    }
+
+    template <typename TManager>
+    void collect(const osmium::io::File& input_file, TManager& manager) {
+        add_member_ways(manager, m_member_ways);
+        collect_needed_nodes(input_file, m_member_ways, m_nodes);
+        m_enabled = true;
+    }
+
+    // Nodes with IDs <= 0 can't be in the bitmap, they are always kept.
+    void node(const osmium::Node& node) {
+        if (!m_enabled || node.id() <= 0 || m_nodes.get(node.id())) {
+            m_location_handler.node(node);
+        }
+    }
+
+    // Ways that are not needed don't get their locations looked up, they
+    // will be ignored by the relations manager anyway.
+    void way(osmium::Way& way) {
+        if (!m_enabled || is_needed_way(way, m_member_ways)) {
+            m_location_handler.way(way);
+        }
+    }
+
+    std::size_t used_memory() const noexcept {
+        return m_member_ways.used_memory() + m_nodes.used_memory();
+    }
+
+}; // class NeededNodesFilter
+
+#endif // NEEDED_NODES_HPP
@@ -0,0 +1,141 @@
+#ifndef NODE_READER_HPP
+#define NODE_READER_HPP
+
+#include <osmium/index/map.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/visitor.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <utility>
+
+/**
+ * Reads the nodes from the input file into a location handler in a
+ * separate thread. If this is started before the first pass, the nodes
+ * are read while the relations are read and the second pass only needs
+ * the ways.
+ *
+ * With worker threads, the locations are written directly into a dense
+ * location index by the workers, one buffer of nodes per task. The
+ * reading thread only looks at the node IDs: It stores the (rare) nodes
+ * with negative IDs in the location handler and grows the index when
+ * needed. Growing the index can move it in memory, so it waits for all
+ * workers before doing that. The index is grown in large steps, so this
+ * doesn't happen often.
+ *
+ * The location handler and the index must not be used by anything else
+ * until wait() returned.
+ */
+template <typename TLocationHandler>
+class BackgroundNodeReader {
+
+    using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
+
+    // Grow the index by at least this many IDs (128MB for a dense array).
+    enum : osmium::unsigned_object_id_type {
+        index_growth = 16UL * 1024UL * 1024UL
+    };
+
+    std::future<void> m_result;
+
+    static void set_locations(const osmium::memory::Buffer& buffer, index_type& index) {
+        for (const auto& node : buffer.select<osmium::Node>()) {
+            if (node.id() >= 0) {
+                index.set(node.positive_id(), node.location());
+            }
+        }
+    }
+
+    static void drain(std::deque<std::future<void>>& results, std::size_t max_results) {
+        while (results.size() > max_results) {
+            results.front().get();
+            results.pop_front();
+        }
+    }
+
+    static void read_parallel(const osmium::io::File& input_file, TLocationHandler& location_handler, index_type& index, int num_threads) {
+        const auto max_results = static_cast<std::size_t>(num_threads) * 4;
+        osmium::thread::Pool pool{num_threads, max_results};
+        std::deque<std::future<void>> results;
+
+        try {
+            osmium::io::Reader reader{input_file, osmium::osm_entity_bits::node};
+            while (osmium::memory::Buffer buffer = reader.read()) {
+                osmium::unsigned_object_id_type max_id = 0;
+                bool has_nodes = false;
+                for (const auto& node : buffer.select<osmium::Node>()) {
+                    if (node.id() < 0) {
+                        location_handler.node(node);
+                    } else if (!has_nodes || node.positive_id() > max_id) {
+                        max_id = node.positive_id();
+                        has_nodes = true;
+                    }
+                }
+                if (!has_nodes) {
+                    continue;
+                }
+
+                if (max_id >= index.size()) {
+                    drain(results, 0);
+                    index.set(max_id + index_growth, osmium::Location{});
+                }
+
+                results.push_back(pool.submit([&index, buffer = std::move(buffer)]() {
+                    set_locations(buffer, index);
+                }));
+                drain(results, max_results);
+            }
+            reader.close();
+            drain(results, 0);
+        } catch (...) {
+            // The workers use the index, they have to be finished before
+            // it can go away.
+            for (auto& result : results) {
+                result.wait();
+            }
+            throw;
+        }
+    }
+
+public:
+
+    BackgroundNodeReader(const osmium::io::File& input_file, TLocationHandler& location_handler) :
+        m_result(std::async(std::launch::async, [input_file, &location_handler]() {
+            osmium::io::Reader reader{input_file, osmium::osm_entity_bits::node};
+            osmium::apply(reader, location_handler);
+            reader.close();
+        })) {
+    }
+
+    /**
+     * Read the nodes and write their locations into the index from
+     * num_threads worker threads. This only works with dense index types
+     * which is the index used by the location handler for positive IDs.
+     */
+    BackgroundNodeReader(const osmium::io::File& input_file, TLocationHandler& location_handler, index_type& index, int num_threads) :
+        m_result(std::async(std::launch::async, [input_file, &location_handler, &index, num_threads]() {
+            read_parallel(input_file, location_handler, index, num_threads);
+        })) {
+    }
+
+    /**
+     * Wait until all nodes were read. Rethrows any exception from the
+     * reading thread.
+     */
+    void wait() {
+        if (m_result.valid()) {
+            m_result.get();
+        }
+    }
+
+}; // class BackgroundNodeReader
+
+#endif // NODE_READER_HPP
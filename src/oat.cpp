@@ -6,12 +6,28 @@
 
 *****************************************************************************/
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <osmium/index/map.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/osm/box.hpp>
 #include <osmium/osm/location.hpp>
 #include <osmium/osm/types.hpp>
+#include <osmium/tags/matcher.hpp>
 
+#include "id_bitmap.hpp"
 #include "oat.hpp"
 
 osmium::osm_entity_bits::type entity_bits(const std::string& location_index_type) {
@@ -33,3 +49,243 @@ void show_index_types() {
     }
 }
 
+namespace {
+
+    // Estimate for the largest node ID in current OSM data. This is used
+    // for the size of the dense indexes.
+    constexpr const std::size_t estimated_max_node_id = 14000000000ULL;
+
+    // Estimated memory needed per node in the index types.
+    constexpr const std::size_t sparse_bytes_per_node = sizeof(osmium::unsigned_object_id_type) + sizeof(osmium::Location);
+    constexpr const std::size_t compressed_bytes_per_node = 4;
+
+    // Rough estimate of the number of bytes in the input file per node.
+    std::size_t file_bytes_per_node(const osmium::io::File& file) {
+        const bool compressed = file.compression() != osmium::io::file_compression::none;
+        switch (file.format()) {
+            case osmium::io::file_format::pbf:
+                return 8;
+            case osmium::io::file_format::xml:
+                return compressed ? 12 : 100;
+            default:
+                return compressed ? 12 : 60;
+        }
+    }
+
+    std::size_t file_size(const osmium::io::File& file) {
+        if (file.filename().empty()) {
+            return 0;
+        }
+        struct stat st{};
+        if (::stat(file.filename().c_str(), &st) != 0) {
+            return 0;
+        }
+        return static_cast<std::size_t>(st.st_size);
+    }
+
+    // Memory available for new allocations without swapping (Linux only),
+    // 0 if unknown.
+    std::size_t available_memory() {
+        std::ifstream meminfo{"/proc/meminfo"};
+        std::string line;
+        while (std::getline(meminfo, line)) {
+            std::istringstream fields{line};
+            std::string key;
+            std::size_t value = 0;
+            if (fields >> key >> value && key == "MemAvailable:") {
+                return value * 1024;
+            }
+        }
+        return 0;
+    }
+
+    bool has_locations_on_ways(const osmium::io::Header& header) {
+        for (int i = 0;; ++i) {
+            const auto feature = header.get("pbf_optional_feature_" + std::to_string(i));
+            if (feature.empty()) {
+                return false;
+            }
+            if (feature == "LocationsOnWays") {
+                return true;
+            }
+        }
+    }
+
+    bool covers_world(const osmium::io::Header& header) {
+        return std::any_of(header.boxes().cbegin(), header.boxes().cend(), [](const osmium::Box& box) {
+            return box.valid() && box.top_right().lon() - box.bottom_left().lon() > 350.0;
+        });
+    }
+
+    std::size_t mbytes(std::size_t bytes) noexcept {
+        return bytes / (1024UL * 1024UL);
+    }
+
+} // anonymous namespace
+
+std::size_t parse_memory_size(const char* str) {
+    // strtoull() would accept leading white space and signs, "-1" would
+    // become a huge number.
+    if (!std::isdigit(static_cast<unsigned char>(*str))) {
+        return 0;
+    }
+
+    char* end = nullptr;
+    errno = 0;
+    const auto value = std::strtoull(str, &end, 10);
+    if (errno == ERANGE || value > std::numeric_limits<std::size_t>::max()) {
+        return 0;
+    }
+
+    unsigned int shift = 0;
+    switch (*end) {
+        case '\0':
+            return value;
+        case 'k':
+        case 'K':
+            shift = 10;
+            break;
+        case 'M':
+            shift = 20;
+            break;
+        case 'G':
+            shift = 30;
+            break;
+        case 'T':
+            shift = 40;
+            break;
+        default:
+            return 0;
+    }
+
+    ++end;
+    if (*end == 'B') {
+        ++end;
+    }
+    if (*end != '\0') {
+        return 0;
+    }
+
+    if (value > (std::numeric_limits<std::size_t>::max() >> shift)) {
+        return 0;
+    }
+
+    return static_cast<std::size_t>(value) << shift;
+}
+
+std::string choose_index_type(const osmium::io::File& input_file, std::size_t max_memory, std::ostream& out) {
+    osmium::io::Header header;
+    {
+        osmium::io::Reader reader{input_file, osmium::osm_entity_bits::nothing};
+        header = reader.header();
+        reader.close();
+    }
+
+    if (has_locations_on_ways(header)) {
+        out << "Input file has locations on ways, using index type 'none'.\n";
+        return "none";
+    }
+
+    const auto size = file_size(input_file);
+    if (size == 0) {
+        out << "Warning: Size of input file unknown, using index type 'flex_mem'.\n";
+        return "flex_mem";
+    }
+
+    std::size_t budget = max_memory;
+    const auto available = available_memory();
+    if (available > 0 && available < max_memory) {
+        out << "Warning: Only " << mbytes(available) << "MB of memory available, using that as limit.\n";
+        budget = available;
+    }
+
+    const auto nodes = size / file_bytes_per_node(input_file);
+    const auto sparse = nodes * sparse_bytes_per_node;
+    const auto dense = estimated_max_node_id * sizeof(osmium::Location);
+    const auto compressed = nodes * compressed_bytes_per_node;
+    const bool planet = covers_world(header) || dense < sparse;
+
+    out << "Estimated memory for location index (about " << nodes << " nodes"
+        << (planet ? ", planet" : "") << "):\n"
+        << "  sparse:     " << mbytes(sparse) << "MB\n"
+        << "  dense:      " << mbytes(dense) << "MB\n"
+        << "  compressed: " << mbytes(compressed) << "MB\n"
+        << "  limit:      " << mbytes(budget) << "MB\n";
+
+    const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+    const bool have_mmap = map_factory.has_map_type("dense_mmap_array");
+
+    std::string type;
+    if (planet) {
+        if (dense <= budget) {
+            type = have_mmap ? "dense_mmap_array" : "dense_mem_array";
+        } else if (compressed <= budget) {
+            type = "compressed_block";
+        } else {
+            out << "Warning: No location index fits into the memory limit, this will be slow.\n";
+            type = have_mmap ? "dense_mmap_array" : "compressed_block";
+        }
+    } else {
+        // The mem version needs extra memory when growing the array.
+        if (sparse * 2 <= budget) {
+            type = "sparse_mem_array";
+        } else if (sparse <= budget && have_mmap) {
+            type = "sparse_mmap_array";
+        } else if (compressed <= budget) {
+            type = "compressed_block";
+        } else {
+            out << "Warning: No location index fits into the memory limit, this will be slow.\n";
+            type = have_mmap ? "sparse_mmap_array" : "compressed_block";
+        }
+    }
+
+    out << "Using index type '" << type << "'.\n";
+    return type;
+}
+
+osmium::TagsFilter parse_tags_filter(const std::string& expression) {
+    if (expression.empty() || expression.back() == ',') {
+        throw std::runtime_error{"Invalid filter expression '" + expression + "'"};
+    }
+
+    osmium::TagsFilter filter{false};
+
+    std::istringstream entries{expression};
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+        const auto pos = entry.find('=');
+        const std::string key{entry.substr(0, pos)};
+        if (key.empty()) {
+            throw std::runtime_error{"Invalid filter expression '" + expression + "': empty key"};
+        }
+        if (pos == std::string::npos || entry.substr(pos + 1) == "*") {
+            filter.add_rule(true, osmium::TagMatcher{key});
+        } else {
+            filter.add_rule(true, osmium::TagMatcher{key, entry.substr(pos + 1)});
+        }
+    }
+
+    return filter;
+}
+
+bool is_needed_way(const osmium::Way& way, const IdBitmap& member_ways) noexcept {
+    const auto& nodes = way.nodes();
+    if (nodes.size() > 3 && way.is_closed()) {
+        return true;
+    }
+    return way.id() <= 0 || member_ways.get(way.id());
+}
+
+void collect_needed_nodes(const osmium::io::File& input_file, const IdBitmap& member_ways, IdBitmap& nodes) {
+    osmium::io::Reader reader{input_file, osmium::osm_entity_bits::way};
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        for (const auto& way : buffer.select<osmium::Way>()) {
+            if (is_needed_way(way, member_ways)) {
+                for (const auto& node_ref : way.nodes()) {
+                    nodes.set(node_ref.ref());
+                }
+            }
+        }
+    }
+    reader.close();
+}
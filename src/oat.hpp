@@ -1,9 +1,16 @@
 #ifndef OAT_HPP
 #define OAT_HPP
 
+#include <cstddef>
+#include <ostream>
 #include <string>
 
+#include <osmium/io/file.hpp>
 #include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/tags/tags_filter.hpp>
+
+class IdBitmap;
 
 enum exit_codes {
     exit_code_ok            = 0,
@@ -15,4 +22,42 @@ osmium::osm_entity_bits::type entity_bits(const std::string& location_index_type
 
 void show_index_types();
 
+/**
+ * Parse a memory size like "800M" or "16G" (suffixes k, M, G, T with
+ * optional B, multiples of 1024). Returns 0 if the size is invalid, negative,
+ * or too large.
+ */
+std::size_t parse_memory_size(const char* str);
+
+/**
+ * Choose a location index type for the input file which fits into
+ * max_memory bytes (and into the memory available on the machine) based
+ * on the size of the input file, the bounding box in its header and on
+ * whether it contains locations on ways. Prints the estimates and the
+ * choice to out.
+ */
+std::string choose_index_type(const osmium::io::File& input_file, std::size_t max_memory, std::ostream& out);
+
+/**
+ * Parse a tag filter expression: A comma-separated list of keys ("building"
+ * or "building=*") and tags ("natural=water"). The filter matches a tag if
+ * any of the list entries matches it. Throws std::runtime_error if the
+ * expression is invalid.
+ */
+osmium::TagsFilter parse_tags_filter(const std::string& expression);
+
+/**
+ * Is this way needed for assembling areas? That's the case if it is closed
+ * (first and last node are the same, the locations are not known yet) or
+ * if it is in the member_ways set. Ways with IDs <= 0 (from files edited
+ * in JOSM, for instance) can't be in the set, they are always needed.
+ */
+bool is_needed_way(const osmium::Way& way, const IdBitmap& member_ways) noexcept;
+
+/**
+ * Read all ways from the input file and add the IDs of the nodes of all
+ * needed ways (see is_needed_way()) to the nodes set.
+ */
+void collect_needed_nodes(const osmium::io::File& input_file, const IdBitmap& member_ways, IdBitmap& nodes);
+
 #endif // OAT_HPP
@@ -0,0 +1,14 @@
+#ifndef OAT_ASSEMBLER_HPP
+#define OAT_ASSEMBLER_HPP
+
+#include "caching_assembler.hpp"
+#include "splitting_assembler.hpp"
+
+/**
+ * The assembler oat_create_areas uses (unless compiled with old style
+ * multipolygon support). The assembler benchmark uses it, too, so it
+ * measures the same code.
+ */
+using oat_assembler_type = CachingAssembler<SplittingAssembler>;
+
+#endif // OAT_ASSEMBLER_HPP
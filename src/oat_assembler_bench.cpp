@@ -0,0 +1,397 @@
+/*****************************************************************************
+
+  OSM Area Tools - Assembler benchmark
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "oat.hpp"
+
+//#define WITH_OLD_STYLE_MP_SUPPORT
+
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
+# include <osmium/area/assembler_legacy.hpp>
+using assembler_type = osmium::area::AssemblerLegacy;
+#else
+# include "oat_assembler.hpp"
+using assembler_type = oat_assembler_type;
+#endif
+
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node_ref.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/memory.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Count all allocations to see how much memory the assembler allocates.
+namespace {
+
+    std::atomic<std::size_t> allocations{0};
+    std::atomic<std::size_t> allocated_bytes{0};
+
+} // anonymous namespace
+
+void* operator new(std::size_t size) {
+    ++allocations;
+    allocated_bytes += size;
+    void* ptr = std::malloc(size == 0 ? 1 : size); // NOLINT(cppcoreguidelines-no-malloc,hicpp-no-malloc)
+    if (!ptr) {
+        throw std::bad_alloc{};
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr); // NOLINT(cppcoreguidelines-no-malloc,hicpp-no-malloc)
+}
+
+void operator delete(void* ptr, std::size_t /*size*/) noexcept {
+    std::free(ptr); // NOLINT(cppcoreguidelines-no-malloc,hicpp-no-malloc)
+}
+
+namespace {
+
+    /**
+     * Builds a multipolygon relation and its member ways in a buffer. Nodes
+     * at the same location get the same ID.
+     */
+    class ShapeBuilder {
+
+        osmium::memory::Buffer m_buffer{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+        std::map<osmium::Location, osmium::object_id_type> m_node_ids;
+        std::vector<std::pair<osmium::object_id_type, const char*>> m_members;
+        std::vector<std::size_t> m_way_offsets;
+        std::size_t m_segments = 0;
+
+        osmium::object_id_type node_id(osmium::Location location) {
+            const auto it = m_node_ids.emplace(location, static_cast<osmium::object_id_type>(m_node_ids.size() + 1));
+            return it.first->second;
+        }
+
+    public:
+
+        /**
+         * Add a member way with the given coordinates (in degrees).
+         */
+        void add_way(const std::vector<std::pair<double, double>>& coordinates, const char* role) {
+            const auto id = static_cast<osmium::object_id_type>(m_members.size() + 1);
+            {
+                osmium::builder::WayBuilder builder{m_buffer};
+                builder.set_id(id);
+                osmium::builder::WayNodeListBuilder nodes{builder};
+                for (const auto& c : coordinates) {
+                    const osmium::Location location{c.first, c.second};
+                    nodes.add_node_ref(osmium::NodeRef{node_id(location), location});
+                }
+            }
+            m_way_offsets.push_back(m_buffer.commit());
+            m_members.emplace_back(id, role);
+            if (!coordinates.empty()) {
+                m_segments += coordinates.size() - 1;
+            }
+        }
+
+        /**
+         * Add the relation. Call this after all ways have been added.
+         */
+        void add_relation() {
+            {
+                osmium::builder::RelationBuilder builder{m_buffer};
+                builder.set_id(1);
+                {
+                    osmium::builder::TagListBuilder tags{builder};
+                    tags.add_tag("type", "multipolygon");
+                    tags.add_tag("landuse", "forest");
+                }
+                osmium::builder::RelationMemberListBuilder members{builder};
+                for (const auto& member : m_members) {
+                    members.add_member(osmium::item_type::way, member.first, member.second);
+                }
+            }
+            m_buffer.commit();
+        }
+
+        const osmium::Relation& relation() const {
+            return *m_buffer.select<osmium::Relation>().cbegin();
+        }
+
+        std::vector<const osmium::Way*> ways() const {
+            std::vector<const osmium::Way*> result;
+            for (const auto offset : m_way_offsets) {
+                result.push_back(&m_buffer.get<osmium::Way>(offset));
+            }
+            return result;
+        }
+
+        std::size_t segments() const noexcept {
+            return m_segments;
+        }
+
+    }; // class ShapeBuilder
+
+    using square = std::vector<std::pair<double, double>>;
+
+    square make_square(double x, double y, double size) {
+        return {{x, y}, {x + size, y}, {x + size, y + size}, {x, y + size}, {x, y}};
+    }
+
+    // One outer ring with num inner rings on a grid.
+    void inner_rings(ShapeBuilder& builder, std::size_t num) {
+        const auto n = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(num))));
+        const double cell = 0.001;
+        builder.add_way(make_square(0.0, 0.0, cell * static_cast<double>(n)), "outer");
+        for (std::size_t i = 0; i < num; ++i) {
+            const auto x = static_cast<double>(i % n) * cell;
+            const auto y = static_cast<double>(i / n) * cell;
+            builder.add_way(make_square(x + cell / 4, y + cell / 4, cell / 2), "inner");
+        }
+    }
+
+    // A circle made of num ways with one segment each.
+    void member_ways(ShapeBuilder& builder, std::size_t num) {
+        const double pi = std::acos(-1.0);
+        const double radius = 0.5;
+        const auto point = [&](std::size_t i) {
+            const double angle = 2 * pi * static_cast<double>(i % num) / static_cast<double>(num);
+            return std::make_pair(radius * std::cos(angle), radius * std::sin(angle));
+        };
+        for (std::size_t i = 0; i < num; ++i) {
+            builder.add_way({point(i), point(i + 1)}, "outer");
+        }
+    }
+
+    // Checkerboard of num outer rings touching each other at the corners.
+    void touching_rings(ShapeBuilder& builder, std::size_t num) {
+        const auto n = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(num * 2))));
+        const double cell = 0.001;
+        std::size_t count = 0;
+        for (std::size_t y = 0; y < n && count < num; ++y) {
+            for (std::size_t x = (y % 2); x < n && count < num; x += 2) {
+                builder.add_way(make_square(static_cast<double>(x) * cell, static_cast<double>(y) * cell, cell), "outer");
+                ++count;
+            }
+        }
+    }
+
+    // Grid of num separate outer rings, like the islands of a country.
+    // With enough rings the relation is split into parts which are
+    // assembled in parallel.
+    void islands(ShapeBuilder& builder, std::size_t num) {
+        const auto n = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(num))));
+        const double cell = 0.001;
+        for (std::size_t i = 0; i < num; ++i) {
+            const auto x = static_cast<double>(i % n) * cell;
+            const auto y = static_cast<double>(i / n) * cell;
+            builder.add_way(make_square(x + cell / 4, y + cell / 4, cell / 2), "outer");
+        }
+    }
+
+    // A spiral band with num nodes split into ways of 1000 nodes.
+    void spiral(ShapeBuilder& builder, std::size_t num) {
+        const double pi = std::acos(-1.0);
+        const std::size_t half = std::max<std::size_t>(num / 2, 4);
+        const double turns = std::max(1.0, static_cast<double>(half) / 500.0);
+        const double band = 0.01;
+
+        std::vector<std::pair<double, double>> points;
+        points.reserve(half * 2 + 1);
+        for (std::size_t i = 0; i < half; ++i) {
+            const double angle = 2 * pi * turns * static_cast<double>(i) / static_cast<double>(half);
+            const double radius = band * 2 * angle / (2 * pi) + band;
+            points.emplace_back(radius * std::cos(angle), radius * std::sin(angle));
+        }
+        for (std::size_t i = half; i > 0; --i) {
+            const double angle = 2 * pi * turns * static_cast<double>(i - 1) / static_cast<double>(half);
+            const double radius = band * 2 * angle / (2 * pi) + band * 2;
+            points.emplace_back(radius * std::cos(angle), radius * std::sin(angle));
+        }
+        points.push_back(points.front());
+
+        constexpr const std::size_t nodes_per_way = 1000;
+        for (std::size_t start = 0; start + 1 < points.size(); start += nodes_per_way - 1) {
+            const auto end = std::min(start + nodes_per_way, points.size());
+            builder.add_way({points.begin() + static_cast<std::ptrdiff_t>(start), points.begin() + static_cast<std::ptrdiff_t>(end)}, "outer");
+        }
+    }
+
+    struct shape {
+        const char* name;
+        std::size_t size;
+        std::function<void(ShapeBuilder&, std::size_t)> create;
+    };
+
+    // Reset the peak RSS of this process (Linux only), so the peak can be
+    // measured for each shape.
+    void reset_peak_rss() {
+        std::ofstream clear_refs{"/proc/self/clear_refs"};
+        clear_refs << "5\n";
+    }
+
+    void run_benchmark(const shape& s, std::size_t repeat, const assembler_type::config_type& config) {
+        ShapeBuilder builder;
+        s.create(builder, s.size);
+        builder.add_relation();
+        const auto& relation = builder.relation();
+        const auto ways = builder.ways();
+
+        reset_peak_rss();
+        const auto start_allocations = allocations.load();
+        const auto start_bytes = allocated_bytes.load();
+        osmium::area::area_stats stats;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < repeat; ++i) {
+            osmium::memory::Buffer out{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+            assembler_type assembler{config};
+            assembler(relation, ways, out);
+            stats = assembler.stats();
+        }
+        const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+        const osmium::MemoryUsage memory;
+        const double seconds = duration.count();
+        const auto runs = static_cast<double>(repeat);
+
+        std::cout << std::left << std::setw(16) << s.name << std::right
+                  << std::setw(10) << s.size
+                  << std::setw(10) << ways.size()
+                  << std::setw(10) << builder.segments()
+                  << std::fixed << std::setprecision(3)
+                  << std::setw(12) << (seconds * 1000.0 / runs)
+                  << std::setprecision(0)
+                  << std::setw(14) << (static_cast<double>(builder.segments()) * runs / seconds)
+                  << std::setw(12) << (static_cast<double>(allocations.load() - start_allocations) / runs)
+                  << std::setw(12) << (static_cast<double>(allocated_bytes.load() - start_bytes) / runs / 1024.0)
+                  << std::setw(10) << memory.peak()
+                  << std::setw(8) << stats.outer_rings
+                  << std::setw(8) << stats.inner_rings
+                  << '\n';
+    }
+
+} // anonymous namespace
+
+void print_help() {
+    std::cout << "oat_assembler_bench [OPTIONS]\n\n"
+              << "Run the area assembler on synthetic multipolygons.\n"
+              << "\nOptions:\n"
+              << "  -h, --help                   This help message\n"
+              << "  -i, --inner-rings=NUM        Number of inner rings (default: 1000)\n"
+              << "  -j, --threads=NUM            Assemble parts of large relations in NUM threads (default: 4)\n"
+              << "  -l, --islands=NUM            Number of separate outer rings (default: 2000)\n"
+              << "  -m, --member-ways=NUM        Number of one-segment member ways (default: 10000)\n"
+              << "  -r, --repeat=NUM             Assemble each shape NUM times (default: 10)\n"
+              << "  -s, --spiral=NUM             Number of nodes in spiral (default: 100000)\n"
+              << "  -t, --touching-rings=NUM     Number of touching outer rings (default: 1000)\n"
+              << "\nSet any number to 0 to disable the shape. With --threads=0 no relation\n"
+              << "is split into parts.\n";
+}
+
+int main(int argc, char* argv[]) {
+    static const struct option long_options[] = {
+        {"help",           no_argument,       nullptr, 'h'},
+        {"inner-rings",    required_argument, nullptr, 'i'},
+        {"threads",        required_argument, nullptr, 'j'},
+        {"islands",        required_argument, nullptr, 'l'},
+        {"member-ways",    required_argument, nullptr, 'm'},
+        {"repeat",         required_argument, nullptr, 'r'},
+        {"spiral",         required_argument, nullptr, 's'},
+        {"touching-rings", required_argument, nullptr, 't'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    std::vector<shape> shapes = {
+        {"inner_rings",    1000,   inner_rings},
+        {"member_ways",    10000,  member_ways},
+        {"touching_rings", 1000,   touching_rings},
+        {"spiral",         100000, spiral},
+        {"islands",        2000,   islands}
+    };
+    std::size_t repeat = 10;
+    int num_threads = 4;
+
+    while (true) {
+        const int c = getopt_long(argc, argv, "hi:j:l:m:r:s:t:", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'h':
+                print_help();
+                return exit_code_ok;
+            case 'i':
+                shapes[0].size = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'j':
+                num_threads = std::atoi(optarg);
+                break;
+            case 'l':
+                shapes[4].size = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'm':
+                shapes[1].size = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'r':
+                repeat = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 's':
+                shapes[3].size = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 't':
+                shapes[2].size = std::strtoul(optarg, nullptr, 10);
+                break;
+            default:
+                return exit_code_cmdline_error;
+        }
+    }
+
+    if (optind != argc || repeat == 0) {
+        std::cerr << "Usage: " << argv[0] << " [OPTIONS]\n";
+        return exit_code_cmdline_error;
+    }
+
+    assembler_type::config_type config;
+    config.create_empty_areas = false;
+
+#ifndef WITH_OLD_STYLE_MP_SUPPORT
+    // Relations with enough members are split into parts assembled in this
+    // pool, like in oat_create_areas with --threads.
+    std::unique_ptr<osmium::thread::Pool> pool;
+    if (num_threads > 0) {
+        pool = std::make_unique<osmium::thread::Pool>(num_threads);
+        config.pool = pool.get();
+    }
+#endif
+
+    std::cout << "shape                 size      ways  segments     ms/run    segments/s  allocs/run    kB/run  peak MB   outer   inner\n";
+    for (const auto& s : shapes) {
+        if (s.size > 0) {
+            run_benchmark(s, repeat, config);
+        }
+    }
+
+    return exit_code_ok;
+}
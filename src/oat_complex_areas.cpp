@@ -6,6 +6,7 @@
 
 *****************************************************************************/
 
+#include "member_way_filter.hpp"
 #include "oat.hpp"
 
 #include <osmium/area/multipolygon_manager.hpp>
@@ -222,11 +223,17 @@ int main(int argc, char* argv[]) {
         osmium::relations::read_relations(input_file, mp_manager);
         vout << "First pass done.\n";
 
+        MemberWayFilter member_way_filter{mp_manager.handler([](osmium::memory::Buffer&& /*buffer*/) {})};
+        member_way_filter.collect(mp_manager);
+        vout << "Member ways bitmap: " << (member_way_filter.used_memory() / 1024) << "kB\n";
+
         vout << "Starting second pass (reading ways)...\n";
         osmium::io::Reader reader{input_file, osmium::osm_entity_bits::way | osmium::osm_entity_bits::relation};
-        osmium::apply(reader, handler, mp_manager.handler([](osmium::memory::Buffer&& /*buffer*/) {}));
+        osmium::apply(reader, handler, member_way_filter);
         reader.close();
         vout << "Second pass done.\n";
+        vout << "Ways skipped by member way filter: " << member_way_filter.rejected() << '\n';
+        vout << "Member ways stored without tags: " << member_way_filter.compacted() << " (" << (member_way_filter.bytes_saved() / 1024) << "kB saved)\n";
 
         const osmium::MemoryUsage mcheck;
         vout << "Actual memory usage:\n";
@@ -6,7 +6,30 @@
 
 *****************************************************************************/
 
+#include "area_manager.hpp"
+#include "area_spool.hpp"
+#include "assembly_timer.hpp"
+#include "area_validator.hpp"
+#include "assembly_cache.hpp"
+#include "async_problem_reporter.hpp"
+#include "async_writer.hpp"
+#include "batched_locations.hpp"
+#include "caching_assembler.hpp"
+#include "checkpoint.hpp"
+#include "compressed_block_map.hpp"
+#include "index_file.hpp"
+#include "member_way_filter.hpp"
+#include "metrics.hpp"
+#include "needed_nodes.hpp"
+#include "node_reader.hpp"
 #include "oat.hpp"
+#include "oat_assembler.hpp"
+#include "problem_recorder.hpp"
+#include "region.hpp"
+#include "relation_spill.hpp"
+#include "spatialite.hpp"
+#include "splitting_assembler.hpp"
+#include "update_state.hpp"
 
 //#define OSMIUM_WITH_TIMER
 
@@ -29,6 +52,7 @@
 #include <osmium/area/problem_reporter_ogr.hpp>
 #include <osmium/area/problem_reporter_stream.hpp>
 #include <osmium/geom/ogr.hpp>
+#include <osmium/geom/wkb.hpp>
 #include <osmium/handler/dump.hpp>
 #include <osmium/handler/node_locations_for_ways.hpp>
 #include <osmium/index/map/dense_mem_array.hpp>
@@ -39,20 +63,70 @@
 #include <osmium/index/map/sparse_mmap_array.hpp>
 #include <osmium/index/node_locations_map.hpp>
 #include <osmium/io/any_input.hpp>
+#include <osmium/tags/tags_filter.hpp>
+#include <osmium/thread/pool.hpp>
 #include <osmium/util/memory.hpp>
 #include <osmium/util/verbose_output.hpp>
 #include <osmium/visitor.hpp>
 
 #include <gdalcpp.hpp>
+#include <sqlite.hpp>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <getopt.h>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
 
 using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
 using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
+using node_filter_type = NeededNodesFilter<location_handler_type>;
 
 REGISTER_MAP(osmium::unsigned_object_id_type, osmium::Location, osmium::index::map::Dummy, none)
+REGISTER_MAP(osmium::unsigned_object_id_type, osmium::Location, CompressedBlockMap, compressed_block)
+
+enum class validator_type {
+    native,
+    ogr,
+    geos,
+    compare
+};
+
+#ifdef OSMIUM_AREA_WITH_GEOS
+constexpr const validator_type default_validator = validator_type::geos;
+#else
+constexpr const validator_type default_validator = validator_type::ogr;
+#endif
+
+// Check area with the native validator and report problems.
+bool check_native(AreaValidator& validator, const osmium::Area& area) {
+    const char* problem = validator.check(area);
+    if (problem) {
+        std::cerr << "NATIVE ERROR: " << problem << " in area " << area.id() << '\n';
+        return false;
+    }
+    return true;
+}
+
+void print_area_error(const osmium::Area& area, const osmium::geometry_error& e) {
+    std::cerr << "Ignoring illegal geometry for area "
+              << area.id()
+              << " created from "
+              << (area.from_way() ? "way" : "relation")
+              << " with id="
+              << area.orig_id() << " (" << e.what() << ").\n";
+}
 
 class OutputOGR : public osmium::handler::Handler {
 
@@ -60,17 +134,71 @@ class OutputOGR : public osmium::handler::Handler {
 
     gdalcpp::Layer m_layer_multipolygons;
 
+    AreaValidator m_validator;
+    validator_type m_validator_type = default_validator;
+
+    std::size_t m_mismatches = 0;
+
     bool m_check = false;
     bool m_only_invalid = false;
     bool m_output_areas = false;
 
-    static void print_area_error(const osmium::Area& area, const osmium::geometry_error& e) {
-        std::cerr << "Ignoring illegal geometry for area "
-                  << area.id()
-                  << " created from "
-                  << (area.from_way() ? "way" : "relation")
-                  << " with id="
-                  << area.orig_id() << " (" << e.what() << ").\n";
+    static bool check_ogr(const OGRMultiPolygon& geom) {
+        return geom.IsValid();
+    }
+
+#ifdef OSMIUM_AREA_WITH_GEOS
+    static bool check_geos(const OGRMultiPolygon& geom) {
+        auto geosgeom = geom.exportToGEOS();
+        geos::operation::valid::IsValidOp ivo(reinterpret_cast<const geos::geom::Geometry *>(geosgeom));
+        ivo.setSelfTouchingRingFormingHoleValid(true);
+        const bool is_valid = ivo.isValid();
+        if (!is_valid) {
+            auto error = ivo.getValidationError();
+            std::cerr << "GEOS ERROR: " << error->toString() << '\n';
+        }
+        return is_valid;
+    }
+#endif
+
+    static bool check_reference(const OGRMultiPolygon& geom) {
+#ifdef OSMIUM_AREA_WITH_GEOS
+        return check_geos(geom);
+#else
+        return check_ogr(geom);
+#endif
+    }
+
+    // Check validity of the area. The OGR geometry is created if needed
+    // for the check.
+    bool check(const osmium::Area& area, std::unique_ptr<OGRMultiPolygon>& geom) {
+        if (m_validator_type == validator_type::native) {
+            return check_native(m_validator, area);
+        }
+
+        geom = m_factory.create_multipolygon(area);
+        switch (m_validator_type) {
+            case validator_type::ogr:
+                return check_ogr(*geom);
+#ifdef OSMIUM_AREA_WITH_GEOS
+            case validator_type::geos:
+                return check_geos(*geom);
+#endif
+            default:
+                break;
+        }
+
+        const bool native_valid = check_native(m_validator, area);
+        const bool reference_valid = check_reference(*geom);
+        if (native_valid != reference_valid) {
+            ++m_mismatches;
+            std::cerr << "VALIDATOR MISMATCH: area " << area.id()
+                      << " is " << (native_valid ? "valid" : "invalid")
+                      << " according to native validator, but "
+                      << (reference_valid ? "valid" : "invalid")
+                      << " according to reference validator\n";
+        }
+        return reference_valid;
     }
 
 public:
@@ -88,6 +216,15 @@ public:
         m_check = check;
     }
 
+    void set_validator(validator_type type) noexcept {
+        m_validator_type = type;
+#ifndef OSMIUM_AREA_WITH_GEOS
+        // The OGR check doesn't allow self-touching rings forming holes,
+        // so the native validator has to use the same rules to compare.
+        m_validator.set_self_touching_ring_forming_hole_valid(type != validator_type::compare);
+#endif
+    }
+
     void set_only_invalid(bool only_invalid) noexcept {
         m_only_invalid = only_invalid;
     }
@@ -96,28 +233,28 @@ public:
         m_output_areas = output_areas;
     }
 
+    /**
+     * Number of areas the validators disagreed on (with validator type
+     * compare).
+     */
+    std::size_t mismatches() const noexcept {
+        return m_mismatches;
+    }
+
     void area(const osmium::Area& area) {
         try {
             bool is_valid = false;
-            auto geom = m_factory.create_multipolygon(area);
+            std::unique_ptr<OGRMultiPolygon> geom;
             if (m_check) {
-#ifdef OSMIUM_AREA_WITH_GEOS
-                auto geosgeom = geom->exportToGEOS();
-                geos::operation::valid::IsValidOp ivo(reinterpret_cast<const geos::geom::Geometry *>(geosgeom));
-                ivo.setSelfTouchingRingFormingHoleValid(true);
-                is_valid = ivo.isValid();
-                if (!is_valid) {
-                    auto error = ivo.getValidationError();
-                    std::cerr << "GEOS ERROR: " << error->toString() << '\n';
-                }
-#else
-                is_valid = geom->IsValid();
-#endif
+                is_valid = check(area, geom);
             }
             if (m_only_invalid && is_valid) {
                 return;
             }
             if (m_output_areas) {
+                if (!geom) {
+                    geom = m_factory.create_multipolygon(area);
+                }
                 gdalcpp::Feature feature{m_layer_multipolygons, std::move(geom)};
                 feature.set_field("id", static_cast<int32_t>(area.id()));
                 feature.set_field("valid", is_valid);
@@ -132,24 +269,242 @@ public:
 
 }; // class OutputOGR
 
+/**
+ * Writes areas directly into the Spatialite database using prepared
+ * statements without going through OGR. Geometries are created as WKB
+ * and converted into the Spatialite blob format in a reused buffer. Areas
+ * are written in large transactions. Only the native validator can be used
+ * for checking areas.
+ */
+class OutputSpatialite : public osmium::handler::Handler {
+
+    enum : std::size_t {
+        max_rows_per_transaction = 100000
+    };
+
+    osmium::geom::WKBFactory<> m_factory{osmium::geom::wkb_type::wkb, osmium::geom::out_type::binary};
+
+    Sqlite::Database m_db;
+    std::unique_ptr<Sqlite::Statement> m_insert;
+
+    AreaValidator m_validator;
+
+    std::string m_blob;
+    int32_t m_srid = 0;
+    std::size_t m_rows = 0;
+    bool m_check = false;
+    bool m_only_invalid = false;
+    bool m_output_areas = false;
+    bool m_in_transaction = false;
+
+    template <typename T>
+    static T read_value(const char* data) noexcept {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void append_value(T value) {
+        m_blob.append(reinterpret_cast<const char*>(&value), sizeof(T)); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+    }
+
+    // Convert (little endian) WKB multipolygon into Spatialite blob format.
+    // The blob starts with a header containing the SRID and the bounding
+    // box, the byte order markers of the polygons are replaced by the
+    // Spatialite entity marker.
+    void wkb_to_spatialite(const std::string& wkb) {
+        constexpr const std::size_t header_size = 39;
+
+        m_blob.clear();
+        m_blob.push_back(0x00); // start
+        m_blob.push_back(0x01); // little endian
+        append_value(m_srid);
+        m_blob.append(4 * sizeof(double), '\0'); // bounding box, set below
+        m_blob.push_back(0x7c); // end of header
+        m_blob.append(wkb, 1, std::string::npos);
+        m_blob.push_back(static_cast<char>(0xfe)); // end
+
+        double min_x = std::numeric_limits<double>::max();
+        double min_y = std::numeric_limits<double>::max();
+        double max_x = std::numeric_limits<double>::lowest();
+        double max_y = std::numeric_limits<double>::lowest();
+
+        std::size_t pos = header_size + 4; // skip geometry type
+        const auto num_polygons = read_value<uint32_t>(m_blob.data() + pos);
+        pos += 4;
+        for (uint32_t p = 0; p < num_polygons; ++p) {
+            m_blob[pos] = 0x69; // entity marker instead of byte order
+            pos += 1 + 4; // skip marker and geometry type
+            const auto num_rings = read_value<uint32_t>(m_blob.data() + pos);
+            pos += 4;
+            for (uint32_t r = 0; r < num_rings; ++r) {
+                const auto num_points = read_value<uint32_t>(m_blob.data() + pos);
+                pos += 4;
+                for (uint32_t n = 0; n < num_points; ++n) {
+                    const auto x = read_value<double>(m_blob.data() + pos);
+                    const auto y = read_value<double>(m_blob.data() + pos + sizeof(double));
+                    pos += 2 * sizeof(double);
+                    min_x = std::min(min_x, x);
+                    min_y = std::min(min_y, y);
+                    max_x = std::max(max_x, x);
+                    max_y = std::max(max_y, y);
+                }
+            }
+        }
+
+        const std::array<double, 4> bbox = {min_x, min_y, max_x, max_y};
+        std::memcpy(&m_blob[6], bbox.data(), sizeof(bbox));
+    }
+
+    void commit() {
+        if (m_in_transaction) {
+            m_db.commit();
+            m_in_transaction = false;
+        }
+    }
+
+public:
+
+    /**
+     * Create a new Spatialite database with an (empty) areas table. GDAL
+     * is used for this to get all the Spatialite metadata right.
+     */
+    static void create_database(const std::string& filename, const osmium::geom::OGRFactory<>& factory) {
+        gdalcpp::Dataset dataset{"SQLite", filename, gdalcpp::SRS{factory.proj_string()}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=NO" }};
+        gdalcpp::Layer layer{dataset, "areas", wkbMultiPolygon, {"SPATIAL_INDEX=NO"}};
+        layer.add_field("id", OFTInteger64, 20);
+        layer.add_field("valid", OFTInteger, 1);
+        layer.add_field("source", OFTString, 1);
+        layer.add_field("orig_id", OFTInteger64, 20);
+    }
+
+    explicit OutputSpatialite(const std::string& filename) :
+        m_db(filename, SQLITE_OPEN_READWRITE) {
+        m_db.exec("PRAGMA journal_mode = OFF;");
+        m_db.exec("PRAGMA synchronous = OFF;");
+        load_spatialite(m_db);
+
+        std::string geometry_column;
+        {
+            Sqlite::Statement query{m_db, "SELECT f_geometry_column, srid FROM geometry_columns WHERE f_table_name = 'areas';"};
+            if (!query.read()) {
+                throw std::runtime_error{"Missing areas table in database '" + filename + "'"};
+            }
+            geometry_column = query.get_text(0);
+            m_srid = query.get_int(1);
+        }
+
+        const std::string sql = "INSERT INTO areas (" + geometry_column + ", id, valid, source, orig_id) VALUES (?, ?, ?, ?, ?);";
+        m_insert = std::make_unique<Sqlite::Statement>(m_db, sql.c_str());
+    }
+
+    OutputSpatialite(const OutputSpatialite&) = delete;
+    OutputSpatialite& operator=(const OutputSpatialite&) = delete;
+
+    OutputSpatialite(OutputSpatialite&&) = delete;
+    OutputSpatialite& operator=(OutputSpatialite&&) = delete;
+
+    ~OutputSpatialite() noexcept {
+        try {
+            close();
+        } catch (...) {
+            // ignore
+        }
+    }
+
+    /**
+     * Check areas with the native validator.
+     */
+    void set_check(bool check) noexcept {
+        m_check = check;
+    }
+
+    void set_only_invalid(bool only_invalid) noexcept {
+        m_only_invalid = only_invalid;
+    }
+
+    void set_output_areas(bool output_areas) noexcept {
+        m_output_areas = output_areas;
+    }
+
+    void area(const osmium::Area& area) {
+        bool is_valid = false;
+        if (m_check) {
+            is_valid = check_native(m_validator, area);
+        }
+        if ((m_only_invalid && is_valid) || !m_output_areas) {
+            return;
+        }
+
+        try {
+            wkb_to_spatialite(m_factory.create_multipolygon(area));
+        } catch (const osmium::geometry_error& e) {
+            print_area_error(area, e);
+            return;
+        }
+
+        if (!m_in_transaction) {
+            m_db.begin_transaction();
+            m_in_transaction = true;
+        }
+
+        m_insert->bind_blob(m_blob.data(), static_cast<int>(m_blob.size()))
+                 .bind_int64(area.id())
+                 .bind_int(is_valid ? 1 : 0)
+                 .bind_text(area.from_way() ? "w" : "r")
+                 .bind_int64(area.orig_id())
+                 .execute();
+
+        if (++m_rows % max_rows_per_transaction == 0) {
+            commit();
+        }
+    }
+
+    /**
+     * Commit outstanding changes. Call this after all areas are written.
+     */
+    void close() {
+        commit();
+    }
+
+}; // class OutputSpatialite
+
 
 void print_help() {
-    std::cout << "oat_create_areas [OPTIONS] OSMFILE\n\n"
+    std::cout << "oat_create_areas [OPTIONS] OSMFILE\n"
+              << "oat_create_areas [OPTIONS] --update=DIR --output=DBNAME OSCFILE...\n\n"
               << "Read OSMFILE and build multipolygons from it.\n"
+              << "Or update the areas in DBNAME from change files.\n"
               << "\nOptions:\n"
               << "  -a, --suppress-area-output   Suppress output of created areas\n"
+              << "  -A, --area-spool=FILE        Write assembled areas to spool FILE\n"
+              << "  -b, --bbox=BOX               Only build areas intersecting BOX (MINLON,MINLAT,MAXLON,MAXLAT)\n"
+              << "  -B, --direct-output          Write areas to database without OGR (faster, needs -p)\n"
               << "  -c, --check                  Check geometries\n"
               << "  -C, --collect-only           Only collect data, don't assemble areas\n"
               << "  -f, --only-invalid           Filter out valid geometries\n"
+              << "  -F, --filter=EXPR            Only build areas with tags matching EXPR (e.g. building,natural=water)\n"
+              << "  -g, --region=FILE            Only build areas intersecting polygon from FILE (poly format)\n"
               << "  -d, --debug[=LEVEL]          Set area assembler debug level\n"
               << "  -D, --dump-areas[=FILE]      Dump areas to file (default: stdout, also needs -o)\n"
               << "  -e, --empty-areas            Create empty areas for broken geometries\n"
               << "  -h, --help                   This help message\n"
               << "  -i, --index=INDEX_TYPE       Set index type for location index (default: flex_mem)\n"
               << "  -I, --show-index-types       Show available index types for location index\n"
+              << "  -j, --threads=NUM            Number of threads for assembling areas (default: 0)\n"
+              << "  -k, --checkpoint=DIR         Write checkpoints to DIR\n"
+              << "  -K, --resume                 Resume from checkpoint in DIR set with -k\n"
+              << "  -l, --max-pending=SIZE       Limit memory for member ways of pending relations (e.g. 8G)\n"
+              << "  -L, --load-index=FILE        Load location index from FILE, don't read nodes\n"
+              << "  -m, --metrics=FILE           Write metrics to FILE every 10 seconds\n"
+              << "  -M, --max-memory=SIZE        Choose index type fitting into SIZE bytes (e.g. 8G)\n"
+              << "  -n, --needed-nodes-only      Only store locations of needed nodes (areas only from ways closed by node ID)\n"
               << "  -o, --output=DBNAME          Database name\n"
               << "  -O, --overwrite              Overwrite existing database\n"
               << "  -p, --report-problems[=FILE] Report problems to file (default: stdout)\n"
+              << "  -P, --parallel-nodes[=NUM]   Read nodes in parallel to the first pass (with NUM threads)\n"
+              << "  -q, --queue-size=NUM         Size of queue to output writer thread (default: 16, 0: no thread)\n"
               << "  -r, --show-incomplete        Show incomplete relations\n"
               << "  -R, --check-roles            Check tagged member roles\n"
 #ifdef WITH_OLD_STYLE_MP_SUPPORT
@@ -159,12 +514,23 @@ void print_help() {
               << "  -s, --no-new-style           Do not output multipolygons created from relations\n"
 #endif
               << "  -t, --keep-type-tag          Keep type tag from mp relation (default: false)\n"
+              << "  -T, --timing[=N]             Time assembly, show N slowest relations (default: 20)\n"
+              << "  -u, --update=DIR             Update database from OSCFILEs using state in DIR\n"
+              << "  -U, --save-state=DIR         Save state needed for updates to DIR\n"
+#ifdef OSMIUM_AREA_WITH_GEOS
+              << "  -V, --validator=TYPE         Validator used for -c: native, ogr, geos, or compare\n"
+#else
+              << "  -V, --validator=TYPE         Validator used for -c: native, ogr, or compare\n"
+#endif
               << "  -w, --no-way-polygons        Do not output areas created from ways\n"
+              << "  -W, --save-index=FILE        Save location index to FILE\n"
 #ifdef WITH_OLD_STYLE_MP_SUPPORT
               << "  -x, --no-areas               Do not output areas (same as -s -S -w)\n"
 #else
               << "  -x, --no-areas               Do not output areas (same as -s -w)\n"
 #endif
+              << "  -y, --cache=FILE             Cache results of assembling relations in FILE\n"
+              << "  -Y, --max-cache-size=SIZE    Maximum size of cache (default: 4G)\n"
               ;
 }
 
@@ -196,8 +562,8 @@ using assembler_type = osmium::area::AssemblerLegacy;
 using mp_manager_type = osmium::area::MultipolygonManagerLegacy<assembler_type>;
 using mp_manager_only = osmium::area::MultipolygonManagerLegacy<DummyAssembler>;
 #else
-using assembler_type = osmium::area::Assembler;
-using mp_manager_type = osmium::area::MultipolygonManager<assembler_type>;
+using assembler_type = oat_assembler_type;
+using mp_manager_type = AreaManager<assembler_type>;
 using mp_manager_only = osmium::area::MultipolygonManager<DummyAssembler>;
 #endif
 
@@ -216,6 +582,213 @@ void show_incomplete_relations(TMPManager& manager) {
     }
 }
 
+/**
+ * Do the first pass reading the relations. With a checkpoint the relations
+ * are read from the checkpoint or written into it. With a relation spill
+ * the relations which don't fit into memory are left for later rounds.
+ */
+template <typename TMPManager>
+void read_relations_with(osmium::util::VerboseOutput& vout, const osmium::io::File& input_file, Checkpoint* checkpoint, RelationSpill* spill, TMPManager& manager) {
+    if (!checkpoint && !spill) {
+        osmium::relations::read_relations(input_file, manager);
+        return;
+    }
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
+    throw std::runtime_error{"--checkpoint and --max-pending are not supported with old style multipolygon support"};
+#else
+    if (spill) {
+        spill->read_relations(input_file, manager);
+        vout << "  " << spill->spilled() << " relations spilled to next round\n";
+        return;
+    }
+    if (checkpoint->has_relations()) {
+        vout << "  reading relations from checkpoint\n";
+    }
+    checkpoint->read_relations(input_file, manager);
+#endif
+}
+
+/**
+ * Assemble the areas of the relations spilled in the first pass. In each
+ * round the spilled relations are read into a new manager and the ways
+ * are read again, only the member ways are used. All locations are
+ * already in the index.
+ */
+template <typename TCallback>
+void assemble_spilled_relations(osmium::util::VerboseOutput& vout,
+                                RelationSpill& spill,
+                                const osmium::io::File& input_file,
+                                const assembler_type::config_type& config,
+                                const osmium::TagsFilter& filter,
+                                int num_threads,
+                                AssemblyTimer* timer,
+                                const Region* region,
+                                BatchedLocations* batched_locations,
+                                const TCallback& callback) {
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
+    throw std::runtime_error{"--max-pending is not supported with old style multipolygon support"};
+#else
+    while (spill.next_round()) {
+        vout << "Starting round " << (spill.round() + 1) << " (reading spilled relations)...\n";
+        mp_manager_type manager{config, filter, num_threads};
+        manager.set_timer(timer);
+        manager.set_region(region);
+        spill.read_relations(input_file, manager);
+        vout << "  " << spill.spilled() << " relations spilled to next round\n";
+
+        vout << "Reading ways and assembling areas...\n";
+        MemberWayFilter member_way_filter{manager.handler(callback)};
+        member_way_filter.collect(manager);
+        member_way_filter.set_members_only();
+
+        osmium::io::Reader reader{input_file, osmium::osm_entity_bits::way};
+        if (batched_locations) {
+            apply_with_locations(reader, *batched_locations, member_way_filter);
+        } else {
+            osmium::apply(reader, member_way_filter);
+        }
+        manager.finish();
+        reader.close();
+        vout << "Round " << (spill.round() + 1) << " done\n";
+
+        vout << "Memory:\n";
+        osmium::relations::print_used_memory(vout, manager.used_memory());
+
+        vout << "Stats:" << manager.stats() << '\n';
+    }
+#endif
+}
+
+template <typename TMPManager>
+void find_needed_nodes(osmium::util::VerboseOutput& vout, const osmium::io::File& input_file, TMPManager& manager, node_filter_type& node_filter) {
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
+    throw std::runtime_error{"--needed-nodes-only is not supported with old style multipolygon support"};
+#else
+    vout << "Starting extra pass (finding needed nodes)...\n";
+    node_filter.collect(input_file, manager);
+    vout << "Extra pass done.\n";
+    vout << "  needed nodes bitmaps: " << (node_filter.used_memory() / 1024) << "kB\n";
+#endif
+}
+
+template <typename TMPManager, typename THandler>
+void collect_member_ways(osmium::util::VerboseOutput& vout, TMPManager& manager, MemberWayFilter<THandler>& member_way_filter) {
+#ifndef WITH_OLD_STYLE_MP_SUPPORT
+    member_way_filter.collect(manager);
+    vout << "  member ways bitmap: " << (member_way_filter.used_memory() / 1024) << "kB\n";
+#endif
+}
+
+template <typename TMPManager>
+void set_region(TMPManager& manager, const Region* region) {
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
+    if (region) {
+        throw std::runtime_error{"--bbox and --region are not supported with old style multipolygon support"};
+    }
+#else
+    manager.set_region(region);
+#endif
+}
+
+// Old style multipolygon support doesn't work with any of the modes
+// needing this, they fail before.
+template <typename TMPManager, typename THandler>
+void set_closed_by_ref(TMPManager& manager, MemberWayFilter<THandler>& member_way_filter, bool closed_by_ref) {
+#ifndef WITH_OLD_STYLE_MP_SUPPORT
+    manager.set_closed_by_ref(closed_by_ref);
+    member_way_filter.set_closed_by_ref(closed_by_ref);
+#endif
+}
+
+template <typename TMPManager>
+void set_timer(TMPManager& manager, AssemblyTimer* timer) {
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
+    if (timer) {
+        throw std::runtime_error{"--timing is not supported with old style multipolygon support"};
+    }
+#else
+    manager.set_timer(timer);
+#endif
+}
+
+/**
+ * Write the assembly time histogram and the slowest relations into the
+ * tables assembly_times and slowest_relations.
+ */
+void write_timer(const std::string& database_name, const AssemblyTimer& timer) {
+    Sqlite::Database db{database_name, SQLITE_OPEN_READWRITE};
+    db.exec("DROP TABLE IF EXISTS assembly_times;");
+    db.exec("DROP TABLE IF EXISTS slowest_relations;");
+    db.exec("CREATE TABLE assembly_times (min_microseconds INTEGER, max_microseconds INTEGER, ways INTEGER, relations INTEGER);");
+    db.exec("CREATE TABLE slowest_relations (rank INTEGER, relation_id INTEGER, microseconds INTEGER, members INTEGER, segments INTEGER);");
+    db.begin_transaction();
+    {
+        Sqlite::Statement insert{db, "INSERT INTO assembly_times (min_microseconds, max_microseconds, ways, relations) VALUES (?, ?, ?, ?);"};
+        for (std::size_t i = 0; i < AssemblyTimer::num_buckets; ++i) {
+            const auto ways = timer.way_histogram()[i];
+            const auto relations = timer.relation_histogram()[i];
+            if (ways == 0 && relations == 0) {
+                continue;
+            }
+            const auto range = AssemblyTimer::bucket_range(i);
+            insert.bind_int64(static_cast<int64_t>(range.first))
+                  .bind_int64(static_cast<int64_t>(range.second))
+                  .bind_int64(static_cast<int64_t>(ways))
+                  .bind_int64(static_cast<int64_t>(relations))
+                  .execute();
+        }
+    }
+    {
+        Sqlite::Statement insert{db, "INSERT INTO slowest_relations (rank, relation_id, microseconds, members, segments) VALUES (?, ?, ?, ?, ?);"};
+        int rank = 0;
+        for (const auto& time : timer.slowest()) {
+            insert.bind_int(++rank)
+                  .bind_int64(time.id)
+                  .bind_int64(static_cast<int64_t>(time.microseconds))
+                  .bind_int64(static_cast<int64_t>(time.members))
+                  .bind_int64(static_cast<int64_t>(time.segments))
+                  .execute();
+        }
+    }
+    db.commit();
+}
+
+template <typename TMPManager>
+void open_state(osmium::util::VerboseOutput& vout, StateWriter& state_writer, const std::string& directory, const osmium::io::File& input_file, const std::string& filter_expression, TMPManager& manager) {
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
+    throw std::runtime_error{"--save-state is not supported with old style multipolygon support"};
+#else
+    vout << "Starting extra pass (writing relations to update state)...\n";
+    state_writer.open(directory, input_file, filter_expression, manager);
+    vout << "Extra pass done.\n";
+#endif
+}
+
+update_result prepare_update_with(const std::string& directory,
+                                  const std::vector<std::string>& change_files,
+                                  const std::string& output_filename,
+                                  const assembler_type::config_type& assembler_config,
+                                  const std::string& filter_expression,
+                                  const osmium::TagsFilter& filter) {
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
+    throw std::runtime_error{"--update is not supported with old style multipolygon support"};
+#else
+    const mp_manager_type manager{assembler_config, filter};
+    return prepare_update(directory, change_files, output_filename, filter_expression, [&manager](const osmium::Relation& relation) {
+        return manager.new_relation(relation);
+    });
+#endif
+}
+
+template <typename TOutput>
+void write_areas(osmium::memory::Buffer& buffer, osmium::handler::Dump* dump_handler, TOutput& output) {
+    if (dump_handler) {
+        osmium::apply(buffer, *dump_handler, output);
+    } else {
+        osmium::apply(buffer, output);
+    }
+}
+
 class optional_output {
 
     std::unique_ptr<std::ostream> m_stream{};
@@ -251,31 +824,68 @@ int main(int argc, char* argv[]) {
 
         static const struct option long_options[] = {
             {"suppress-area-output", no_argument,       nullptr, 'a'},
+            {"area-spool",           required_argument, nullptr, 'A'},
+            {"bbox",                 required_argument, nullptr, 'b'},
+            {"direct-output",        no_argument,       nullptr, 'B'},
             {"check",                no_argument,       nullptr, 'c'},
             {"collect-only",         no_argument,       nullptr, 'C'},
             {"only-invalid",         no_argument,       nullptr, 'f'},
+            {"filter",               required_argument, nullptr, 'F'},
+            {"region",               required_argument, nullptr, 'g'},
             {"debug",                optional_argument, nullptr, 'd'},
             {"dump-areas",           optional_argument, nullptr, 'D'},
             {"empty-areas",          no_argument,       nullptr, 'e'},
             {"help",                 no_argument,       nullptr, 'h'},
             {"index",                required_argument, nullptr, 'i'},
             {"show-index",           no_argument,       nullptr, 'I'},
+            {"threads",              required_argument, nullptr, 'j'},
+            {"checkpoint",           required_argument, nullptr, 'k'},
+            {"resume",               no_argument,       nullptr, 'K'},
+            {"max-pending",          required_argument, nullptr, 'l'},
+            {"load-index",           required_argument, nullptr, 'L'},
+            {"metrics",              required_argument, nullptr, 'm'},
+            {"max-memory",           required_argument, nullptr, 'M'},
+            {"needed-nodes-only",    no_argument,       nullptr, 'n'},
             {"output",               required_argument, nullptr, 'o'},
             {"overwrite",            no_argument,       nullptr, 'O'},
             {"report-problems",      optional_argument, nullptr, 'p'},
+            {"parallel-nodes",       optional_argument, nullptr, 'P'},
+            {"queue-size",           required_argument, nullptr, 'q'},
             {"show-incomplete",      no_argument,       nullptr, 'r'},
             {"check-roles",          no_argument,       nullptr, 'R'},
             {"no-new-style",         no_argument,       nullptr, 's'},
             {"no-old-style",         no_argument,       nullptr, 'S'},
             {"keep-type-tag",        no_argument,       nullptr, 't'},
+            {"timing",               optional_argument, nullptr, 'T'},
+            {"update",               required_argument, nullptr, 'u'},
+            {"save-state",           required_argument, nullptr, 'U'},
+            {"validator",            required_argument, nullptr, 'V'},
             {"no-way-polygons",      no_argument,       nullptr, 'w'},
+            {"save-index",           required_argument, nullptr, 'W'},
             {"no-areas",             no_argument,       nullptr, 'x'},
+            {"cache",                required_argument, nullptr, 'y'},
+            {"max-cache-size",       required_argument, nullptr, 'Y'},
             {nullptr, 0, nullptr, 0}
         };
 
         std::string database_name;
 
         std::string location_index_type{"flex_mem"};
+        bool index_type_set = false;
+        std::size_t max_memory = 0;
+        std::size_t max_pending = 0;
+        std::string load_index;
+        std::string save_index;
+        std::string update_state;
+        std::string save_state;
+        std::string metrics_file;
+        std::string filter_expression;
+        osmium::TagsFilter filter{true};
+        std::string spool_file;
+        std::string checkpoint_directory;
+        std::string cache_file;
+        std::size_t max_cache_size = 4UL * 1024UL * 1024UL * 1024UL;
+        std::unique_ptr<Region> region;
         const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
 
         optional_output dump_stream;
@@ -287,12 +897,23 @@ int main(int argc, char* argv[]) {
         bool show_incomplete = false;
         bool overwrite = false;
         bool output_areas = true;
+        bool needed_nodes_only = false;
+        bool parallel_nodes = false;
+        int node_threads = 0;
+        bool direct_output = false;
+        bool timing = false;
+        bool resume = false;
+        std::size_t max_slowest = 20;
+        validator_type validator = default_validator;
+        std::size_t validator_mismatches = 0;
+        int num_threads = 0;
+        std::size_t queue_size = 16;
 
         assembler_type::config_type assembler_config;
         assembler_config.create_empty_areas = false;
 
         while (true) {
-            const int c = getopt_long(argc, argv, "acCd::D::efhi:Io:Op::rRsStwx", long_options, nullptr);
+            const int c = getopt_long(argc, argv, "aA:b:BcCd::D::efF:g:hi:Ij:k:Kl:L:m:M:no:Op::P::q:rRsStT::u:U:V:wW:xy:Y:", long_options, nullptr);
             if (c == -1) {
                 break;
             }
@@ -301,6 +922,15 @@ int main(int argc, char* argv[]) {
                 case 'a':
                     output_areas = false;
                     break;
+                case 'A':
+                    spool_file = optarg;
+                    break;
+                case 'b':
+                    region = std::make_unique<Region>(Region::from_bbox(optarg));
+                    break;
+                case 'B':
+                    direct_output = true;
+                    break;
                 case 'c':
                     check = true;
                     break;
@@ -324,15 +954,60 @@ int main(int argc, char* argv[]) {
                     only_invalid = true;
                     check = true;
                     break;
+                case 'F':
+                    try {
+                        filter = parse_tags_filter(optarg);
+                    } catch (const std::runtime_error& e) {
+                        std::cerr << e.what() << '\n';
+                        return exit_code_cmdline_error;
+                    }
+                    filter_expression = optarg;
+                    break;
+                case 'g':
+                    region = std::make_unique<Region>(Region::from_poly_file(optarg));
+                    break;
                 case 'h':
                     print_help();
                     return exit_code_ok;
                 case 'i':
                     location_index_type = optarg;
+                    index_type_set = true;
                     break;
                 case 'I':
                     show_index_types();
                     return exit_code_ok;
+                case 'k':
+                    checkpoint_directory = optarg;
+                    break;
+                case 'K':
+                    resume = true;
+                    break;
+                case 'l':
+                    max_pending = parse_memory_size(optarg);
+                    if (max_pending == 0) {
+                        std::cerr << "Invalid memory size '" << optarg << "'.\n";
+                        return exit_code_cmdline_error;
+                    }
+                    break;
+                case 'L':
+                    load_index = optarg;
+                    break;
+                case 'm':
+                    metrics_file = optarg;
+                    break;
+                case 'M':
+                    max_memory = parse_memory_size(optarg);
+                    if (max_memory == 0) {
+                        std::cerr << "Invalid memory size '" << optarg << "'.\n";
+                        return exit_code_cmdline_error;
+                    }
+                    break;
+                case 'j':
+                    num_threads = std::atoi(optarg);
+                    break;
+                case 'n':
+                    needed_nodes_only = true;
+                    break;
                 case 'o':
                     database_name = optarg;
                     break;
@@ -346,6 +1021,15 @@ int main(int argc, char* argv[]) {
                         problem_stream.set_stdout();
                     }
                     break;
+                case 'P':
+                    parallel_nodes = true;
+                    if (optarg) {
+                        node_threads = std::atoi(optarg);
+                    }
+                    break;
+                case 'q':
+                    queue_size = std::strtoul(optarg, nullptr, 10);
+                    break;
                 case 'r':
                     show_incomplete = true;
                     break;
@@ -361,53 +1045,327 @@ int main(int argc, char* argv[]) {
                 case 't':
                     assembler_config.keep_type_tag = true;
                     break;
+                case 'T':
+                    timing = true;
+                    if (optarg) {
+                        max_slowest = std::strtoul(optarg, nullptr, 10);
+                    }
+                    break;
+                case 'u':
+                    update_state = optarg;
+                    break;
+                case 'U':
+                    save_state = optarg;
+                    break;
+                case 'V':
+                    if (!std::strcmp(optarg, "native")) {
+                        validator = validator_type::native;
+                    } else if (!std::strcmp(optarg, "ogr")) {
+                        validator = validator_type::ogr;
+#ifdef OSMIUM_AREA_WITH_GEOS
+                    } else if (!std::strcmp(optarg, "geos")) {
+                        validator = validator_type::geos;
+#endif
+                    } else if (!std::strcmp(optarg, "compare")) {
+                        validator = validator_type::compare;
+                    } else {
+                        std::cerr << "Unknown validator '" << optarg << "'.\n";
+                        return exit_code_cmdline_error;
+                    }
+                    break;
                 case 'w':
                     assembler_config.create_way_polygons = false;
                     break;
+                case 'W':
+                    save_index = optarg;
+                    break;
                 case 'x':
                     assembler_config.create_new_style_polygons = false;
                     assembler_config.create_old_style_polygons = false;
                     assembler_config.create_way_polygons = false;
                     break;
+                case 'y':
+                    cache_file = optarg;
+                    break;
+                case 'Y':
+                    max_cache_size = parse_memory_size(optarg);
+                    if (max_cache_size == 0) {
+                        std::cerr << "Invalid memory size '" << optarg << "'.\n";
+                        return exit_code_cmdline_error;
+                    }
+                    break;
                 default:
                     return exit_code_cmdline_error;
             }
         }
 
         const int remaining_args = argc - optind;
-        if (remaining_args != 1) {
-            std::cerr << "Usage: " << argv[0] << " [OPTIONS] OSMFILE\n";
+        if (update_state.empty() ? remaining_args != 1 : remaining_args < 1) {
+            std::cerr << "Usage: " << argv[0] << " [OPTIONS] OSMFILE\n"
+                      << "       " << argv[0] << " [OPTIONS] --update=DIR --output=DBNAME OSCFILE...\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (!load_index.empty() && !save_index.empty()) {
+            std::cerr << "Can not use --load-index and --save-index together.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (max_memory > 0 && index_type_set) {
+            std::cerr << "Can not use --max-memory and --index together.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (max_memory > 0 && load_index.empty() && update_state.empty()) {
+            location_index_type = choose_index_type(osmium::io::File{argv[optind]}, max_memory, std::cerr);
+        }
+
+        if (direct_output && !problem_stream) {
+            std::cerr << "Can only use --direct-output together with --report-problems, problems are not written to the database.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (direct_output && check && validator != validator_type::native) {
+            std::cerr << "Can only use --direct-output together with --check or --only-invalid if --validator=native is set.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (needed_nodes_only && (!load_index.empty() || !save_index.empty() || location_index_type == "none")) {
+            std::cerr << "Can not use --needed-nodes-only together with --load-index, --save-index, or index type 'none'.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (parallel_nodes && (!load_index.empty() || needed_nodes_only || !save_state.empty() ||
+                               !update_state.empty() || location_index_type == "none")) {
+            std::cerr << "Can not use --parallel-nodes together with --load-index, --needed-nodes-only, --save-state, --update, or index type 'none'.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (node_threads > 0 && location_index_type.find("dense") != 0) {
+            std::cerr << "Can only use threads with --parallel-nodes together with a dense_* index type.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (!update_state.empty() && (database_name.empty() || collect_only || needed_nodes_only ||
+                                      !load_index.empty() || !save_index.empty() || !save_state.empty())) {
+            std::cerr << "--update needs --output and can not be used together with --collect-only, --needed-nodes-only, --load-index, --save-index, or --save-state.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (!update_state.empty() && ::access(database_name.c_str(), W_OK) != 0) {
+            std::cerr << "Database '" << database_name << "' has to exist for --update.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (!spool_file.empty() && (collect_only || !update_state.empty())) {
+            std::cerr << "Can not use --area-spool together with --collect-only or --update.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (resume && checkpoint_directory.empty()) {
+            std::cerr << "--resume needs --checkpoint.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (!checkpoint_directory.empty() && (!update_state.empty() || !load_index.empty() ||
+                                              !save_index.empty() || !save_state.empty())) {
+            std::cerr << "Can not use --checkpoint together with --update, --load-index, --save-index, or --save-state.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (max_pending > 0 && (collect_only || needed_nodes_only || !update_state.empty() ||
+                                !save_state.empty() || !checkpoint_directory.empty())) {
+            std::cerr << "Can not use --max-pending together with --collect-only, --needed-nodes-only, --update, --save-state, or --checkpoint.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (!cache_file.empty() && collect_only) {
+            std::cerr << "Can not use --cache together with --collect-only.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (!save_state.empty() && (database_name.empty() || !load_index.empty() || location_index_type == "none")) {
+            std::cerr << "--save-state needs --output and can not be used together with --load-index or index type 'none'.\n";
+            return exit_code_cmdline_error;
+        }
+
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
+        if (!filter_expression.empty()) {
+            std::cerr << "--filter is not supported with old style multipolygon support.\n";
+            return exit_code_cmdline_error;
+        }
+#endif
+
+        // In update mode the areas affected by the changes are rebuilt from
+        // a small OSM file created from the update state. They are written
+        // into a separate database which is then merged into the existing
+        // one.
+        std::string input_filename{argv[optind]};
+        std::string update_database_name;
+        update_result update;
+        if (!update_state.empty()) {
+            const std::vector<std::string> change_files(argv + optind, argv + argc);
+            input_filename = update_state + "/update.osm.pbf";
+
+            vout << "Applying changes to update state...\n";
+            update = prepare_update_with(update_state, change_files, input_filename, assembler_config, filter_expression, filter);
+            vout << "  " << update.changes << " changed objects, rebuilding areas of "
+                 << update.ways.size() << " ways and " << update.relations.size() << " relations\n";
+
+            update_database_name = database_name;
+            database_name += ".update";
+            overwrite = true;
+            location_index_type = "none";
+        }
+
+        const osmium::io::File input_file{input_filename};
+
+        // If the ways needed are selected before the locations are known
+        // (for the needed nodes or the node to way index of the update
+        // state), only ways closed by node ID can become areas. Otherwise
+        // the output would depend on the mode.
+        const bool closed_by_ref = needed_nodes_only || !save_state.empty() || !update_state.empty();
+
+        // When resuming after all nodes were read, the location index is
+        // loaded from the checkpoint and only the ways are read again.
+        // Anything written into the database before is thrown away.
+        std::unique_ptr<Checkpoint> checkpoint;
+        if (!checkpoint_directory.empty()) {
+            checkpoint = std::make_unique<Checkpoint>(checkpoint_directory, input_file, filter_expression, resume);
+            if (resume) {
+                vout << "Resuming from checkpoint in '" << checkpoint_directory << "'...\n";
+                overwrite = true;
+            }
+            if (checkpoint->has_locations()) {
+                load_index = checkpoint->locations_file();
+                needed_nodes_only = false;
+                parallel_nodes = false;
+            }
+        }
+
+        // Relations which don't fit into memory in the second pass are
+        // assembled in later rounds.
+        std::unique_ptr<RelationSpill> relation_spill;
+        if (max_pending > 0) {
+            relation_spill = std::make_unique<RelationSpill>(max_pending);
+        }
+
+#ifndef WITH_OLD_STYLE_MP_SUPPORT
+        // With worker threads, the rings of large relations are assembled
+        // in parallel, too. This needs a separate pool, the workers
+        // assembling relations wait for it.
+        std::unique_ptr<osmium::thread::Pool> split_pool;
+        if (num_threads > 0) {
+            split_pool = std::make_unique<osmium::thread::Pool>(num_threads);
+            assembler_config.pool = split_pool.get();
+        }
+
+        std::unique_ptr<AssemblyCache> cache;
+        if (!cache_file.empty()) {
+            cache = std::make_unique<AssemblyCache>(cache_file, max_cache_size);
+            assembler_config.cache = cache.get();
+        }
+#else
+        if (!cache_file.empty()) {
+            std::cerr << "--cache is not supported with old style multipolygon support.\n";
             return exit_code_cmdline_error;
         }
+#endif
+
+        MetricsWriter metrics{"oat_create_areas"};
+        if (!metrics_file.empty()) {
+            metrics.open(metrics_file, std::chrono::seconds{10});
+        }
 
-        auto location_index = map_factory.create_map(location_index_type);
+        auto location_index = load_index.empty() ? map_factory.create_map(location_index_type)
+                                                 : load_location_index(load_index, input_file);
         location_handler_type location_handler{*location_index};
         location_handler.ignore_errors(); // XXX
+        node_filter_type node_filter{location_handler};
+        StateWriter state_writer;
+        std::unique_ptr<AreaSpoolWriter> spool;
+        if (!spool_file.empty()) {
+            spool = std::make_unique<AreaSpoolWriter>(spool_file);
+        }
+        AssemblyTimer timer{max_slowest};
+
+        // If the locations are loaded from an index file or read in
+        // parallel to the first pass, we don't need the nodes.
+        const auto read_types = load_index.empty() && !parallel_nodes ? entity_bits(location_index_type) : osmium::osm_entity_bits::way;
 
-        const osmium::io::File input_file{argv[optind]};
+        const bool need_locations = !load_index.empty() || location_index_type != "none";
 
-        const bool need_locations = location_index_type != "none";
+        // If all locations are in the index before the second pass, they
+        // are added to the ways in batches.
+        const bool batch_locations = need_locations && (!load_index.empty() || parallel_nodes);
+        BatchedLocations batched_locations{*location_index};
+
+        // Only dense and sparse location indexes can be saved.
+        Checkpoint* locations_checkpoint_target = nullptr;
+        if (checkpoint && !checkpoint->has_locations() && need_locations) {
+            if (location_index_type.find("dense") == 0 || location_index_type.find("sparse") == 0) {
+                locations_checkpoint_target = checkpoint.get();
+            } else {
+                vout << "Location index of type '" << location_index_type << "' can not be saved in checkpoint.\n";
+            }
+        }
+        LocationsCheckpoint locations_checkpoint{locations_checkpoint_target, input_file, location_index_type, *location_index};
+
+        std::unique_ptr<BackgroundNodeReader<location_handler_type>> node_reader;
+        if (parallel_nodes) {
+            vout << "Reading nodes in parallel to first pass...\n";
+            if (node_threads > 0) {
+                node_reader = std::make_unique<BackgroundNodeReader<location_handler_type>>(input_file, location_handler, *location_index, node_threads);
+            } else {
+                node_reader = std::make_unique<BackgroundNodeReader<location_handler_type>>(input_file, location_handler);
+            }
+        }
 
         if (collect_only) {
             const DummyAssembler::config_type config;
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
             mp_manager_only mp_manager{config};
+#else
+            mp_manager_only mp_manager{config, filter};
+#endif
 
             vout << "Starting first pass (reading relations)...\n";
-            osmium::relations::read_relations(input_file, mp_manager);
+            metrics.start_pass(1);
+            read_relations_with(vout, input_file, checkpoint.get(), relation_spill.get(), mp_manager);
+            sample_manager(metrics, mp_manager);
             vout << "First pass done.\n";
 
+            if (node_reader) {
+                vout << "Waiting for nodes...\n";
+                node_reader->wait();
+                vout << "Reading nodes done.\n";
+            }
+
             vout << "Memory:\n";
             osmium::relations::print_used_memory(vout, mp_manager.used_memory());
 
+            if (needed_nodes_only) {
+                find_needed_nodes(vout, input_file, mp_manager, node_filter);
+            }
+
             vout << "Starting second pass (reading nodes and ways and assembling areas)...\n";
-            osmium::io::Reader reader2{input_file, entity_bits(location_index_type)};
-            if (need_locations) {
-                osmium::apply(reader2, location_handler, mp_manager.handler());
+            metrics.start_pass(2);
+            osmium::io::Reader reader2{input_file, read_types};
+            auto metrics_handler = make_metrics_handler(metrics, reader2, mp_manager, *location_index);
+            MemberWayFilter member_way_filter{mp_manager.handler()};
+            collect_member_ways(vout, mp_manager, member_way_filter);
+            if (batch_locations) {
+                apply_with_locations(reader2, batched_locations, metrics_handler, locations_checkpoint, member_way_filter);
+            } else if (need_locations) {
+                osmium::apply(reader2, metrics_handler, locations_checkpoint, node_filter, member_way_filter);
             } else {
-                osmium::apply(reader2, mp_manager.handler());
+                osmium::apply(reader2, metrics_handler, member_way_filter);
             }
+            metrics_handler.flush();
             reader2.close();
             vout << "Second pass done\n";
+            vout << "  ways skipped by member way filter: " << member_way_filter.rejected() << '\n';
+            vout << "  member ways stored without tags: " << member_way_filter.compacted() << " (" << (member_way_filter.bytes_saved() / 1024) << "kB saved)\n";
 
             vout << "Memory:\n";
             osmium::relations::print_used_memory(vout, mp_manager.used_memory());
@@ -415,37 +1373,92 @@ int main(int argc, char* argv[]) {
             vout << "Stats:" << mp_manager.stats() << '\n';
         } else {
             std::unique_ptr<osmium::area::ProblemReporter> reporter{nullptr};
+            std::unique_ptr<AsyncProblemReporter> async_reporter{nullptr};
 
+            // Formatting the problems for the stream is done in a separate
+            // thread.
             if (problem_stream) {
                 reporter = std::make_unique<osmium::area::ProblemReporterStream>(problem_stream.get());
-                assembler_config.problem_reporter = reporter.get();
+                async_reporter = std::make_unique<AsyncProblemReporter>(*reporter, queue_size);
+                assembler_config.problem_reporter = async_reporter.get();
             }
 
             if (database_name.empty()) {
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
                 mp_manager_type mp_manager{assembler_config};
+#else
+                mp_manager_type mp_manager{assembler_config, filter, num_threads};
+#endif
+                set_timer(mp_manager, timing ? &timer : nullptr);
+                set_region(mp_manager, region.get());
 
                 vout << "Starting first pass (reading relations)...\n";
-                osmium::relations::read_relations(input_file, mp_manager);
+                metrics.start_pass(1);
+                read_relations_with(vout, input_file, checkpoint.get(), relation_spill.get(), mp_manager);
+                sample_manager(metrics, mp_manager);
                 vout << "First pass done.\n";
 
+                if (node_reader) {
+                    vout << "Waiting for nodes...\n";
+                    node_reader->wait();
+                    vout << "Reading nodes done.\n";
+                }
+
                 vout << "Memory:\n";
                 osmium::relations::print_used_memory(vout, mp_manager.used_memory());
 
+                if (needed_nodes_only) {
+                    find_needed_nodes(vout, input_file, mp_manager, node_filter);
+                }
+
                 vout << "Starting second pass (reading nodes and ways and assembling areas)...\n";
-                osmium::io::Reader reader2{input_file, entity_bits(location_index_type)};
-                if (need_locations) {
-                    osmium::apply(reader2, location_handler, mp_manager.handler([](osmium::memory::Buffer&& /*buffer*/) {}));
+                metrics.start_pass(2);
+                osmium::io::Reader reader2{input_file, read_types};
+                auto metrics_handler = make_metrics_handler(metrics, reader2, mp_manager, *location_index);
+                const auto count_areas = [&](osmium::memory::Buffer&& buffer) {
+                    metrics.add_areas(buffer);
+                    if (spool) {
+                        spool->write(buffer);
+                    }
+                };
+                MemberWayFilter member_way_filter{mp_manager.handler(count_areas)};
+                collect_member_ways(vout, mp_manager, member_way_filter);
+                set_closed_by_ref(mp_manager, member_way_filter, closed_by_ref);
+                if (batch_locations) {
+                    apply_with_locations(reader2, batched_locations, metrics_handler, locations_checkpoint, member_way_filter);
+                } else if (need_locations) {
+                    osmium::apply(reader2, metrics_handler, locations_checkpoint, node_filter, member_way_filter);
                 } else {
-                    osmium::apply(reader2, mp_manager.handler([](osmium::memory::Buffer&& /*buffer*/) {}));
+                    osmium::apply(reader2, metrics_handler, member_way_filter);
                 }
+#ifndef WITH_OLD_STYLE_MP_SUPPORT
+                mp_manager.finish();
+#endif
+                if (relation_spill) {
+                    // The index was already sorted by the location handler.
+                    batched_locations.set_sorted();
+                    assemble_spilled_relations(vout, *relation_spill, input_file, assembler_config, filter, num_threads,
+                                               timing ? &timer : nullptr, region.get(),
+                                               need_locations ? &batched_locations : nullptr, count_areas);
+                }
+                metrics_handler.flush();
                 reader2.close();
+                if (async_reporter) {
+                    async_reporter->close();
+                }
                 vout << "Second pass done\n";
+                vout << "  ways skipped by member way filter: " << member_way_filter.rejected() << '\n';
+                vout << "  member ways stored without tags: " << member_way_filter.compacted() << " (" << (member_way_filter.bytes_saved() / 1024) << "kB saved)\n";
 
                 vout << "Memory:\n";
                 osmium::relations::print_used_memory(vout, mp_manager.used_memory());
 
                 vout << "Stats:" << mp_manager.stats() << '\n';
 
+                if (timing) {
+                    timer.print(std::cerr);
+                }
+
                 if (show_incomplete) {
                     show_incomplete_relations(mp_manager);
                 }
@@ -457,57 +1470,148 @@ int main(int argc, char* argv[]) {
                 CPLSetConfigOption("OGR_SQLITE_SYNCHRONOUS", "OFF");
                 osmium::geom::OGRFactory<> factory;
 
-                gdalcpp::Dataset dataset{"SQLite", database_name, gdalcpp::SRS{factory.proj_string()}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=NO" }};
-                dataset.enable_auto_transactions();
+                std::unique_ptr<gdalcpp::Dataset> dataset;
+                std::unique_ptr<OutputOGR> output_ogr;
+                std::unique_ptr<OutputSpatialite> output_spatialite;
+
+                if (direct_output) {
+                    OutputSpatialite::create_database(database_name, factory);
+                    output_spatialite = std::make_unique<OutputSpatialite>(database_name);
+                    output_spatialite->set_check(check);
+                    output_spatialite->set_only_invalid(only_invalid);
+                    output_spatialite->set_output_areas(output_areas);
+                } else {
+                    dataset = std::make_unique<gdalcpp::Dataset>("SQLite", database_name, gdalcpp::SRS{factory.proj_string()}, std::vector<std::string>{ "SPATIALITE=TRUE", "INIT_WITH_EPSG=NO" });
+                    dataset->enable_auto_transactions();
 
-                dataset.exec("PRAGMA journal_mode = OFF;");
+                    dataset->exec("PRAGMA journal_mode = OFF;");
 
-                OutputOGR output{dataset, factory};
-                output.set_check(check);
-                output.set_only_invalid(only_invalid);
-                output.set_output_areas(output_areas);
+                    output_ogr = std::make_unique<OutputOGR>(*dataset, factory);
+                    output_ogr->set_check(check);
+                    output_ogr->set_validator(validator);
+                    output_ogr->set_only_invalid(only_invalid);
+                    output_ogr->set_output_areas(output_areas);
+                }
 
+                std::unique_ptr<osmium::handler::Dump> dump_handler;
+                if (dump_stream) {
+                    dump_handler = std::make_unique<osmium::handler::Dump>(dump_stream.get());
+                }
+
+                // If the problems go into the database, they have to be
+                // written from the writer thread, too. With direct output
+                // problems always go to the problem stream.
+                ProblemRecorder recorder;
+                const bool record_problems = queue_size > 0 && dataset && !problem_stream;
+
+                if (dataset && !problem_stream) {
+                    reporter = std::make_unique<osmium::area::ProblemReporterOGR>(*dataset);
+                }
                 if (!problem_stream) {
-                    reporter = std::make_unique<osmium::area::ProblemReporterOGR>(dataset);
+                    assembler_config.problem_reporter = record_problems ? &recorder : reporter.get();
                 }
-                assembler_config.problem_reporter = reporter.get();
+
+                AsyncWriter<output_chunk> writer{queue_size, [&](output_chunk& chunk) {
+                    if (record_problems) {
+                        chunk.problems.replay(*reporter);
+                    }
+                    if (!chunk.buffer) {
+                        return;
+                    }
+                    if (output_spatialite) {
+                        write_areas(chunk.buffer, dump_handler.get(), *output_spatialite);
+                    } else {
+                        write_areas(chunk.buffer, dump_handler.get(), *output_ogr);
+                    }
+                }};
+
+                const auto push_chunk = [&](osmium::memory::Buffer&& buffer) {
+                    metrics.add_areas(buffer);
+                    if (spool) {
+                        spool->write(buffer);
+                    }
+                    writer.push(output_chunk{std::move(buffer), std::move(recorder)});
+                    recorder.clear();
+                };
+
+#ifdef WITH_OLD_STYLE_MP_SUPPORT
                 mp_manager_type mp_manager{assembler_config};
+#else
+                mp_manager_type mp_manager{assembler_config, filter, num_threads};
+#endif
+                set_timer(mp_manager, timing ? &timer : nullptr);
+                set_region(mp_manager, region.get());
 
                 vout << "Starting first pass (reading relations)...\n";
-                osmium::relations::read_relations(input_file, mp_manager);
+                metrics.start_pass(1);
+                read_relations_with(vout, input_file, checkpoint.get(), relation_spill.get(), mp_manager);
+                sample_manager(metrics, mp_manager);
                 vout << "First pass done.\n";
 
+                if (node_reader) {
+                    vout << "Waiting for nodes...\n";
+                    node_reader->wait();
+                    vout << "Reading nodes done.\n";
+                }
+
                 vout << "Memory:\n";
                 osmium::relations::print_used_memory(vout, mp_manager.used_memory());
 
-                vout << "Starting second pass (reading nodes and ways and assembling areas)...\n";
-                osmium::io::Reader reader2{input_file, entity_bits(location_index_type)};
+                if (needed_nodes_only) {
+                    find_needed_nodes(vout, input_file, mp_manager, node_filter);
+                }
 
-                if (dump_stream) {
-                    osmium::handler::Dump dump_handler{dump_stream.get()};
-                    if (need_locations) {
-                        osmium::apply(reader2, location_handler, mp_manager.handler([&output, &dump_handler](osmium::memory::Buffer&& buffer) {
-                            osmium::apply(buffer, dump_handler, output);
-                        }));
-                    } else {
-                        osmium::apply(reader2, mp_manager.handler([&output, &dump_handler](osmium::memory::Buffer&& buffer) {
-                            osmium::apply(buffer, dump_handler, output);
-                        }));
-                    }
+                if (!save_state.empty()) {
+                    open_state(vout, state_writer, save_state, input_file, filter_expression, mp_manager);
+                }
+
+                vout << "Starting second pass (reading nodes and ways and assembling areas)...\n";
+                metrics.start_pass(2);
+                osmium::io::Reader reader2{input_file, read_types};
+                auto metrics_handler = make_metrics_handler(metrics, reader2, mp_manager, *location_index);
+                MemberWayFilter member_way_filter{mp_manager.handler(push_chunk)};
+                collect_member_ways(vout, mp_manager, member_way_filter);
+                set_closed_by_ref(mp_manager, member_way_filter, closed_by_ref);
+
+                if (batch_locations) {
+                    apply_with_locations(reader2, batched_locations, metrics_handler, locations_checkpoint, member_way_filter);
+                } else if (need_locations) {
+                    osmium::apply(reader2, metrics_handler, locations_checkpoint, node_filter, state_writer, member_way_filter);
                 } else {
-                    if (need_locations) {
-                        osmium::apply(reader2, location_handler, mp_manager.handler([&output](osmium::memory::Buffer&& buffer) {
-                            osmium::apply(buffer, output);
-                        }));
-                    } else {
-                        osmium::apply(reader2, mp_manager.handler([&output](osmium::memory::Buffer&& buffer) {
-                            osmium::apply(buffer, output);
-                        }));
-                    }
+                    osmium::apply(reader2, metrics_handler, member_way_filter);
+                }
+#ifndef WITH_OLD_STYLE_MP_SUPPORT
+                mp_manager.finish();
+#endif
+                if (relation_spill) {
+                    // The index was already sorted by the location handler.
+                    batched_locations.set_sorted();
+                    assemble_spilled_relations(vout, *relation_spill, input_file, assembler_config, filter, num_threads,
+                                               timing ? &timer : nullptr, region.get(),
+                                               need_locations ? &batched_locations : nullptr, push_chunk);
+                }
+                metrics_handler.flush();
+                if (!recorder.empty()) {
+                    push_chunk(osmium::memory::Buffer{});
                 }
 
                 reader2.close();
+                writer.close();
+                if (async_reporter) {
+                    async_reporter->close();
+                }
+                if (output_spatialite) {
+                    output_spatialite->close();
+                }
+                state_writer.close();
+                if (output_ogr) {
+                    validator_mismatches = output_ogr->mismatches();
+                }
                 vout << "Second pass done\n";
+                vout << "  ways skipped by member way filter: " << member_way_filter.rejected() << '\n';
+                vout << "  member ways stored without tags: " << member_way_filter.compacted() << " (" << (member_way_filter.bytes_saved() / 1024) << "kB saved)\n";
+
+                writer.print_stats(vout);
 
                 if (!problem_stream) {
                     reporter.reset();
@@ -517,12 +1621,51 @@ int main(int argc, char* argv[]) {
 
                 vout << "Stats:" << mp_manager.stats() << '\n';
 
+                if (timing) {
+                    timer.print(std::cerr);
+                }
+
                 if (show_incomplete) {
                     show_incomplete_relations(mp_manager);
                 }
             }
         }
 
+        if (spool) {
+            vout << "Writing index of area spool '" << spool_file << "'...\n";
+            spool->close();
+        }
+
+        if (!update_database_name.empty()) {
+            vout << "Merging update into '" << update_database_name << "'...\n";
+            merge_update(update_database_name, database_name, update);
+            commit_update(update_state);
+            unlink(database_name.c_str());
+            unlink(input_filename.c_str());
+        }
+
+        if (timing && !collect_only && !database_name.empty()) {
+            write_timer(update_database_name.empty() ? database_name : update_database_name, timer);
+        }
+
+        if (!save_index.empty()) {
+            vout << "Saving location index to '" << save_index << "'...\n";
+            save_location_index(save_index, input_file, location_index_type, *location_index);
+        }
+
+        if (checkpoint) {
+            vout << "Removing checkpoint from '" << checkpoint_directory << "'...\n";
+            checkpoint->remove();
+        }
+
+#ifndef WITH_OLD_STYLE_MP_SUPPORT
+        if (cache) {
+            vout << "Writing assembly cache to '" << cache_file << "'...\n";
+            vout << "  " << cache->hits() << " relations found in cache, " << cache->misses() << " assembled\n";
+            cache->close();
+        }
+#endif
+
         vout << "Estimated memory usage:\n";
         vout << "  location index: " << (location_index->used_memory() / 1024) << "kB\n";
 
@@ -531,6 +1674,12 @@ int main(int argc, char* argv[]) {
             << "  current: " << mcheck.current() << "MB\n"
             << "  peak:    " << mcheck.peak() << "MB\n";
 
+        metrics.close();
+        if (validator_mismatches > 0) {
+            std::cerr << "Validators disagreed on " << validator_mismatches << " areas.\n";
+            return exit_code_error;
+        }
+
         vout << "Done.\n";
 
     } catch (const std::exception& e) {
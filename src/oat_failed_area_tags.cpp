@@ -6,6 +6,10 @@
 
 *****************************************************************************/
 
+#include "batched_locations.hpp"
+#include "compressed_block_map.hpp"
+#include "index_file.hpp"
+#include "node_reader.hpp"
 #include "oat.hpp"
 
 //#define WITH_OLD_STYLE_MP_SUPPORT
@@ -37,11 +41,13 @@
 #include <cstdlib>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
 
 using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
 using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
 
 REGISTER_MAP(osmium::unsigned_object_id_type, osmium::Location, osmium::index::map::Dummy, none)
+REGISTER_MAP(osmium::unsigned_object_id_type, osmium::Location, CompressedBlockMap, compressed_block)
 
 void print_help() {
     std::cout << "oat_failed_area_tags [OPTIONS] OSMFILE\n\n"
@@ -50,6 +56,10 @@ void print_help() {
               << "  -h, --help                   This help message\n"
               << "  -i, --index=INDEX_TYPE       Set index type for location index (default: flex_mem)\n"
               << "  -I, --show-index-types       Show available index types for location index\n"
+              << "  -L, --load-index=FILE        Load location index from FILE, don't read nodes\n"
+              << "  -M, --max-memory=SIZE        Choose index type fitting into SIZE bytes (e.g. 8G)\n"
+              << "  -P, --parallel-nodes[=NUM]   Read nodes in parallel to the first pass (with NUM threads)\n"
+              << "  -W, --save-index=FILE        Save location index to FILE\n"
               ;
 }
 
@@ -85,14 +95,24 @@ int main(int argc, char* argv[]) {
             {"help",       no_argument,       nullptr, 'h'},
             {"index",      required_argument, nullptr, 'i'},
             {"show-index", no_argument,       nullptr, 'I'},
+            {"load-index", required_argument, nullptr, 'L'},
+            {"max-memory", required_argument, nullptr, 'M'},
+            {"parallel-nodes", optional_argument, nullptr, 'P'},
+            {"save-index", required_argument, nullptr, 'W'},
             {nullptr, 0, nullptr, 0}
         };
 
         std::string location_index_type{"flex_mem"};
+        bool index_type_set = false;
+        std::size_t max_memory = 0;
+        std::string load_index;
+        std::string save_index;
+        bool parallel_nodes = false;
+        int node_threads = 0;
         const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
 
         while (true) {
-            const int c = getopt_long(argc, argv, "hi:I", long_options, nullptr);
+            const int c = getopt_long(argc, argv, "hi:IL:M:P::W:", long_options, nullptr);
             if (c == -1) {
                 break;
             }
@@ -103,10 +123,30 @@ int main(int argc, char* argv[]) {
                     return exit_code_ok;
                 case 'i':
                     location_index_type = optarg;
+                    index_type_set = true;
                     break;
                 case 'I':
                     show_index_types();
                     return exit_code_ok;
+                case 'L':
+                    load_index = optarg;
+                    break;
+                case 'M':
+                    max_memory = parse_memory_size(optarg);
+                    if (max_memory == 0) {
+                        std::cerr << "Invalid memory size '" << optarg << "'.\n";
+                        return exit_code_cmdline_error;
+                    }
+                    break;
+                case 'P':
+                    parallel_nodes = true;
+                    if (optarg) {
+                        node_threads = std::atoi(optarg);
+                    }
+                    break;
+                case 'W':
+                    save_index = optarg;
+                    break;
                 default:
                     return exit_code_cmdline_error;
             }
@@ -118,20 +158,68 @@ int main(int argc, char* argv[]) {
             return exit_code_cmdline_error;
         }
 
-        auto location_index = map_factory.create_map(location_index_type);
+        if (!load_index.empty() && !save_index.empty()) {
+            std::cerr << "Can not use --load-index and --save-index together.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (max_memory > 0 && index_type_set) {
+            std::cerr << "Can not use --max-memory and --index together.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (max_memory > 0 && load_index.empty()) {
+            location_index_type = choose_index_type(osmium::io::File{argv[optind]}, max_memory, std::cerr);
+        }
+
+        if (parallel_nodes && (!load_index.empty() || location_index_type == "none")) {
+            std::cerr << "Can not use --parallel-nodes together with --load-index or index type 'none'.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (node_threads > 0 && location_index_type.find("dense") != 0) {
+            std::cerr << "Can only use threads with --parallel-nodes together with a dense_* index type.\n";
+            return exit_code_cmdline_error;
+        }
+
+        const osmium::io::File input_file{argv[optind]};
+
+        auto location_index = load_index.empty() ? map_factory.create_map(location_index_type)
+                                                 : load_location_index(load_index, input_file);
         location_handler_type location_handler{*location_index};
         location_handler.ignore_errors(); // XXX
 
-        const osmium::io::File input_file{argv[optind]};
+        // If the locations are loaded from an index file or read in
+        // parallel to the first pass, we don't need the nodes.
+        const bool need_locations = !load_index.empty() || location_index_type != "none";
+        const auto read_types = load_index.empty() && !parallel_nodes ? entity_bits(location_index_type) : osmium::osm_entity_bits::way;
+
+        // If all locations are in the index before the second pass, they
+        // are added to the ways in batches.
+        const bool batch_locations = need_locations && (!load_index.empty() || parallel_nodes);
+        BatchedLocations batched_locations{*location_index};
 
         assembler_type::config_type assembler_config;
         assembler_config.create_empty_areas = true;
 
         mp_manager_type mp_manager{assembler_config};
 
+        std::unique_ptr<BackgroundNodeReader<location_handler_type>> node_reader;
+        if (parallel_nodes) {
+            if (node_threads > 0) {
+                node_reader = std::make_unique<BackgroundNodeReader<location_handler_type>>(input_file, location_handler, *location_index, node_threads);
+            } else {
+                node_reader = std::make_unique<BackgroundNodeReader<location_handler_type>>(input_file, location_handler);
+            }
+        }
+
         osmium::relations::read_relations(input_file, mp_manager);
 
-        osmium::io::Reader reader2{input_file, entity_bits(location_index_type)};
+        if (node_reader) {
+            node_reader->wait();
+        }
+
+        osmium::io::Reader reader2{input_file, read_types};
 
         tag_counter counter;
 
@@ -169,14 +257,20 @@ int main(int argc, char* argv[]) {
             }
         });
 
-        if (location_index_type == "none") {
+        if (!need_locations) {
             osmium::apply(reader2, mp_manager_handler);
+        } else if (batch_locations) {
+            apply_with_locations(reader2, batched_locations, mp_manager_handler);
         } else {
             osmium::apply(reader2, location_handler, mp_manager_handler);
         }
 
         reader2.close();
 
+        if (!save_index.empty()) {
+            save_location_index(save_index, input_file, location_index_type, *location_index);
+        }
+
         std::cout << "amenity:   " << counter.amenity  << '\n';
         std::cout << "boundary:  " << counter.boundary << '\n';
         std::cout << "building:  " << counter.building << '\n';
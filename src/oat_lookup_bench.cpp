@@ -0,0 +1,259 @@
+/*****************************************************************************
+
+  OSM Area Tools - Location lookup benchmark
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "batched_locations.hpp"
+#include "compressed_block_map.hpp"
+#include "oat.hpp"
+
+#include <osmium/handler/node_locations_for_ways.hpp>
+#include <osmium/index/map/dense_mem_array.hpp>
+#include <osmium/index/map/dense_mmap_array.hpp>
+#include <osmium/index/map/flex_mem.hpp>
+#include <osmium/index/map/sparse_mem_array.hpp>
+#include <osmium/index/map/sparse_mmap_array.hpp>
+#include <osmium/index/node_locations_map.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/visitor.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
+using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
+
+REGISTER_MAP(osmium::unsigned_object_id_type, osmium::Location, CompressedBlockMap, compressed_block)
+
+namespace {
+
+    using clock = std::chrono::steady_clock;
+
+    double milliseconds_since(clock::time_point start) {
+        const std::chrono::duration<double, std::milli> duration = clock::now() - start;
+        return duration.count();
+    }
+
+    // Number of way nodes with a valid location, used to check that both
+    // lookup methods get the same result.
+    std::size_t count_locations(const std::vector<osmium::memory::Buffer>& buffers) {
+        std::size_t count = 0;
+        for (const auto& buffer : buffers) {
+            for (const auto& way : buffer.select<osmium::Way>()) {
+                for (const auto& node_ref : way.nodes()) {
+                    if (node_ref.location().valid()) {
+                        ++count;
+                    }
+                }
+            }
+        }
+        return count;
+    }
+
+    void clear_locations(std::vector<osmium::memory::Buffer>& buffers) {
+        for (auto& buffer : buffers) {
+            for (auto& way : buffer.select<osmium::Way>()) {
+                for (auto& node_ref : way.nodes()) {
+                    node_ref.set_location(osmium::Location{});
+                }
+            }
+        }
+    }
+
+    double time_single(index_type& index, std::vector<osmium::memory::Buffer>& ways) {
+        clear_locations(ways);
+        const auto start = clock::now();
+        {
+            location_handler_type location_handler{index};
+            location_handler.ignore_errors();
+            for (auto& buffer : ways) {
+                osmium::apply(buffer, location_handler);
+            }
+        }
+        return milliseconds_since(start);
+    }
+
+    double time_batched(index_type& index, std::vector<osmium::memory::Buffer>& ways, std::size_t& lookups) {
+        clear_locations(ways);
+
+        // The index was already sorted after loading, only the lookups
+        // are timed.
+        BatchedLocations batched_locations{index};
+        batched_locations.set_sorted();
+
+        const auto start = clock::now();
+        for (auto& buffer : ways) {
+            batched_locations(buffer);
+        }
+        const auto ms = milliseconds_since(start);
+
+        lookups = batched_locations.lookups();
+        return ms;
+    }
+
+    // The single and batched lookups are run repeat times each, taking
+    // turns which one goes first, so neither always runs on warm caches.
+    void run_benchmark(const std::string& location_index_type, const osmium::io::File& input_file, std::vector<osmium::memory::Buffer>& ways, std::size_t way_nodes, std::size_t repeat) {
+        const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+        auto index = map_factory.create_map(location_index_type);
+
+        const auto start = clock::now();
+        {
+            location_handler_type location_handler{*index};
+            osmium::io::Reader reader{input_file, osmium::osm_entity_bits::node};
+            osmium::apply(reader, location_handler);
+            reader.close();
+            index->sort();
+        }
+        const auto load_ms = milliseconds_since(start);
+
+        double single_ms = 0.0;
+        double batched_ms = 0.0;
+        std::size_t lookups = 0;
+        bool mismatch = false;
+        for (std::size_t i = 0; i < repeat; ++i) {
+            std::size_t single_found = 0;
+            std::size_t batched_found = 0;
+            if (i % 2 == 0) {
+                single_ms += time_single(*index, ways);
+                single_found = count_locations(ways);
+                batched_ms += time_batched(*index, ways, lookups);
+                batched_found = count_locations(ways);
+            } else {
+                batched_ms += time_batched(*index, ways, lookups);
+                batched_found = count_locations(ways);
+                single_ms += time_single(*index, ways);
+                single_found = count_locations(ways);
+            }
+            mismatch = mismatch || single_found != batched_found;
+        }
+
+        const auto runs = static_cast<double>(repeat);
+        single_ms /= runs;
+        batched_ms /= runs;
+
+        std::cout << std::left << std::setw(20) << location_index_type << std::right
+                  << std::fixed << std::setprecision(0)
+                  << std::setw(12) << load_ms
+                  << std::setw(12) << single_ms
+                  << std::setw(12) << batched_ms
+                  << std::setw(12) << lookups
+                  << std::setprecision(1)
+                  << std::setw(11) << (static_cast<double>(way_nodes) / single_ms / 1000.0)
+                  << std::setw(11) << (static_cast<double>(way_nodes) / batched_ms / 1000.0)
+                  << std::setprecision(2)
+                  << std::setw(9) << (single_ms / batched_ms)
+                  << (mismatch ? "  MISMATCH" : "")
+                  << '\n';
+    }
+
+} // anonymous namespace
+
+void print_help() {
+    std::cout << "oat_lookup_bench [OPTIONS] OSMFILE\n\n"
+              << "Compare adding node locations to ways one way at a time with batched lookups.\n"
+              << "\nOptions:\n"
+              << "  -h, --help                   This help message\n"
+              << "  -i, --index=INDEX_TYPE       Add index type to benchmark (can be given several times)\n"
+              << "  -I, --show-index-types       Show available index types for location index\n"
+              << "  -r, --repeat=NUM             Run lookups NUM times, report average (default: 4)\n"
+              << "\nDefault index types: flex_mem, sparse_mem_array, dense_mem_array,\n"
+              << "and dense_mmap_array (if available).\n";
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        static const struct option long_options[] = {
+            {"help",       no_argument,       nullptr, 'h'},
+            {"index",      required_argument, nullptr, 'i'},
+            {"show-index", no_argument,       nullptr, 'I'},
+            {"repeat",     required_argument, nullptr, 'r'},
+            {nullptr, 0, nullptr, 0}
+        };
+
+        std::vector<std::string> location_index_types;
+        std::size_t repeat = 4;
+
+        while (true) {
+            const int c = getopt_long(argc, argv, "hi:Ir:", long_options, nullptr);
+            if (c == -1) {
+                break;
+            }
+
+            switch (c) {
+                case 'h':
+                    print_help();
+                    return exit_code_ok;
+                case 'i':
+                    location_index_types.emplace_back(optarg);
+                    break;
+                case 'I':
+                    show_index_types();
+                    return exit_code_ok;
+                case 'r':
+                    repeat = std::strtoul(optarg, nullptr, 10);
+                    break;
+                default:
+                    return exit_code_cmdline_error;
+            }
+        }
+
+        if (argc - optind != 1 || repeat == 0) {
+            std::cerr << "Usage: " << argv[0] << " [OPTIONS] OSMFILE\n";
+            return exit_code_cmdline_error;
+        }
+
+        const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+        if (location_index_types.empty()) {
+            location_index_types = {"flex_mem", "sparse_mem_array", "dense_mem_array"};
+            if (map_factory.has_map_type("dense_mmap_array")) {
+                location_index_types.emplace_back("dense_mmap_array");
+            }
+        }
+
+        const osmium::io::File input_file{argv[optind]};
+
+        // All ways are kept in memory, so this only works for extracts.
+        std::vector<osmium::memory::Buffer> ways;
+        std::size_t way_nodes = 0;
+        {
+            osmium::io::Reader reader{input_file, osmium::osm_entity_bits::way};
+            while (osmium::memory::Buffer buffer = reader.read()) {
+                for (const auto& way : buffer.select<osmium::Way>()) {
+                    way_nodes += way.nodes().size();
+                }
+                ways.push_back(std::move(buffer));
+            }
+            reader.close();
+        }
+        std::cout << ways.size() << " buffers with " << way_nodes << " way nodes\n\n";
+
+        std::cout << "index type               load ms   single ms  batched ms     lookups  single/us batched/us  speedup\n";
+        for (const auto& location_index_type : location_index_types) {
+            run_benchmark(location_index_type, input_file, ways, way_nodes, repeat);
+        }
+
+        const osmium::MemoryUsage memory;
+        std::cout << "\npeak memory: " << memory.peak() << "MB\n";
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return exit_code_error;
+    }
+
+    return exit_code_ok;
+}
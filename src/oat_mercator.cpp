@@ -6,10 +6,21 @@
 
 *****************************************************************************/
 
+#include "area_manager.hpp"
+#include "area_spool.hpp"
+#include "assembly_cache.hpp"
+#include "async_writer.hpp"
+#include "batched_locations.hpp"
+#include "caching_assembler.hpp"
+#include "compressed_block_map.hpp"
+#include "index_file.hpp"
+#include "needed_nodes.hpp"
+#include "node_reader.hpp"
 #include "oat.hpp"
+#include "problem_recorder.hpp"
+#include "region.hpp"
 
 #include <osmium/area/assembler.hpp>
-#include <osmium/area/multipolygon_manager.hpp>
 #include <osmium/area/problem_reporter_ogr.hpp>
 #include <osmium/geom/mercator_projection.hpp>
 #include <osmium/geom/ogr.hpp>
@@ -22,15 +33,20 @@
 #include <osmium/index/map/sparse_mmap_array.hpp>
 #include <osmium/index/node_locations_map.hpp>
 #include <osmium/io/any_input.hpp>
+#include <osmium/tags/tags_filter.hpp>
 #include <osmium/util/memory.hpp>
 #include <osmium/util/verbose_output.hpp>
 #include <osmium/visitor.hpp>
 
 #include <gdalcpp.hpp>
 
+#include <cstddef>
 #include <cstdlib>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <utility>
 
 using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
 using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
@@ -38,6 +54,7 @@ using proj_type = osmium::geom::MercatorProjection;
 using factory_type = osmium::geom::OGRFactory<proj_type>;
 
 REGISTER_MAP(osmium::unsigned_object_id_type, osmium::Location, osmium::index::map::Dummy, none)
+REGISTER_MAP(osmium::unsigned_object_id_type, osmium::Location, CompressedBlockMap, compressed_block)
 
 class OutputOGR : public osmium::handler::Handler {
 
@@ -95,73 +112,140 @@ public:
 
 
 void print_help() {
-    std::cout << "oat_mercator [OPTIONS] OSMFILE\n\n"
+    std::cout << "oat_mercator [OPTIONS] OSMFILE\n"
+              << "oat_mercator [OPTIONS] --from-spool SPOOLFILE\n\n"
               << "Read OSMFILE, build multipolygons from it and project to Mercator.\n"
+              << "Or read already assembled areas from SPOOLFILE (see oat_create_areas --area-spool).\n"
               << "\nOptions:\n"
+              << "  -b, --bbox=BOX          Only build areas intersecting BOX (MINLON,MINLAT,MAXLON,MAXLAT)\n"
               << "  -d, --debug[=LEVEL]     Set area assembler debug level\n"
               << "  -f, --only-invalid      Filter out valid geometries\n"
+              << "  -F, --filter=EXPR       Only build areas with tags matching EXPR (e.g. building,natural=water)\n"
+              << "  -g, --region=FILE       Only build areas intersecting polygon from FILE (poly format)\n"
               << "  -h, --help              This help message\n"
               << "  -i, --index=INDEX_TYPE  Set index type for location index (default: flex_mem)\n"
               << "  -I, --show-index-types  Show available index types for location index\n"
+              << "  -L, --load-index=FILE   Load location index from FILE, don't read nodes\n"
+              << "  -M, --max-memory=SIZE   Choose index type fitting into SIZE bytes (e.g. 8G)\n"
+              << "  -n, --needed-nodes-only Only store locations of needed nodes (areas only from ways closed by node ID)\n"
               << "  -o, --output=DBNAME     Database name\n"
               << "  -O, --overwrite         Overwrite existing database\n"
               << "  -p, --report-problems   Report problems to database\n"
+              << "  -P, --parallel-nodes[=N] Read nodes in parallel to the first pass (with N threads)\n"
+              << "  -q, --queue-size=NUM    Size of queue to output writer thread (default: 16, 0: no thread)\n"
+              << "  -s, --from-spool        Read areas from spool file instead of OSM file\n"
+              << "  -W, --save-index=FILE   Save location index to FILE\n"
+              << "  -y, --cache=FILE        Cache results of assembling relations in FILE\n"
+              << "  -Y, --max-cache-size=SIZE Maximum size of cache (default: 4G)\n"
               ;
 }
 
-using assembler_type = osmium::area::Assembler;
-using mp_manager_type = osmium::area::MultipolygonManager<assembler_type>;
+using assembler_type = CachingAssembler<osmium::area::Assembler>;
+using mp_manager_type = AreaManager<assembler_type>;
 
 int main(int argc, char* argv[]) {
     try {
         osmium::util::VerboseOutput vout{true};
 
         static const struct option long_options[] = {
-            {"debug",           optional_argument, nullptr, 'd'},
-            {"only-invalid",    no_argument,       nullptr, 'f'},
-            {"help",            no_argument,       nullptr, 'h'},
-            {"index",           required_argument, nullptr, 'i'},
-            {"show-index",      no_argument,       nullptr, 'I'},
-            {"output",          required_argument, nullptr, 'o'},
-            {"overwrite",       no_argument,       nullptr, 'O'},
-            {"report-problems", no_argument,       nullptr, 'p'},
+            {"bbox",              required_argument, nullptr, 'b'},
+            {"debug",             optional_argument, nullptr, 'd'},
+            {"only-invalid",      no_argument,       nullptr, 'f'},
+            {"filter",            required_argument, nullptr, 'F'},
+            {"region",            required_argument, nullptr, 'g'},
+            {"help",              no_argument,       nullptr, 'h'},
+            {"index",             required_argument, nullptr, 'i'},
+            {"show-index",        no_argument,       nullptr, 'I'},
+            {"load-index",        required_argument, nullptr, 'L'},
+            {"max-memory",        required_argument, nullptr, 'M'},
+            {"needed-nodes-only", no_argument,       nullptr, 'n'},
+            {"output",            required_argument, nullptr, 'o'},
+            {"overwrite",         no_argument,       nullptr, 'O'},
+            {"report-problems",   no_argument,       nullptr, 'p'},
+            {"parallel-nodes",    optional_argument, nullptr, 'P'},
+            {"queue-size",        required_argument, nullptr, 'q'},
+            {"from-spool",        no_argument,       nullptr, 's'},
+            {"save-index",        required_argument, nullptr, 'W'},
+            {"cache",             required_argument, nullptr, 'y'},
+            {"max-cache-size",    required_argument, nullptr, 'Y'},
             {nullptr, 0, nullptr, 0}
         };
 
         std::string database_name;
 
         std::string location_index_type{"flex_mem"};
+        bool index_type_set = false;
+        std::size_t max_memory = 0;
+        std::string load_index;
+        std::string save_index;
         const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
 
         bool overwrite = false;
         bool report_problems = false;
         bool only_invalid = false;
+        bool needed_nodes_only = false;
+        bool parallel_nodes = false;
+        int node_threads = 0;
+        bool from_spool = false;
+        std::size_t queue_size = 16;
+        osmium::TagsFilter filter{true};
+        std::unique_ptr<Region> region;
+        std::string cache_file;
+        std::size_t max_cache_size = 4UL * 1024UL * 1024UL * 1024UL;
 
         assembler_type::config_type assembler_config;
         assembler_config.create_empty_areas = false;
 
         while (true) {
-            const int c = getopt_long(argc, argv, "d::fhi:Io:Op", long_options, nullptr);
+            const int c = getopt_long(argc, argv, "b:d::fF:g:hi:IL:M:no:OpP::q:sW:y:Y:", long_options, nullptr);
             if (c == -1) {
                 break;
             }
 
             switch (c) {
+                case 'b':
+                    region = std::make_unique<Region>(Region::from_bbox(optarg));
+                    break;
                 case 'd':
                     assembler_config.debug_level = optarg ? std::atoi(optarg) : 1;
                     break;
                 case 'f':
                     only_invalid = true;
                     break;
+                case 'F':
+                    try {
+                        filter = parse_tags_filter(optarg);
+                    } catch (const std::runtime_error& e) {
+                        std::cerr << e.what() << '\n';
+                        return exit_code_cmdline_error;
+                    }
+                    break;
+                case 'g':
+                    region = std::make_unique<Region>(Region::from_poly_file(optarg));
+                    break;
                 case 'h':
                     print_help();
                     return exit_code_ok;
                 case 'i':
                     location_index_type = optarg;
+                    index_type_set = true;
                     break;
                 case 'I':
                     show_index_types();
                     return exit_code_ok;
+                case 'L':
+                    load_index = optarg;
+                    break;
+                case 'M':
+                    max_memory = parse_memory_size(optarg);
+                    if (max_memory == 0) {
+                        std::cerr << "Invalid memory size '" << optarg << "'.\n";
+                        return exit_code_cmdline_error;
+                    }
+                    break;
+                case 'n':
+                    needed_nodes_only = true;
+                    break;
                 case 'o':
                     database_name = optarg;
                     break;
@@ -171,6 +255,31 @@ int main(int argc, char* argv[]) {
                 case 'p':
                     report_problems = true;
                     break;
+                case 'P':
+                    parallel_nodes = true;
+                    if (optarg) {
+                        node_threads = std::atoi(optarg);
+                    }
+                    break;
+                case 'q':
+                    queue_size = std::strtoul(optarg, nullptr, 10);
+                    break;
+                case 's':
+                    from_spool = true;
+                    break;
+                case 'W':
+                    save_index = optarg;
+                    break;
+                case 'y':
+                    cache_file = optarg;
+                    break;
+                case 'Y':
+                    max_cache_size = parse_memory_size(optarg);
+                    if (max_cache_size == 0) {
+                        std::cerr << "Invalid memory size '" << optarg << "'.\n";
+                        return exit_code_cmdline_error;
+                    }
+                    break;
                 default:
                     return exit_code_cmdline_error;
             }
@@ -182,13 +291,59 @@ int main(int argc, char* argv[]) {
             return exit_code_cmdline_error;
         }
 
-        auto location_index = map_factory.create_map(location_index_type);
+        if (!load_index.empty() && !save_index.empty()) {
+            std::cerr << "Can not use --load-index and --save-index together.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (from_spool && (!load_index.empty() || !save_index.empty() || max_memory > 0 || needed_nodes_only ||
+                           parallel_nodes || report_problems || region || index_type_set || !cache_file.empty())) {
+            std::cerr << "Can only use --from-spool together with --output, --overwrite, and --only-invalid.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (max_memory > 0 && index_type_set) {
+            std::cerr << "Can not use --max-memory and --index together.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (max_memory > 0 && load_index.empty()) {
+            location_index_type = choose_index_type(osmium::io::File{argv[optind]}, max_memory, std::cerr);
+        }
+
+        if (needed_nodes_only && (!load_index.empty() || !save_index.empty() || location_index_type == "none")) {
+            std::cerr << "Can not use --needed-nodes-only together with --load-index, --save-index, or index type 'none'.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (parallel_nodes && (!load_index.empty() || needed_nodes_only || location_index_type == "none")) {
+            std::cerr << "Can not use --parallel-nodes together with --load-index, --needed-nodes-only, or index type 'none'.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (node_threads > 0 && location_index_type.find("dense") != 0) {
+            std::cerr << "Can only use threads with --parallel-nodes together with a dense_* index type.\n";
+            return exit_code_cmdline_error;
+        }
+
+        const osmium::io::File input_file{argv[optind]};
+
+        auto location_index = load_index.empty() ? map_factory.create_map(location_index_type)
+                                                 : load_location_index(load_index, input_file);
         location_handler_type location_handler{*location_index};
         location_handler.ignore_errors(); // XXX
+        NeededNodesFilter<location_handler_type> node_filter{location_handler};
 
-        const osmium::io::File input_file{argv[optind]};
+        // If the locations are loaded from an index file or read in
+        // parallel to the first pass, we don't need the nodes.
+        const auto read_types = load_index.empty() && !parallel_nodes ? entity_bits(location_index_type) : osmium::osm_entity_bits::way;
+
+        const bool need_locations = !load_index.empty() || location_index_type != "none";
 
-        const bool need_locations = location_index_type != "none";
+        // If all locations are in the index before the second pass, they
+        // are added to the ways in batches.
+        const bool batch_locations = need_locations && (!load_index.empty() || parallel_nodes);
+        BatchedLocations batched_locations{*location_index};
 
         if (overwrite) {
             unlink(database_name.c_str());
@@ -205,43 +360,119 @@ int main(int argc, char* argv[]) {
         OutputOGR output{dataset, factory};
         output.set_only_invalid(only_invalid);
 
+        if (from_spool) {
+            vout << "Reading areas from spool...\n";
+            const AreaSpoolReader spool{argv[optind]};
+            auto buffer = spool.buffer();
+            osmium::apply(buffer, output);
+            vout << "  " << spool.size() << " areas\n";
+            vout << "Done.\n";
+            return exit_code_ok;
+        }
+
         std::unique_ptr<osmium::area::ProblemReporterOGR> reporter;
 
         if (report_problems) {
             reporter = std::make_unique<osmium::area::ProblemReporterOGR>(dataset);
         }
 
-        assembler_config.problem_reporter = reporter.get();
-        mp_manager_type mp_manager{assembler_config};
+        // The problems have to be written from the writer thread, because
+        // that thread owns the database.
+        ProblemRecorder recorder;
+        const bool record_problems = queue_size > 0 && report_problems;
+
+        assembler_config.problem_reporter = record_problems ? &recorder : reporter.get();
+
+        std::unique_ptr<AssemblyCache> cache;
+        if (!cache_file.empty()) {
+            cache = std::make_unique<AssemblyCache>(cache_file, max_cache_size);
+            assembler_config.cache = cache.get();
+        }
+
+        mp_manager_type mp_manager{assembler_config, filter};
+        mp_manager.set_region(region.get());
+        mp_manager.set_closed_by_ref(needed_nodes_only);
+
+        AsyncWriter<output_chunk> writer{queue_size, [&](output_chunk& chunk) {
+            if (record_problems) {
+                chunk.problems.replay(*reporter);
+            }
+            if (chunk.buffer) {
+                osmium::apply(chunk.buffer, output);
+            }
+        }};
+
+        const auto push_chunk = [&](osmium::memory::Buffer&& buffer) {
+            writer.push(output_chunk{std::move(buffer), std::move(recorder)});
+            recorder.clear();
+        };
+
+        std::unique_ptr<BackgroundNodeReader<location_handler_type>> node_reader;
+        if (parallel_nodes) {
+            vout << "Reading nodes in parallel to first pass...\n";
+            if (node_threads > 0) {
+                node_reader = std::make_unique<BackgroundNodeReader<location_handler_type>>(input_file, location_handler, *location_index, node_threads);
+            } else {
+                node_reader = std::make_unique<BackgroundNodeReader<location_handler_type>>(input_file, location_handler);
+            }
+        }
 
         vout << "Starting first pass (reading relations)...\n";
         osmium::relations::read_relations(input_file, mp_manager);
         vout << "First pass done.\n";
 
+        if (node_reader) {
+            vout << "Waiting for nodes...\n";
+            node_reader->wait();
+            vout << "Reading nodes done.\n";
+        }
+
         vout << "Memory:\n";
         osmium::relations::print_used_memory(vout, mp_manager.used_memory());
 
+        if (needed_nodes_only) {
+            vout << "Starting extra pass (finding needed nodes)...\n";
+            node_filter.collect(input_file, mp_manager);
+            vout << "Extra pass done.\n";
+            vout << "  needed nodes bitmaps: " << (node_filter.used_memory() / 1024) << "kB\n";
+        }
+
         vout << "Starting second pass (reading nodes and ways and assembling areas)...\n";
-        osmium::io::Reader reader{input_file, entity_bits(location_index_type)};
+        osmium::io::Reader reader{input_file, read_types};
 
-        if (need_locations) {
-            osmium::apply(reader, location_handler, mp_manager.handler([&output](osmium::memory::Buffer&& buffer) {
-                osmium::apply(buffer, output);
-            }));
+        if (batch_locations) {
+            apply_with_locations(reader, batched_locations, mp_manager.handler(push_chunk));
+        } else if (need_locations) {
+            osmium::apply(reader, node_filter, mp_manager.handler(push_chunk));
         } else {
-            osmium::apply(reader, mp_manager.handler([&output](osmium::memory::Buffer&& buffer) {
-                osmium::apply(buffer, output);
-            }));
+            osmium::apply(reader, mp_manager.handler(push_chunk));
+        }
+        if (!recorder.empty()) {
+            push_chunk(osmium::memory::Buffer{});
         }
 
         reader.close();
+        writer.close();
         vout << "Second pass done\n";
 
+        writer.print_stats(vout);
+
         reporter.reset();
         osmium::relations::print_used_memory(vout, mp_manager.used_memory());
 
         vout << "Stats:" << mp_manager.stats() << '\n';
 
+        if (cache) {
+            vout << "Writing assembly cache to '" << cache_file << "'...\n";
+            vout << "  " << cache->hits() << " relations found in cache, " << cache->misses() << " assembled\n";
+            cache->close();
+        }
+
+        if (!save_index.empty()) {
+            vout << "Saving location index to '" << save_index << "'...\n";
+            save_location_index(save_index, input_file, location_index_type, *location_index);
+        }
+
         vout << "Estimated memory usage:\n";
         vout << "  location index: " << (location_index->used_memory() / 1024) << "kB\n";
 
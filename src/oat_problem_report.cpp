@@ -6,6 +6,12 @@
 
 *****************************************************************************/
 
+#include "async_problem_reporter.hpp"
+#include "batched_locations.hpp"
+#include "compressed_block_map.hpp"
+#include "index_file.hpp"
+#include "metrics.hpp"
+#include "node_reader.hpp"
 #include "oat.hpp"
 
 //#define WITH_OLD_STYLE_MP_SUPPORT
@@ -35,14 +41,19 @@
 
 #include <gdalcpp.hpp>
 
+#include <chrono>
+#include <cstddef>
 #include <cstdlib>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
+#include <string>
 
 using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
 using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
 
 REGISTER_MAP(osmium::unsigned_object_id_type, osmium::Location, osmium::index::map::Dummy, none)
+REGISTER_MAP(osmium::unsigned_object_id_type, osmium::Location, CompressedBlockMap, compressed_block)
 
 static void print_help() {
     std::cout << "oat_problem_report [OPTIONS] OSMFILE\n\n"
@@ -50,7 +61,13 @@ static void print_help() {
               << "Options:\n"
               << "  -h, --help                   This help message\n"
               << "  -i, --index=INDEX_TYPE       Set index type for location index (default: flex_mem)\n"
-              << "  -I, --show-index-types       Show available index types for location index\n";
+              << "  -I, --show-index-types       Show available index types for location index\n"
+              << "  -L, --load-index=FILE        Load location index from FILE, don't read nodes\n"
+              << "  -m, --metrics=FILE           Write metrics to FILE every 10 seconds\n"
+              << "  -M, --max-memory=SIZE        Choose index type fitting into SIZE bytes (e.g. 8G)\n"
+              << "  -P, --parallel-nodes[=NUM]   Read nodes in parallel to the first pass (with NUM threads)\n"
+              << "  -q, --queue-size=NUM         Size of queue to problem writer thread (default: 16, 0: no thread)\n"
+              << "  -W, --save-index=FILE        Save location index to FILE\n";
 }
 
 #ifdef WITH_OLD_STYLE_MP_SUPPORT
@@ -69,16 +86,30 @@ int main(int argc, char* argv[]) {
             {"help",       no_argument,       nullptr, 'h'},
             {"index",      required_argument, nullptr, 'i'},
             {"show-index", no_argument,       nullptr, 'I'},
+            {"load-index", required_argument, nullptr, 'L'},
+            {"metrics",    required_argument, nullptr, 'm'},
+            {"max-memory", required_argument, nullptr, 'M'},
+            {"parallel-nodes", optional_argument, nullptr, 'P'},
+            {"queue-size", required_argument, nullptr, 'q'},
+            {"save-index", required_argument, nullptr, 'W'},
             {nullptr, 0, nullptr, 0}
         };
 
         const std::string database_name{"area_problems"};
 
         std::string location_index_type{"flex_mem"};
+        bool index_type_set = false;
+        std::size_t max_memory = 0;
+        std::string load_index;
+        std::string save_index;
+        std::string metrics_file;
+        bool parallel_nodes = false;
+        int node_threads = 0;
+        std::size_t queue_size = 16;
         const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
 
         while (true) {
-            const int c = getopt_long(argc, argv, "hi:I", long_options, nullptr);
+            const int c = getopt_long(argc, argv, "hi:IL:m:M:P::q:W:", long_options, nullptr);
             if (c == -1) {
                 break;
             }
@@ -89,10 +120,36 @@ int main(int argc, char* argv[]) {
                     return exit_code_ok;
                 case 'i':
                     location_index_type = optarg;
+                    index_type_set = true;
                     break;
                 case 'I':
                     show_index_types();
                     return exit_code_ok;
+                case 'L':
+                    load_index = optarg;
+                    break;
+                case 'm':
+                    metrics_file = optarg;
+                    break;
+                case 'M':
+                    max_memory = parse_memory_size(optarg);
+                    if (max_memory == 0) {
+                        std::cerr << "Invalid memory size '" << optarg << "'.\n";
+                        return exit_code_cmdline_error;
+                    }
+                    break;
+                case 'P':
+                    parallel_nodes = true;
+                    if (optarg) {
+                        node_threads = std::atoi(optarg);
+                    }
+                    break;
+                case 'q':
+                    queue_size = std::strtoul(optarg, nullptr, 10);
+                    break;
+                case 'W':
+                    save_index = optarg;
+                    break;
                 default:
                     return exit_code_cmdline_error;
             }
@@ -104,11 +161,51 @@ int main(int argc, char* argv[]) {
             return exit_code_cmdline_error;
         }
 
-        auto location_index = map_factory.create_map(location_index_type);
+        if (!load_index.empty() && !save_index.empty()) {
+            std::cerr << "Can not use --load-index and --save-index together.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (max_memory > 0 && index_type_set) {
+            std::cerr << "Can not use --max-memory and --index together.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (max_memory > 0 && load_index.empty()) {
+            location_index_type = choose_index_type(osmium::io::File{argv[optind]}, max_memory, std::cerr);
+        }
+
+        if (parallel_nodes && (!load_index.empty() || location_index_type == "none")) {
+            std::cerr << "Can not use --parallel-nodes together with --load-index or index type 'none'.\n";
+            return exit_code_cmdline_error;
+        }
+
+        if (node_threads > 0 && location_index_type.find("dense") != 0) {
+            std::cerr << "Can only use threads with --parallel-nodes together with a dense_* index type.\n";
+            return exit_code_cmdline_error;
+        }
+
+        const osmium::io::File input_file{argv[optind]};
+
+        MetricsWriter metrics{"oat_problem_report"};
+        if (!metrics_file.empty()) {
+            metrics.open(metrics_file, std::chrono::seconds{10});
+        }
+
+        auto location_index = load_index.empty() ? map_factory.create_map(location_index_type)
+                                                 : load_location_index(load_index, input_file);
         location_handler_type location_handler(*location_index);
         location_handler.ignore_errors(); // XXX
 
-        const osmium::io::File input_file{argv[optind]};
+        // If the locations are loaded from an index file or read in
+        // parallel to the first pass, we don't need the nodes.
+        const bool need_locations = !load_index.empty() || location_index_type != "none";
+        const auto read_types = load_index.empty() && !parallel_nodes ? entity_bits(location_index_type) : osmium::osm_entity_bits::way;
+
+        // If all locations are in the index before the second pass, they
+        // are added to the ways in batches.
+        const bool batch_locations = need_locations && (!load_index.empty() || parallel_nodes);
+        BatchedLocations batched_locations{*location_index};
 
         assembler_type::config_type assembler_config;
         assembler_config.check_roles = true;
@@ -117,32 +214,68 @@ int main(int argc, char* argv[]) {
 
         gdalcpp::Dataset dataset{"ESRI Shapefile", database_name, gdalcpp::SRS{factory.proj_string()}};
         osmium::area::ProblemReporterOGR problem_reporter{dataset};
-        assembler_config.problem_reporter = &problem_reporter;
+
+        // Writing the problems into the shapefiles is done in a separate
+        // thread (unless the queue size is 0).
+        AsyncProblemReporter async_reporter{problem_reporter, queue_size};
+        assembler_config.problem_reporter = &async_reporter;
         mp_manager_type mp_manager{assembler_config};
 
+        std::unique_ptr<BackgroundNodeReader<location_handler_type>> node_reader;
+        if (parallel_nodes) {
+            vout << "Reading nodes in parallel to first pass...\n";
+            if (node_threads > 0) {
+                node_reader = std::make_unique<BackgroundNodeReader<location_handler_type>>(input_file, location_handler, *location_index, node_threads);
+            } else {
+                node_reader = std::make_unique<BackgroundNodeReader<location_handler_type>>(input_file, location_handler);
+            }
+        }
+
         vout << "Starting first pass (reading relations)...\n";
+        metrics.start_pass(1);
         osmium::relations::read_relations(input_file, mp_manager);
+        sample_manager(metrics, mp_manager);
         vout << "First pass done.\n";
 
+        if (node_reader) {
+            vout << "Waiting for nodes...\n";
+            node_reader->wait();
+            vout << "Reading nodes done.\n";
+        }
+
         vout << "Memory:\n";
         osmium::relations::print_used_memory(vout, mp_manager.used_memory());
 
         vout << "Starting second pass (reading nodes and ways and assembling areas)...\n";
-        osmium::io::Reader reader2{input_file, entity_bits(location_index_type)};
+        metrics.start_pass(2);
+        osmium::io::Reader reader2{input_file, read_types};
+        auto metrics_handler = make_metrics_handler(metrics, reader2, mp_manager, *location_index);
+        const auto count_areas = [&metrics](osmium::memory::Buffer&& buffer) {
+            metrics.add_areas(buffer);
+        };
 
-        if (location_index_type == "none") {
-            osmium::apply(reader2, mp_manager.handler([](osmium::memory::Buffer&& /*buffer*/){}));
+        if (!need_locations) {
+            osmium::apply(reader2, metrics_handler, mp_manager.handler(count_areas));
+        } else if (batch_locations) {
+            apply_with_locations(reader2, batched_locations, metrics_handler, mp_manager.handler(count_areas));
         } else {
-            osmium::apply(reader2, location_handler, mp_manager.handler([](osmium::memory::Buffer&& /*buffer*/){}));
+            osmium::apply(reader2, metrics_handler, location_handler, mp_manager.handler(count_areas));
         }
 
+        metrics_handler.flush();
         reader2.close();
+        async_reporter.close();
         vout << "Second pass done\n";
 
         osmium::relations::print_used_memory(vout, mp_manager.used_memory());
 
         vout << "Stats:" << mp_manager.stats() << '\n';
 
+        if (!save_index.empty()) {
+            vout << "Saving location index to '" << save_index << "'...\n";
+            save_location_index(save_index, input_file, location_index_type, *location_index);
+        }
+
         vout << "Estimated memory usage:\n";
         vout << "  location index: " << (location_index->used_memory() / (1024 * 1024)) << "MB\n";
 
@@ -151,6 +284,7 @@ int main(int argc, char* argv[]) {
             << "  current: " << mcheck.current() << "MB\n"
             << "  peak:    " << mcheck.peak() << "MB\n";
 
+        metrics.close();
         vout << "Results written to 'area_problems' directory.\n";
         vout << "Done.\n";
 
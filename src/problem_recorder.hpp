@@ -0,0 +1,289 @@
+#ifndef PROBLEM_RECORDER_HPP
+#define PROBLEM_RECORDER_HPP
+
+#include <osmium/area/problem_reporter.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node_ref.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Problem reporter that doesn't report anything but remembers all problems
+ * so that they can be replayed into some other problem reporter later. This
+ * is used to get problems from assemblers running in other threads back
+ * into the thread that owns the real problem reporter.
+ */
+class ProblemRecorder : public osmium::area::ProblemReporter {
+
+    enum class problem_type : uint8_t {
+        duplicate_node,
+        touching_ring,
+        intersection,
+        duplicate_segment,
+        overlapping_segment,
+        ring_not_closed,
+        role_should_be_outer,
+        role_should_be_inner,
+        way_in_multiple_rings,
+        inner_with_same_tags,
+        invalid_location,
+        duplicate_way,
+        way
+    };
+
+    static constexpr const std::size_t no_way = static_cast<std::size_t>(-1);
+
+    struct record {
+        problem_type type;
+        osmium::item_type object_type;
+        osmium::object_id_type object_id;
+        std::size_t nodes;
+        osmium::object_id_type id1 = 0;
+        osmium::object_id_type id2 = 0;
+        std::array<osmium::Location, 5> locations{};
+        std::size_t way_offset = no_way;
+    };
+
+    static_assert(std::is_trivially_copyable<record>::value, "problem records must be trivially copyable");
+
+    std::vector<record> m_records;
+
+    // Copies of the ways some problems refer to
+    osmium::memory::Buffer m_ways{};
+
+    record& add(problem_type type) {
+        m_records.emplace_back();
+        auto& r = m_records.back();
+        r.type = type;
+        r.object_type = m_object_type;
+        r.object_id = m_object_id;
+        r.nodes = m_nodes;
+        return r;
+    }
+
+    std::size_t add_way(const osmium::Way& way) {
+        if (!m_ways) {
+            m_ways = osmium::memory::Buffer{1024UL * 16UL, osmium::memory::Buffer::auto_grow::yes};
+        }
+        const auto offset = m_ways.committed();
+        m_ways.add_item(way);
+        m_ways.commit();
+        return offset;
+    }
+
+    const osmium::Way& way(const record& r) const {
+        return m_ways.get<osmium::Way>(r.way_offset);
+    }
+
+public:
+
+    bool empty() const noexcept {
+        return m_records.empty();
+    }
+
+    std::size_t size() const noexcept {
+        return m_records.size();
+    }
+
+    void clear() {
+        m_records.clear();
+        if (m_ways) {
+            m_ways.clear();
+        }
+    }
+
+    void report_duplicate_node(osmium::object_id_type node_id1, osmium::object_id_type node_id2, osmium::Location location) override {
+        auto& r = add(problem_type::duplicate_node);
+        r.id1 = node_id1;
+        r.id2 = node_id2;
+        r.locations[0] = location;
+    }
+
+    void report_touching_ring(osmium::object_id_type node_id, osmium::Location location) override {
+        auto& r = add(problem_type::touching_ring);
+        r.id1 = node_id;
+        r.locations[0] = location;
+    }
+
+    void report_intersection(osmium::object_id_type way1_id, osmium::Location way1_seg_start, osmium::Location way1_seg_end,
+                             osmium::object_id_type way2_id, osmium::Location way2_seg_start, osmium::Location way2_seg_end, osmium::Location intersection) override {
+        auto& r = add(problem_type::intersection);
+        r.id1 = way1_id;
+        r.id2 = way2_id;
+        r.locations = {way1_seg_start, way1_seg_end, way2_seg_start, way2_seg_end, intersection};
+    }
+
+    void report_duplicate_segment(const osmium::NodeRef& nr1, const osmium::NodeRef& nr2) override {
+        auto& r = add(problem_type::duplicate_segment);
+        r.id1 = nr1.ref();
+        r.id2 = nr2.ref();
+        r.locations[0] = nr1.location();
+        r.locations[1] = nr2.location();
+    }
+
+    void report_overlapping_segment(const osmium::NodeRef& nr1, const osmium::NodeRef& nr2) override {
+        auto& r = add(problem_type::overlapping_segment);
+        r.id1 = nr1.ref();
+        r.id2 = nr2.ref();
+        r.locations[0] = nr1.location();
+        r.locations[1] = nr2.location();
+    }
+
+    void report_ring_not_closed(const osmium::NodeRef& nr, const osmium::Way* way) override {
+        const auto offset = way ? add_way(*way) : no_way;
+        auto& r = add(problem_type::ring_not_closed);
+        r.id1 = nr.ref();
+        r.locations[0] = nr.location();
+        r.way_offset = offset;
+    }
+
+    void report_role_should_be_outer(osmium::object_id_type way_id, osmium::Location seg_start, osmium::Location seg_end) override {
+        auto& r = add(problem_type::role_should_be_outer);
+        r.id1 = way_id;
+        r.locations[0] = seg_start;
+        r.locations[1] = seg_end;
+    }
+
+    void report_role_should_be_inner(osmium::object_id_type way_id, osmium::Location seg_start, osmium::Location seg_end) override {
+        auto& r = add(problem_type::role_should_be_inner);
+        r.id1 = way_id;
+        r.locations[0] = seg_start;
+        r.locations[1] = seg_end;
+    }
+
+    void report_way_in_multiple_rings(const osmium::Way& way) override {
+        const auto offset = add_way(way);
+        add(problem_type::way_in_multiple_rings).way_offset = offset;
+    }
+
+    void report_inner_with_same_tags(const osmium::Way& way) override {
+        const auto offset = add_way(way);
+        add(problem_type::inner_with_same_tags).way_offset = offset;
+    }
+
+    void report_invalid_location(osmium::object_id_type way_id, osmium::object_id_type node_id) override {
+        auto& r = add(problem_type::invalid_location);
+        r.id1 = way_id;
+        r.id2 = node_id;
+    }
+
+    void report_duplicate_way(const osmium::Way& way) override {
+        const auto offset = add_way(way);
+        add(problem_type::duplicate_way).way_offset = offset;
+    }
+
+    void report_way(const osmium::Way& way) override {
+        const auto offset = add_way(way);
+        add(problem_type::way).way_offset = offset;
+    }
+
+    /**
+     * Append the recorded problems to out in a binary format which can be
+     * read again with load(). This includes all problem types and the
+     * copies of the ways they refer to. The format depends on the build, it
+     * is only meant for caches.
+     */
+    void save(std::string& out) const {
+        const uint64_t count = m_records.size();
+        const uint64_t ways_size = m_ways ? m_ways.committed() : 0;
+        out.append(reinterpret_cast<const char*>(&count), sizeof(count));
+        out.append(reinterpret_cast<const char*>(&ways_size), sizeof(ways_size));
+        out.append(reinterpret_cast<const char*>(m_records.data()), m_records.size() * sizeof(record));
+        if (ways_size > 0) {
+            out.append(reinterpret_cast<const char*>(m_ways.data()), ways_size);
+        }
+    }
+
+    /**
+     * Replace the recorded problems with those written by save() to data.
+     * Returns the number of bytes read.
+     */
+    std::size_t load(const char* data) {
+        uint64_t count = 0;
+        uint64_t ways_size = 0;
+        std::memcpy(&count, data, sizeof(count));
+        std::memcpy(&ways_size, data + sizeof(count), sizeof(ways_size));
+        data += sizeof(count) + sizeof(ways_size);
+
+        m_records.resize(count);
+        std::memcpy(m_records.data(), data, count * sizeof(record));
+        data += count * sizeof(record);
+
+        if (ways_size > 0) {
+            m_ways = osmium::memory::Buffer{std::max<std::size_t>(ways_size, 1024UL * 16UL), osmium::memory::Buffer::auto_grow::yes};
+            std::memcpy(m_ways.reserve_space(ways_size), data, ways_size);
+            m_ways.commit();
+        } else if (m_ways) {
+            m_ways.clear();
+        }
+
+        return sizeof(count) + sizeof(ways_size) + count * sizeof(record) + ways_size;
+    }
+
+    /**
+     * Report all recorded problems to the specified problem reporter in
+     * the order they were recorded.
+     */
+    void replay(osmium::area::ProblemReporter& reporter) const {
+        for (const auto& r : m_records) {
+            reporter.set_object(r.object_type, r.object_id);
+            reporter.set_nodes(r.nodes);
+            const auto& l = r.locations;
+            switch (r.type) {
+                case problem_type::duplicate_node:
+                    reporter.report_duplicate_node(r.id1, r.id2, l[0]);
+                    break;
+                case problem_type::touching_ring:
+                    reporter.report_touching_ring(r.id1, l[0]);
+                    break;
+                case problem_type::intersection:
+                    reporter.report_intersection(r.id1, l[0], l[1], r.id2, l[2], l[3], l[4]);
+                    break;
+                case problem_type::duplicate_segment:
+                    reporter.report_duplicate_segment(osmium::NodeRef{r.id1, l[0]}, osmium::NodeRef{r.id2, l[1]});
+                    break;
+                case problem_type::overlapping_segment:
+                    reporter.report_overlapping_segment(osmium::NodeRef{r.id1, l[0]}, osmium::NodeRef{r.id2, l[1]});
+                    break;
+                case problem_type::ring_not_closed:
+                    reporter.report_ring_not_closed(osmium::NodeRef{r.id1, l[0]}, r.way_offset == no_way ? nullptr : &way(r));
+                    break;
+                case problem_type::role_should_be_outer:
+                    reporter.report_role_should_be_outer(r.id1, l[0], l[1]);
+                    break;
+                case problem_type::role_should_be_inner:
+                    reporter.report_role_should_be_inner(r.id1, l[0], l[1]);
+                    break;
+                case problem_type::way_in_multiple_rings:
+                    reporter.report_way_in_multiple_rings(way(r));
+                    break;
+                case problem_type::inner_with_same_tags:
+                    reporter.report_inner_with_same_tags(way(r));
+                    break;
+                case problem_type::invalid_location:
+                    reporter.report_invalid_location(r.id1, r.id2);
+                    break;
+                case problem_type::duplicate_way:
+                    reporter.report_duplicate_way(way(r));
+                    break;
+                case problem_type::way:
+                    reporter.report_way(way(r));
+                    break;
+            }
+        }
+    }
+
+}; // class ProblemRecorder
+
+#endif // PROBLEM_RECORDER_HPP
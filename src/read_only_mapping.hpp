@@ -0,0 +1,51 @@
+#ifndef READ_ONLY_MAPPING_HPP
+#define READ_ONLY_MAPPING_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+
+/**
+ * Read-only memory mapping of (part of) a file.
+ */
+class ReadOnlyMapping {
+
+    void* m_addr = MAP_FAILED;
+    std::size_t m_size = 0;
+
+public:
+
+    ReadOnlyMapping(int fd, std::size_t size, std::size_t offset) :
+        m_size(size) {
+        if (size == 0) {
+            return;
+        }
+        m_addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(offset));
+        if (m_addr == MAP_FAILED) {
+            throw std::system_error{errno, std::system_category(), "mmap failed"};
+        }
+    }
+
+    ReadOnlyMapping(const ReadOnlyMapping&) = delete;
+    ReadOnlyMapping& operator=(const ReadOnlyMapping&) = delete;
+
+    ReadOnlyMapping(ReadOnlyMapping&&) = delete;
+    ReadOnlyMapping& operator=(ReadOnlyMapping&&) = delete;
+
+    ~ReadOnlyMapping() noexcept {
+        if (m_addr != MAP_FAILED) {
+            ::munmap(m_addr, m_size);
+        }
+    }
+
+    template <typename T>
+    const T* get() const noexcept {
+        return m_addr == MAP_FAILED ? nullptr : static_cast<const T*>(m_addr);
+    }
+
+}; // class ReadOnlyMapping
+
+#endif // READ_ONLY_MAPPING_HPP
@@ -0,0 +1,280 @@
+/*****************************************************************************
+
+  OSM Area Tools - Region
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "region.hpp"
+
+#include <osmium/osm/node_ref.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    __extension__ using int128_type = __int128;
+
+    using rings_type = std::vector<std::vector<osmium::Location>>;
+
+    // Sign of the cross product (q - p) x (r - p), calculated exactly.
+    int orientation(osmium::Location p, osmium::Location q, osmium::Location r) noexcept {
+        const int128_type a = static_cast<int128_type>(static_cast<int64_t>(q.x()) - p.x()) *
+                              (static_cast<int64_t>(r.y()) - p.y());
+        const int128_type b = static_cast<int128_type>(static_cast<int64_t>(q.y()) - p.y()) *
+                              (static_cast<int64_t>(r.x()) - p.x());
+        return (a > b) - (a < b);
+    }
+
+    bool overlap(const osmium::Box& a, const osmium::Box& b) noexcept {
+        return a.bottom_left().x() <= b.top_right().x() && b.bottom_left().x() <= a.top_right().x() &&
+               a.bottom_left().y() <= b.top_right().y() && b.bottom_left().y() <= a.top_right().y();
+    }
+
+    osmium::Box segment_box(osmium::Location a, osmium::Location b) noexcept {
+        osmium::Box box;
+        box.extend(a);
+        box.extend(b);
+        return box;
+    }
+
+    // Do the segments a-b and c-d cross or touch?
+    bool segments_intersect(osmium::Location a, osmium::Location b, osmium::Location c, osmium::Location d) noexcept {
+        if (!overlap(segment_box(a, b), segment_box(c, d))) {
+            return false;
+        }
+        const int d1 = orientation(c, d, a);
+        const int d2 = orientation(c, d, b);
+        const int d3 = orientation(a, b, c);
+        const int d4 = orientation(a, b, d);
+        // With overlapping boxes collinear segments always touch.
+        return d1 * d2 <= 0 && d3 * d4 <= 0;
+    }
+
+    template <typename TFunc>
+    void for_each_segment(const std::vector<const osmium::NodeRefList*>& ways, TFunc&& func) {
+        for (const auto* nodes : ways) {
+            for (std::size_t n = 1; n < nodes->size(); ++n) {
+                const auto a = (*nodes)[n - 1].location();
+                const auto b = (*nodes)[n].location();
+                if (a.valid() && b.valid()) {
+                    func(a, b);
+                }
+            }
+        }
+    }
+
+    // Is the location inside the area made from the ways? The member ways
+    // of a relation together make up the rings, so the even-odd rule is
+    // used on all segments.
+    bool in_area(const std::vector<const osmium::NodeRefList*>& ways, osmium::Location location) {
+        bool inside = false;
+        for_each_segment(ways, [&](osmium::Location a, osmium::Location b) {
+            if ((a.y() > location.y()) != (b.y() > location.y())) {
+                const int o = orientation(a, b, location);
+                if ((b.y() > a.y()) ? (o > 0) : (o < 0)) {
+                    inside = !inside;
+                }
+            }
+        });
+        return inside;
+    }
+
+    // Is the region given by its rings inside the area or does any segment
+    // of the area cross the boundary of the region? Only called when no
+    // node of the area is inside the region.
+    bool boundary_intersects(const std::vector<const osmium::NodeRefList*>& ways, const rings_type& rings, const osmium::Box& envelope) {
+        for (const auto& ring : rings) {
+            if (in_area(ways, ring.front())) {
+                return true;
+            }
+        }
+
+        bool found = false;
+        for_each_segment(ways, [&](osmium::Location a, osmium::Location b) {
+            if (found || !overlap(segment_box(a, b), envelope)) {
+                return;
+            }
+            for (const auto& ring : rings) {
+                auto prev = ring.back();
+                for (const auto& loc : ring) {
+                    if (segments_intersect(a, b, prev, loc)) {
+                        found = true;
+                        return;
+                    }
+                    prev = loc;
+                }
+            }
+        });
+        return found;
+    }
+
+    std::string trim(const std::string& str) {
+        const auto begin = str.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) {
+            return std::string{};
+        }
+        const auto end = str.find_last_not_of(" \t\r");
+        return str.substr(begin, end - begin + 1);
+    }
+
+} // anonymous namespace
+
+Region Region::from_bbox(const std::string& str) {
+    std::istringstream in{str};
+    std::array<double, 4> values{};
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        char sep = ',';
+        if ((i > 0 && !(in >> sep)) || sep != ',' || !(in >> values[i])) {
+            throw std::runtime_error{"Invalid bounding box '" + str + "'"};
+        }
+    }
+    if (!in.eof() && !(in >> std::ws).eof()) {
+        throw std::runtime_error{"Invalid bounding box '" + str + "'"};
+    }
+
+    const osmium::Location bottom_left{values[0], values[1]};
+    const osmium::Location top_right{values[2], values[3]};
+    if (!bottom_left.valid() || !top_right.valid() ||
+        bottom_left.x() > top_right.x() || bottom_left.y() > top_right.y()) {
+        throw std::runtime_error{"Invalid bounding box '" + str + "'"};
+    }
+
+    return Region{osmium::Box{bottom_left, top_right}};
+}
+
+Region Region::from_poly_file(const std::string& filename) {
+    std::ifstream file{filename};
+    if (!file) {
+        throw std::runtime_error{"Can not open region file '" + filename + "'"};
+    }
+
+    const auto error = [&filename](const char* msg) {
+        return std::runtime_error{std::string{"Invalid region file '"} + filename + "': " + msg};
+    };
+
+    std::string line;
+    if (!std::getline(file, line)) { // name of the polygon
+        throw error("empty file");
+    }
+
+    Region region{osmium::Box{}};
+    while (true) {
+        if (!std::getline(file, line)) {
+            throw error("missing END");
+        }
+        line = trim(line);
+        if (line == "END") {
+            break;
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        // line is the ring name, the coordinates follow
+        std::vector<osmium::Location> ring;
+        while (true) {
+            if (!std::getline(file, line)) {
+                throw error("missing END of ring");
+            }
+            line = trim(line);
+            if (line == "END") {
+                break;
+            }
+            std::istringstream in{line};
+            double lon = 0.0;
+            double lat = 0.0;
+            if (!(in >> lon >> lat)) {
+                throw error("invalid coordinates");
+            }
+            const osmium::Location location{lon, lat};
+            if (!location.valid()) {
+                throw error("invalid coordinates");
+            }
+            ring.push_back(location);
+            region.m_envelope.extend(location);
+        }
+        if (ring.size() < 3) {
+            throw error("ring with less than 3 points");
+        }
+        region.m_rings.push_back(std::move(ring));
+    }
+
+    if (region.m_rings.empty()) {
+        throw error("no rings");
+    }
+
+    return region;
+}
+
+bool Region::in_rings(osmium::Location location) const noexcept {
+    bool inside = false;
+    const auto x = location.x();
+    const auto y = location.y();
+
+    for (const auto& ring : m_rings) {
+        auto prev = ring.back();
+        for (const auto& loc : ring) {
+            if ((loc.y() > y) != (prev.y() > y)) {
+                // x coordinate where the segment crosses the horizontal
+                // line through the location
+                const double cross = static_cast<double>(prev.x()) +
+                                     (static_cast<double>(loc.x()) - static_cast<double>(prev.x())) *
+                                     (static_cast<double>(y) - static_cast<double>(prev.y())) /
+                                     (static_cast<double>(loc.y()) - static_cast<double>(prev.y()));
+                if (static_cast<double>(x) < cross) {
+                    inside = !inside;
+                }
+            }
+            prev = loc;
+        }
+    }
+
+    return inside;
+}
+
+bool Region::contains_any(const osmium::NodeRefList& nodes) const noexcept {
+    return std::any_of(nodes.cbegin(), nodes.cend(), [this](const osmium::NodeRef& node_ref) {
+        return node_ref.location().valid() && contains(node_ref.location());
+    });
+}
+
+bool Region::intersects(const std::vector<const osmium::NodeRefList*>& ways) const {
+    osmium::Box envelope;
+    for (const auto* nodes : ways) {
+        for (const auto& node_ref : *nodes) {
+            envelope.extend(node_ref.location());
+        }
+    }
+    if (!envelope.valid() || !overlap(envelope, m_envelope)) {
+        return false;
+    }
+
+    if (std::any_of(ways.cbegin(), ways.cend(), [this](const osmium::NodeRefList* nodes) {
+        return contains_any(*nodes);
+    })) {
+        return true;
+    }
+
+    if (m_rings.empty()) {
+        const auto bottom_left = m_envelope.bottom_left();
+        const auto top_right = m_envelope.top_right();
+        const rings_type box{{bottom_left,
+                              osmium::Location{top_right.x(), bottom_left.y()},
+                              top_right,
+                              osmium::Location{bottom_left.x(), top_right.y()}}};
+        return boundary_intersects(ways, box, m_envelope);
+    }
+
+    return boundary_intersects(ways, m_rings, m_envelope);
+}
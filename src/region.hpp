@@ -0,0 +1,67 @@
+#ifndef REGION_HPP
+#define REGION_HPP
+
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node_ref_list.hpp>
+
+#include <string>
+#include <vector>
+
+/**
+ * A geographic region given as bounding box or as polygon (possibly with
+ * holes and several outer rings). Used to restrict the areas built to
+ * those intersecting the region.
+ */
+class Region {
+
+    osmium::Box m_envelope;
+
+    // All rings (outer and inner), point in polygon uses the even-odd rule.
+    std::vector<std::vector<osmium::Location>> m_rings;
+
+    bool in_rings(osmium::Location location) const noexcept;
+
+public:
+
+    explicit Region(const osmium::Box& box) :
+        m_envelope(box) {
+    }
+
+    /**
+     * Create region from a bounding box given as "MINLON,MINLAT,MAXLON,MAXLAT".
+     * Throws std::runtime_error if the string is invalid.
+     */
+    static Region from_bbox(const std::string& str);
+
+    /**
+     * Create region from a polygon file in the Osmosis poly format. Throws
+     * std::runtime_error if the file can't be read or is invalid.
+     */
+    static Region from_poly_file(const std::string& filename);
+
+    const osmium::Box& envelope() const noexcept {
+        return m_envelope;
+    }
+
+    bool contains(osmium::Location location) const noexcept {
+        return m_envelope.contains(location) && (m_rings.empty() || in_rings(location));
+    }
+
+    /**
+     * Is any of the nodes in the list inside the region?
+     */
+    bool contains_any(const osmium::NodeRefList& nodes) const noexcept;
+
+    /**
+     * Can the area made from these ways (a closed way or the member ways
+     * of a relation) intersect the region? This is the case if a node is
+     * inside the region, a segment crosses the boundary of the region, or
+     * the region is inside the area. Segments touching the boundary count
+     * as crossing it, so this errs on the side of building the area.
+     */
+    bool intersects(const std::vector<const osmium::NodeRefList*>& ways) const;
+
+}; // class Region
+
+#endif // REGION_HPP
@@ -0,0 +1,104 @@
+/*****************************************************************************
+
+  OSM Area Tools - Spilling relations
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "relation_spill.hpp"
+
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/pbf_output.hpp>
+#include <osmium/io/writer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/item_type.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+    std::size_t estimated_size(const osmium::Relation& relation) {
+        const auto ways = std::count_if(relation.members().cbegin(), relation.members().cend(), [](const osmium::RelationMember& member) {
+            return member.type() == osmium::item_type::way;
+        });
+        return static_cast<std::size_t>(ways) * RelationSpill::estimated_member_size;
+    }
+
+} // anonymous namespace
+
+RelationSpill::RelationSpill(std::size_t max_pending) :
+    m_max_pending(max_pending) {
+    const char* tmpdir = std::getenv("TMPDIR");
+    std::string directory{tmpdir ? tmpdir : "/tmp"};
+    directory += "/oat-spill-XXXXXX";
+
+    std::vector<char> name(directory.cbegin(), directory.cend());
+    name.push_back('\0');
+    if (!::mkdtemp(name.data())) {
+        throw std::system_error{errno, std::system_category(), "Can not create temporary directory '" + directory + "'"};
+    }
+    m_directory = name.data();
+}
+
+RelationSpill::~RelationSpill() noexcept {
+    ::unlink(spill_file(m_round).c_str());
+    ::unlink(spill_file(m_round + 1).c_str());
+    ::rmdir(m_directory.c_str());
+}
+
+std::string RelationSpill::spill_file(int round) const {
+    return m_directory + "/relations-" + std::to_string(round) + ".osm.pbf";
+}
+
+void RelationSpill::read_relations(const osmium::io::File& input_file,
+                                   const relation_filter_type& filter,
+                                   const std::function<void(const osmium::memory::Buffer&)>& callback) {
+    const osmium::io::File source = m_round == 0 ? input_file : osmium::io::File{spill_file(m_round), "pbf"};
+
+    std::unique_ptr<osmium::io::Writer> writer;
+    osmium::memory::Buffer used{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+    std::size_t pending = 0;
+    m_spilled = 0;
+
+    osmium::io::Reader reader{source, osmium::osm_entity_bits::relation};
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        for (const auto& relation : buffer.select<osmium::Relation>()) {
+            if (!filter(relation)) {
+                continue;
+            }
+
+            const auto size = estimated_size(relation);
+            if (pending == 0 || pending + size <= m_max_pending) {
+                pending += size;
+                used.add_item(relation);
+                used.commit();
+                continue;
+            }
+
+            if (!writer) {
+                writer = std::make_unique<osmium::io::Writer>(osmium::io::File{spill_file(m_round + 1), "pbf"}, osmium::io::overwrite::allow);
+            }
+            (*writer)(relation);
+            ++m_spilled;
+        }
+        callback(used);
+        used.clear();
+    }
+    reader.close();
+
+    if (writer) {
+        writer->close();
+    }
+
+    if (m_round > 0) {
+        ::unlink(spill_file(m_round).c_str());
+    }
+}
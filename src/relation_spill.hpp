@@ -0,0 +1,105 @@
+#ifndef RELATION_SPILL_HPP
+#define RELATION_SPILL_HPP
+
+#include "update_state.hpp"
+
+#include <osmium/io/file.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/visitor.hpp>
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+/**
+ * Limits the number of relations the multipolygon manager works on at the
+ * same time so that their member ways stored in the second pass fit into
+ * a memory budget. The relations that don't fit are spilled into a
+ * temporary file in the first pass. Once the second pass is done, another
+ * manager gets the spilled relations and the ways are read again for
+ * them. This is repeated until there are no more spilled relations.
+ *
+ * The memory needed by a relation is estimated from the number of its
+ * member ways, the ways themselves are not known in the first pass. The
+ * first relation of each round is always used, so there is progress even
+ * if a single relation is larger than the budget.
+ *
+ * The spill files are kept in a temporary directory in $TMPDIR (or /tmp)
+ * which is removed when this object goes away.
+ */
+class RelationSpill {
+
+    std::string m_directory;
+    std::size_t m_max_pending;
+    int m_round = 0;
+    std::size_t m_spilled = 0;
+
+    std::string spill_file(int round) const;
+
+    void read_relations(const osmium::io::File& input_file,
+                        const relation_filter_type& filter,
+                        const std::function<void(const osmium::memory::Buffer&)>& callback);
+
+public:
+
+    /**
+     * Estimated number of bytes needed for each member way of a relation
+     * while it is waiting for its members.
+     */
+    enum : std::size_t {
+        estimated_member_size = 512
+    };
+
+    explicit RelationSpill(std::size_t max_pending);
+
+    RelationSpill(const RelationSpill&) = delete;
+    RelationSpill& operator=(const RelationSpill&) = delete;
+
+    RelationSpill(RelationSpill&&) = delete;
+    RelationSpill& operator=(RelationSpill&&) = delete;
+
+    ~RelationSpill() noexcept;
+
+    /**
+     * Do the first pass for the manager. In the first round the relations
+     * are read from the input file, later from the spill file written in
+     * the round before. Relations that don't fit into the budget are
+     * written into the spill file for the next round.
+     */
+    template <typename TManager>
+    void read_relations(const osmium::io::File& input_file, TManager& manager) {
+        read_relations(input_file, [&manager](const osmium::Relation& relation) {
+            return manager.new_relation(relation);
+        }, [&manager](const osmium::memory::Buffer& buffer) {
+            osmium::apply(buffer, manager);
+        });
+        manager.prepare_for_lookup();
+    }
+
+    /**
+     * Number of relations spilled in the current round.
+     */
+    std::size_t spilled() const noexcept {
+        return m_spilled;
+    }
+
+    int round() const noexcept {
+        return m_round;
+    }
+
+    /**
+     * Go to the next round. Returns false if there is nothing to do,
+     * because no relations were spilled in the current round.
+     */
+    bool next_round() noexcept {
+        if (m_spilled == 0) {
+            return false;
+        }
+        ++m_round;
+        return true;
+    }
+
+}; // class RelationSpill
+
+#endif // RELATION_SPILL_HPP
@@ -0,0 +1,26 @@
+#ifndef SPATIALITE_HPP
+#define SPATIALITE_HPP
+
+#include <sqlite.hpp>
+
+/**
+ * Load the Spatialite extension into the database connection if it is
+ * available. If GDAL was compiled with Spatialite support, the geometry
+ * tables it creates have triggers calling Spatialite functions, so any
+ * insert or update on those tables will fail without the extension. If
+ * the extension is not available, GDAL didn't have it either and there are
+ * no such triggers, so failing to load it is not an error.
+ */
+inline void load_spatialite(Sqlite::Database& db) noexcept {
+    sqlite3* handle = db.get_sqlite3();
+    if (sqlite3_enable_load_extension(handle, 1) != SQLITE_OK) {
+        return;
+    }
+    char* error = nullptr;
+    if (sqlite3_load_extension(handle, "mod_spatialite", nullptr, &error) != SQLITE_OK) {
+        sqlite3_free(error);
+    }
+    sqlite3_enable_load_extension(handle, 0);
+}
+
+#endif // SPATIALITE_HPP
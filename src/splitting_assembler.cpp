@@ -0,0 +1,307 @@
+/*****************************************************************************
+
+  OSM Area Tools - Splitting assembler
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "splitting_assembler.hpp"
+#include "problem_recorder.hpp"
+
+#include <osmium/area/assembler.hpp>
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/osm/area.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/types.hpp>
+
+#include <algorithm>
+#include <future>
+#include <iterator>
+#include <numeric>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    // A set of member ways, given as indexes into the list of members.
+    struct part_type {
+        std::vector<std::size_t> members;
+        osmium::Box box;
+        std::size_t nodes = 0;
+    };
+
+    struct part_result {
+        osmium::memory::Buffer buffer{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+        osmium::area::area_stats stats{};
+        bool okay = false;
+    };
+
+    bool overlap(const osmium::Box& a, const osmium::Box& b) noexcept {
+        return a.bottom_left().x() <= b.top_right().x() && b.bottom_left().x() <= a.top_right().x() &&
+               a.bottom_left().y() <= b.top_right().y() && b.bottom_left().y() <= a.top_right().y();
+    }
+
+    std::size_t find_root(std::vector<std::size_t>& parents, std::size_t n) noexcept {
+        while (parents[n] != n) {
+            parents[n] = parents[parents[n]];
+            n = parents[n];
+        }
+        return n;
+    }
+
+    // Merge parts with overlapping bounding boxes. The parts are sorted by
+    // the west side of their boxes, so only the parts reaching far enough
+    // east have to be checked. Merging makes boxes larger, so this is
+    // repeated until nothing changes.
+    void merge_overlapping(std::vector<part_type>& parts) {
+        bool merged = true;
+        while (merged && parts.size() > 1) {
+            merged = false;
+            std::sort(parts.begin(), parts.end(), [](const part_type& lhs, const part_type& rhs) {
+                return lhs.box.bottom_left().x() < rhs.box.bottom_left().x();
+            });
+
+            std::vector<part_type> result;
+            std::vector<std::size_t> active;
+            for (auto& part : parts) {
+                active.erase(std::remove_if(active.begin(), active.end(), [&](std::size_t n) {
+                    return result[n].box.top_right().x() < part.box.bottom_left().x();
+                }), active.end());
+
+                const auto it = std::find_if(active.cbegin(), active.cend(), [&](std::size_t n) {
+                    return overlap(result[n].box, part.box);
+                });
+                if (it == active.cend()) {
+                    active.push_back(result.size());
+                    result.push_back(std::move(part));
+                    continue;
+                }
+
+                auto& target = result[*it];
+                target.box.extend(part.box);
+                target.nodes += part.nodes;
+                target.members.insert(target.members.end(), part.members.cbegin(), part.members.cend());
+                merged = true;
+            }
+            parts = std::move(result);
+        }
+    }
+
+    // Split the member ways into parts which can be assembled separately.
+    // Returns no parts if there are ways without nodes or with invalid
+    // locations, the assembler has to report those.
+    std::vector<part_type> find_parts(const std::vector<const osmium::Way*>& members) {
+        std::vector<std::size_t> parents(members.size());
+        std::iota(parents.begin(), parents.end(), 0);
+
+        std::unordered_map<osmium::object_id_type, std::size_t> ends;
+        for (std::size_t n = 0; n < members.size(); ++n) {
+            const auto& nodes = members[n]->nodes();
+            if (nodes.empty()) {
+                return {};
+            }
+            for (const auto& node_ref : nodes) {
+                if (!node_ref.location().valid()) {
+                    return {};
+                }
+            }
+            for (const auto id : {nodes.front().ref(), nodes.back().ref()}) {
+                const auto result = ends.emplace(id, n);
+                if (!result.second) {
+                    parents[find_root(parents, n)] = find_root(parents, result.first->second);
+                }
+            }
+        }
+
+        std::vector<part_type> parts;
+        std::unordered_map<std::size_t, std::size_t> part_of_root;
+        for (std::size_t n = 0; n < members.size(); ++n) {
+            const auto result = part_of_root.emplace(find_root(parents, n), parts.size());
+            if (result.second) {
+                parts.emplace_back();
+            }
+            auto& part = parts[result.first->second];
+            part.members.push_back(n);
+            part.box.extend(members[n]->envelope());
+            part.nodes += members[n]->nodes().size();
+        }
+
+        merge_overlapping(parts);
+        return parts;
+    }
+
+    // Distribute the parts over at most num_groups groups with about the
+    // same number of nodes each. Any number of parts can be assembled
+    // together, they don't interact. The members of each group are sorted
+    // so that they are in the same order as in the relation.
+    std::vector<std::vector<std::size_t>> group_parts(std::vector<part_type>& parts, std::size_t num_groups) {
+        std::sort(parts.begin(), parts.end(), [](const part_type& lhs, const part_type& rhs) {
+            return lhs.nodes > rhs.nodes;
+        });
+
+        std::vector<std::vector<std::size_t>> groups(std::min(num_groups, parts.size()));
+        std::vector<std::size_t> nodes(groups.size());
+        for (const auto& part : parts) {
+            const auto n = static_cast<std::size_t>(std::min_element(nodes.cbegin(), nodes.cend()) - nodes.cbegin());
+            groups[n].insert(groups[n].end(), part.members.cbegin(), part.members.cend());
+            nodes[n] += part.nodes;
+        }
+
+        for (auto& group : groups) {
+            std::sort(group.begin(), group.end());
+        }
+
+        return groups;
+    }
+
+    // Assemble the area from the members in the group using a copy of the
+    // relation with only those members. The assembler expects the member
+    // ways in the order of the members in the relation.
+    part_result assemble_group(const osmium::area::AssemblerConfig& config,
+                               const osmium::Relation& relation,
+                               const std::vector<const osmium::RelationMember*>& relation_members,
+                               const std::vector<const osmium::Way*>& members,
+                               const std::vector<std::size_t>& group) {
+        osmium::memory::Buffer buffer{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+        {
+            osmium::builder::RelationBuilder builder{buffer};
+            builder.set_id(relation.id());
+            builder.set_version(relation.version());
+            builder.set_changeset(relation.changeset());
+            builder.set_timestamp(relation.timestamp());
+            builder.set_uid(relation.uid());
+            builder.set_user(relation.user());
+            builder.add_item(relation.tags());
+
+            osmium::builder::RelationMemberListBuilder member_builder{builder};
+            for (const auto n : group) {
+                member_builder.add_member(osmium::item_type::way, relation_members[n]->ref(), relation_members[n]->role());
+            }
+        }
+        buffer.commit();
+
+        std::vector<const osmium::Way*> ways;
+        ways.reserve(group.size());
+        for (const auto n : group) {
+            ways.push_back(members[n]);
+        }
+
+        // Problems are only recorded to find out whether there were any.
+        ProblemRecorder problems;
+        osmium::area::AssemblerConfig group_config{config};
+        group_config.problem_reporter = &problems;
+
+        part_result result;
+        osmium::area::Assembler assembler{group_config};
+        assembler(buffer.get<osmium::Relation>(0), ways, result.buffer);
+        result.stats = assembler.stats();
+
+        const auto areas = result.buffer.select<osmium::Area>();
+        result.okay = problems.empty() &&
+                      std::distance(areas.cbegin(), areas.cend()) == 1 &&
+                      areas.cbegin()->num_rings().first > 0;
+
+        return result;
+    }
+
+} // anonymous namespace
+
+bool SplittingAssembler::assemble_parts(const osmium::Relation& relation, const std::vector<const osmium::Way*>& members, osmium::memory::Buffer& out_buffer) {
+    std::vector<const osmium::RelationMember*> relation_members;
+    for (const auto& member : relation.members()) {
+        if (member.ref() != 0) {
+            relation_members.push_back(&member);
+        }
+    }
+    if (relation_members.size() != members.size()) {
+        return false;
+    }
+
+    auto parts = find_parts(members);
+    if (parts.size() < 2) {
+        return false;
+    }
+
+    const auto groups = group_parts(parts, static_cast<std::size_t>(m_config.pool->num_threads()));
+
+    std::vector<std::future<part_result>> futures;
+    futures.reserve(groups.size());
+    for (const auto& group : groups) {
+        futures.push_back(m_config.pool->submit([this, &relation, &relation_members, &members, &group]() {
+            return assemble_group(m_config, relation, relation_members, members, group);
+        }));
+    }
+
+    // The tasks use the relation and the members, wait for all of them
+    // before anything can throw.
+    for (auto& future : futures) {
+        future.wait();
+    }
+
+    std::vector<part_result> results;
+    results.reserve(futures.size());
+    for (auto& future : futures) {
+        results.push_back(future.get());
+    }
+
+    if (!std::all_of(results.cbegin(), results.cend(), [](const part_result& result) {
+        return result.okay;
+    })) {
+        return false;
+    }
+
+    {
+        const auto& first = results.front().buffer.get<osmium::Area>(0);
+        osmium::builder::AreaBuilder builder{out_buffer};
+        builder.set_id(first.id());
+        builder.set_version(first.version());
+        builder.set_changeset(first.changeset());
+        builder.set_timestamp(first.timestamp());
+        builder.set_uid(first.uid());
+        builder.set_user(first.user());
+        builder.add_item(first.tags());
+
+        for (const auto& result : results) {
+            const auto& area = result.buffer.get<osmium::Area>(0);
+            for (auto it = area.cbegin(); it != area.cend(); ++it) {
+                if (it->type() == osmium::item_type::outer_ring || it->type() == osmium::item_type::inner_ring) {
+                    builder.add_item(*it);
+                }
+            }
+        }
+    }
+    out_buffer.commit();
+
+    for (const auto& result : results) {
+        m_stats += result.stats;
+    }
+
+    // Every part was counted as a relation by its assembler.
+    m_stats.from_relations -= results.size() - 1;
+
+    return true;
+}
+
+bool SplittingAssembler::operator()(const osmium::Way& way, osmium::memory::Buffer& out_buffer) {
+    osmium::area::Assembler assembler{m_config};
+    const bool result = assembler(way, out_buffer);
+    m_stats += assembler.stats();
+    return result;
+}
+
+bool SplittingAssembler::operator()(const osmium::Relation& relation, const std::vector<const osmium::Way*>& members, osmium::memory::Buffer& out_buffer) {
+    if (m_config.pool &&
+        m_config.create_new_style_polygons &&
+        members.size() >= m_config.min_members &&
+        assemble_parts(relation, members, out_buffer)) {
+        return true;
+    }
+
+    osmium::area::Assembler assembler{m_config};
+    const bool result = assembler(relation, members, out_buffer);
+    m_stats += assembler.stats();
+    return result;
+}
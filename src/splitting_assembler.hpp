@@ -0,0 +1,71 @@
+#ifndef SPLITTING_ASSEMBLER_HPP
+#define SPLITTING_ASSEMBLER_HPP
+
+#include <osmium/area/assembler_config.hpp>
+#include <osmium/area/stats.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/thread/pool.hpp>
+
+#include <cstddef>
+#include <vector>
+
+struct splitting_assembler_config : public osmium::area::AssemblerConfig {
+
+    /**
+     * Pool used for assembling the parts of large relations. If this is
+     * nullptr, relations are never split.
+     */
+    osmium::thread::Pool* pool = nullptr;
+
+    /**
+     * Only relations with at least this many member ways are split.
+     */
+    std::size_t min_members = 1000;
+
+}; // struct splitting_assembler_config
+
+/**
+ * Assembler for areas which can assemble the rings of a large relation in
+ * several threads. Everything else is done by the osmium::area::Assembler.
+ *
+ * The member ways are split into parts which can't interact: Ways sharing
+ * an end node are in the same part and parts with overlapping bounding
+ * boxes are merged. Rings from different parts can't intersect or touch
+ * and no ring of one part can be inside a ring of another part, so each
+ * part can be assembled on its own and the rings of all parts together
+ * make up the area. Typical candidates are boundaries of countries with
+ * many islands or large forests made of many separate patches.
+ *
+ * If any part has a problem or doesn't give an area, the whole relation
+ * is assembled again in the usual way, so the problems reported and the
+ * areas created for broken relations are the same as with the osmium
+ * assembler.
+ */
+class SplittingAssembler {
+
+    splitting_assembler_config m_config;
+    osmium::area::area_stats m_stats;
+
+    bool assemble_parts(const osmium::Relation& relation, const std::vector<const osmium::Way*>& members, osmium::memory::Buffer& out_buffer);
+
+public:
+
+    using config_type = splitting_assembler_config;
+
+    explicit SplittingAssembler(const config_type& config) :
+        m_config(config) {
+    }
+
+    bool operator()(const osmium::Way& way, osmium::memory::Buffer& out_buffer);
+
+    bool operator()(const osmium::Relation& relation, const std::vector<const osmium::Way*>& members, osmium::memory::Buffer& out_buffer);
+
+    const osmium::area::area_stats& stats() const noexcept {
+        return m_stats;
+    }
+
+}; // class SplittingAssembler
+
+#endif // SPLITTING_ASSEMBLER_HPP
@@ -0,0 +1,774 @@
+/*****************************************************************************
+
+  OSM Area Tools - Update state
+
+  https://github.com/osmcode/osm-area-tools
+
+*****************************************************************************/
+
+#include "update_state.hpp"
+#include "oat.hpp"
+#include "read_only_mapping.hpp"
+#include "spatialite.hpp"
+
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/pbf_output.hpp>
+#include <osmium/io/writer.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/object_pointer_collection.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/object_comparisons.hpp>
+#include <osmium/visitor.hpp>
+
+#include <sqlite.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    constexpr const char* ways_file_name = "ways.osm.pbf";
+    constexpr const char* relations_file_name = "relations.osm.pbf";
+    constexpr const char* node_ways_file_name = "node_ways.idx";
+    constexpr const char* locations_file_name = "locations.idx";
+    constexpr const char* filter_file_name = "filter";
+
+    // Suffix of the state files written by prepare_update().
+    constexpr const char* new_suffix = ".new";
+
+    // Sort at most this many node/way pairs in memory (1GB).
+    constexpr const std::size_t max_pairs_in_memory = 64UL * 1024UL * 1024UL;
+
+    // Number of node/way pairs read or written at once.
+    constexpr const std::size_t pairs_per_block = 64UL * 1024UL;
+
+    std::string state_file(const std::string& directory, const char* name) {
+        return directory + '/' + name;
+    }
+
+    std::size_t file_size(int fd) {
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) {
+            throw std::system_error{errno, std::system_category(), "fstat failed"};
+        }
+        return static_cast<std::size_t>(st.st_size);
+    }
+
+    int open_for_reading(const std::string& filename) {
+        const int fd = ::open(filename.c_str(), O_RDONLY); // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+        if (fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can not open '"} + filename + "'"};
+        }
+        return fd;
+    }
+
+    void write_pairs(int fd, const std::vector<node_way>& pairs) {
+        osmium::io::detail::reliable_write(fd, reinterpret_cast<const char*>(pairs.data()), pairs.size() * sizeof(node_way));
+    }
+
+    /**
+     * Sequential reading of a file with sorted node/way pairs.
+     */
+    class NodeWaysReader {
+
+        int m_fd;
+        std::vector<node_way> m_pairs;
+        std::size_t m_pos = 0;
+
+        bool fill() {
+            m_pairs.resize(pairs_per_block);
+            auto* data = reinterpret_cast<char*>(m_pairs.data());
+            std::size_t size = 0;
+            while (size < pairs_per_block * sizeof(node_way)) {
+                const auto length = ::read(m_fd, data + size, pairs_per_block * sizeof(node_way) - size);
+                if (length < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::system_error{errno, std::system_category(), "Read error"};
+                }
+                if (length == 0) {
+                    break;
+                }
+                size += static_cast<std::size_t>(length);
+            }
+            m_pairs.resize(size / sizeof(node_way));
+            m_pos = 0;
+            return !m_pairs.empty();
+        }
+
+    public:
+
+        explicit NodeWaysReader(const std::string& filename) :
+            m_fd(open_for_reading(filename)) {
+        }
+
+        NodeWaysReader(const NodeWaysReader&) = delete;
+        NodeWaysReader& operator=(const NodeWaysReader&) = delete;
+
+        NodeWaysReader(NodeWaysReader&&) = delete;
+        NodeWaysReader& operator=(NodeWaysReader&&) = delete;
+
+        ~NodeWaysReader() noexcept {
+            ::close(m_fd);
+        }
+
+        bool next(node_way& pair) {
+            if (m_pos == m_pairs.size() && !fill()) {
+                return false;
+            }
+            pair = m_pairs[m_pos++];
+            return true;
+        }
+
+    }; // class NodeWaysReader
+
+    void merge_node_ways_files(const std::vector<std::string>& inputs, const std::string& output) {
+        using entry = std::pair<node_way, std::size_t>;
+        const auto greater = [](const entry& lhs, const entry& rhs) {
+            return rhs.first < lhs.first;
+        };
+        std::priority_queue<entry, std::vector<entry>, decltype(greater)> queue{greater};
+
+        std::vector<std::unique_ptr<NodeWaysReader>> readers;
+        for (const auto& input : inputs) {
+            readers.push_back(std::make_unique<NodeWaysReader>(input));
+            node_way pair{};
+            if (readers.back()->next(pair)) {
+                queue.emplace(pair, readers.size() - 1);
+            }
+        }
+
+        const int fd = osmium::io::detail::open_for_writing(output, osmium::io::overwrite::allow);
+        std::vector<node_way> pairs;
+        pairs.reserve(pairs_per_block);
+
+        bool first = true;
+        node_way last{};
+        while (!queue.empty()) {
+            const auto top = queue.top();
+            queue.pop();
+            if (first || !(last == top.first)) {
+                if (pairs.size() == pairs_per_block) {
+                    write_pairs(fd, pairs);
+                    pairs.clear();
+                }
+                pairs.push_back(top.first);
+                last = top.first;
+                first = false;
+            }
+            node_way pair{};
+            if (readers[top.second]->next(pair)) {
+                queue.emplace(pair, top.second);
+            }
+        }
+
+        write_pairs(fd, pairs);
+        if (::close(fd) != 0) {
+            throw std::system_error{errno, std::system_category(), "Close failed"};
+        }
+    }
+
+    /**
+     * The node to way index mapped into memory.
+     */
+    class NodeWaysIndex {
+
+        int m_fd;
+        std::size_t m_count;
+        ReadOnlyMapping m_mapping;
+
+    public:
+
+        explicit NodeWaysIndex(const std::string& filename) :
+            m_fd(open_for_reading(filename)),
+            m_count(file_size(m_fd) / sizeof(node_way)),
+            m_mapping(m_fd, m_count * sizeof(node_way), 0) {
+        }
+
+        NodeWaysIndex(const NodeWaysIndex&) = delete;
+        NodeWaysIndex& operator=(const NodeWaysIndex&) = delete;
+
+        NodeWaysIndex(NodeWaysIndex&&) = delete;
+        NodeWaysIndex& operator=(NodeWaysIndex&&) = delete;
+
+        ~NodeWaysIndex() noexcept {
+            ::close(m_fd);
+        }
+
+        template <typename TFunc>
+        void for_each_way(osmium::object_id_type node_id, TFunc&& func) const {
+            const auto* begin = m_mapping.get<node_way>();
+            const auto* end = begin + m_count;
+            const node_way key{static_cast<uint64_t>(node_id), 0};
+            for (const auto* it = std::lower_bound(begin, end, key); it != end && it->node == key.node; ++it) {
+                std::forward<TFunc>(func)(static_cast<osmium::object_id_type>(it->way));
+            }
+        }
+
+    }; // class NodeWaysIndex
+
+    /**
+     * Merges a sorted list of changed objects into a stream of sorted
+     * objects of the same type. The function is called for each object in
+     * the result, changed objects (including deleted ones) are marked.
+     */
+    template <typename T>
+    class ChangeMerger {
+
+        typename std::vector<const T*>::const_iterator m_it;
+        typename std::vector<const T*>::const_iterator m_end;
+
+    public:
+
+        explicit ChangeMerger(const std::vector<const T*>& changes) :
+            m_it(changes.cbegin()),
+            m_end(changes.cend()) {
+        }
+
+        template <typename TFunc>
+        void next(const T& object, TFunc&& func) {
+            while (m_it != m_end && (*m_it)->id() < object.id()) {
+                func(**m_it++, true);
+            }
+            if (m_it != m_end && (*m_it)->id() == object.id()) {
+                func(**m_it++, true);
+                return;
+            }
+            func(object, false);
+        }
+
+        template <typename TFunc>
+        void finish(TFunc&& func) {
+            while (m_it != m_end) {
+                func(**m_it++, true);
+            }
+        }
+
+    }; // class ChangeMerger
+
+    template <typename T>
+    void sort_unique(std::vector<T>& data) {
+        std::sort(data.begin(), data.end());
+        data.erase(std::unique(data.begin(), data.end()), data.end());
+    }
+
+    template <typename T>
+    bool contains(const std::vector<T>& sorted_data, const T& value) {
+        return std::binary_search(sorted_data.cbegin(), sorted_data.cend(), value);
+    }
+
+    osmium::memory::Buffer read_file(const std::string& filename) {
+        osmium::memory::Buffer result{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+        osmium::io::Reader reader{filename};
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            result.add_buffer(buffer);
+            result.commit();
+        }
+        reader.close();
+        return result;
+    }
+
+    std::string quote(const std::string& identifier, char quote_char) {
+        std::string result{quote_char};
+        for (const char c : identifier) {
+            result += c;
+            if (c == quote_char) {
+                result += c;
+            }
+        }
+        result += quote_char;
+        return result;
+    }
+
+    // Columns of a table, the primary key column (ogc_fid in tables created
+    // by GDAL) is left out, because it is different in each database.
+    std::vector<std::string> table_columns(Sqlite::Database& db, const std::string& schema, const std::string& table) {
+        std::vector<std::string> columns;
+        const std::string sql = "PRAGMA " + schema + ".table_info(" + quote(table, '"') + ");";
+        Sqlite::Statement query{db, sql.c_str()};
+        while (query.read()) {
+            if (query.get_int(5) == 0) {
+                columns.push_back(query.get_text(1));
+            }
+        }
+        return columns;
+    }
+
+    bool has_column(const std::vector<std::string>& columns, const char* name) {
+        return std::find(columns.cbegin(), columns.cend(), name) != columns.cend();
+    }
+
+    void delete_rows(Sqlite::Database& db, const std::string& table, const char* type_column, const char* id_column, const update_result& update) {
+        const std::string sql = "DELETE FROM main." + quote(table, '"') + " WHERE " + type_column + " = ? AND " + id_column + " = ?;";
+        Sqlite::Statement statement{db, sql.c_str()};
+        for (const auto id : update.ways) {
+            statement.bind_text("w").bind_int64(id).execute();
+        }
+        for (const auto id : update.relations) {
+            statement.bind_text("r").bind_int64(id).execute();
+        }
+    }
+
+    void copy_rows(Sqlite::Database& db, const std::string& table) {
+        const auto columns = table_columns(db, "upd", table);
+        if (columns.empty()) {
+            return;
+        }
+
+        std::string column_list;
+        for (const auto& column : columns) {
+            if (!column_list.empty()) {
+                column_list += ", ";
+            }
+            column_list += quote(column, '"');
+        }
+
+        db.exec("INSERT INTO main." + quote(table, '"') + " (" + column_list + ") SELECT " + column_list + " FROM upd." + quote(table, '"') + ";");
+    }
+
+} // anonymous namespace
+
+DenseLocationFile::DenseLocationFile(const std::string& filename) :
+    m_fd(::open(filename.c_str(), O_RDWR | O_CREAT, 0666)) { // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+    if (m_fd < 0) {
+        throw std::system_error{errno, std::system_category(), std::string{"Can not open '"} + filename + "'"};
+    }
+    const auto size = file_size(m_fd) / sizeof(stored_location);
+    if (size > 0) {
+        grow(size);
+    }
+}
+
+DenseLocationFile::~DenseLocationFile() noexcept {
+    if (m_data) {
+        ::munmap(m_data, m_size * sizeof(stored_location));
+    }
+    ::close(m_fd);
+}
+
+void DenseLocationFile::grow(std::size_t min_size) {
+    constexpr const std::size_t initial_size = 1024UL * 1024UL;
+    const auto new_size = std::max({min_size, m_size * 2, initial_size});
+
+    if (::ftruncate(m_fd, static_cast<off_t>(new_size * sizeof(stored_location))) != 0) {
+        throw std::system_error{errno, std::system_category(), "Could not grow location file"};
+    }
+
+    if (m_data) {
+        ::munmap(m_data, m_size * sizeof(stored_location));
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    void* addr = ::mmap(nullptr, new_size * sizeof(stored_location), PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (addr == MAP_FAILED) {
+        throw std::system_error{errno, std::system_category(), "mmap failed"};
+    }
+    m_data = static_cast<stored_location*>(addr);
+    m_size = new_size;
+}
+
+void DenseLocationFile::set(osmium::object_id_type id, osmium::Location location) {
+    if (id <= 0) {
+        return;
+    }
+    const auto uid = static_cast<std::size_t>(id);
+    if (uid >= m_size) {
+        grow(uid + 1);
+    }
+    m_data[uid].x = location.x() ^ osmium::Location::undefined_coordinate;
+    m_data[uid].y = location.y() ^ osmium::Location::undefined_coordinate;
+}
+
+osmium::Location DenseLocationFile::get(osmium::object_id_type id) const noexcept {
+    if (id <= 0 || static_cast<std::size_t>(id) >= m_size) {
+        return osmium::Location{};
+    }
+    const auto& stored = m_data[static_cast<std::size_t>(id)];
+    return osmium::Location{static_cast<int32_t>(stored.x ^ osmium::Location::undefined_coordinate),
+                            static_cast<int32_t>(stored.y ^ osmium::Location::undefined_coordinate)};
+}
+
+NodeWaysWriter::NodeWaysWriter(std::string filename) :
+    m_filename(std::move(filename)) {
+}
+
+void NodeWaysWriter::write_run() {
+    sort_unique(m_pairs);
+    m_runs.push_back(m_filename + ".run" + std::to_string(m_runs.size()));
+    const int fd = osmium::io::detail::open_for_writing(m_runs.back(), osmium::io::overwrite::allow);
+    write_pairs(fd, m_pairs);
+    if (::close(fd) != 0) {
+        throw std::system_error{errno, std::system_category(), "Close failed"};
+    }
+    m_pairs.clear();
+}
+
+void NodeWaysWriter::add(const osmium::Way& way) {
+    for (const auto& node_ref : way.nodes()) {
+        if (node_ref.ref() > 0) {
+            m_pairs.push_back(node_way{static_cast<uint64_t>(node_ref.ref()), static_cast<uint64_t>(way.id())});
+        }
+    }
+    if (m_pairs.size() >= max_pairs_in_memory) {
+        write_run();
+    }
+}
+
+void NodeWaysWriter::close(const std::vector<std::string>& extra_inputs) {
+    if (m_runs.empty() && extra_inputs.empty()) {
+        sort_unique(m_pairs);
+        const int fd = osmium::io::detail::open_for_writing(m_filename, osmium::io::overwrite::allow);
+        write_pairs(fd, m_pairs);
+        if (::close(fd) != 0) {
+            throw std::system_error{errno, std::system_category(), "Close failed"};
+        }
+        m_pairs.clear();
+        return;
+    }
+
+    if (!m_pairs.empty()) {
+        write_run();
+    }
+
+    auto inputs = m_runs;
+    inputs.insert(inputs.end(), extra_inputs.cbegin(), extra_inputs.cend());
+    merge_node_ways_files(inputs, m_filename);
+
+    for (const auto& run : m_runs) {
+        ::unlink(run.c_str());
+    }
+    m_runs.clear();
+}
+
+StateWriter::StateWriter() = default;
+
+StateWriter::~StateWriter() noexcept = default;
+
+void StateWriter::open(const std::string& directory, const osmium::io::File& input_file, const std::string& filter_expression, const relation_filter_type& filter) {
+    if (::mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw std::system_error{errno, std::system_category(), std::string{"Can not create directory '"} + directory + "'"};
+    }
+
+    {
+        const auto filename = state_file(directory, filter_file_name);
+        std::ofstream file{filename};
+        file << filter_expression << '\n';
+        file.close();
+        if (!file) {
+            throw std::runtime_error{"Can not write '" + filename + "'"};
+        }
+    }
+
+    {
+        osmium::io::Reader reader{input_file, osmium::osm_entity_bits::relation};
+        osmium::io::Writer writer{state_file(directory, relations_file_name), osmium::io::overwrite::allow};
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            for (const auto& relation : buffer.select<osmium::Relation>()) {
+                if (filter(relation)) {
+                    writer(relation);
+                }
+            }
+        }
+        writer.close();
+        reader.close();
+    }
+
+    // Start with an empty location file, old locations would stay in it
+    // otherwise.
+    const auto locations_file = state_file(directory, locations_file_name);
+    ::unlink(locations_file.c_str());
+    m_locations = std::make_unique<DenseLocationFile>(locations_file);
+
+    m_ways = std::make_unique<osmium::io::Writer>(state_file(directory, ways_file_name), osmium::io::overwrite::allow);
+    m_node_ways = std::make_unique<NodeWaysWriter>(state_file(directory, node_ways_file_name));
+}
+
+void StateWriter::node(const osmium::Node& node) {
+    if (m_locations) {
+        m_locations->set(node.id(), node.location());
+    }
+}
+
+void StateWriter::way(const osmium::Way& way) {
+    if (!m_ways) {
+        return;
+    }
+    (*m_ways)(way);
+    if (is_needed_way(way, m_member_ways)) {
+        m_node_ways->add(way);
+    }
+}
+
+void StateWriter::close() {
+    if (!m_ways) {
+        return;
+    }
+    m_ways->close();
+    m_node_ways->close();
+    m_ways.reset();
+    m_node_ways.reset();
+    m_locations.reset();
+    m_member_ways.clear();
+}
+
+update_result prepare_update(const std::string& directory,
+                             const std::vector<std::string>& change_files,
+                             const std::string& output_filename,
+                             const std::string& filter_expression,
+                             const relation_filter_type& filter) {
+    for (const char* name : {ways_file_name, relations_file_name, node_ways_file_name, locations_file_name, filter_file_name}) {
+        const auto filename = state_file(directory, name);
+        if (::access(filename.c_str(), R_OK | W_OK) != 0) {
+            throw std::runtime_error{"Missing file '" + filename + "' in update state directory (create it with --save-state)"};
+        }
+    }
+
+    // The relations in the state and the areas in the database were
+    // selected with the filter, using another one would mix areas.
+    {
+        std::ifstream file{state_file(directory, filter_file_name)};
+        std::string filter_expression_used;
+        if (!std::getline(file, filter_expression_used) || filter_expression_used != filter_expression) {
+            throw std::runtime_error{"Update state in '" + directory + "' was written with a different filter"};
+        }
+    }
+
+    update_result result;
+
+    // Read all changes and keep only the newest version of each object.
+    osmium::memory::Buffer changes{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+    for (const auto& filename : change_files) {
+        osmium::io::Reader reader{filename};
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            changes.add_buffer(buffer);
+            changes.commit();
+        }
+        reader.close();
+    }
+
+    osmium::ObjectPointerCollection objects;
+    osmium::apply(changes, objects);
+    objects.sort(osmium::object_order_type_id_reverse_version{});
+    objects.unique(osmium::object_equal_type_id{});
+    result.changes = objects.size();
+
+    DenseLocationFile locations{state_file(directory, locations_file_name)};
+
+    std::vector<osmium::object_id_type> changed_nodes;
+    std::vector<const osmium::Way*> changed_ways;
+    std::vector<const osmium::Relation*> changed_relations;
+    for (const auto& object : objects) {
+        if (object.id() <= 0) {
+            continue;
+        }
+        switch (object.type()) {
+            case osmium::item_type::node: {
+                    const auto& node = static_cast<const osmium::Node&>(object);
+                    locations.set(node.id(), node.visible() ? node.location() : osmium::Location{});
+                    changed_nodes.push_back(node.id());
+                }
+                break;
+            case osmium::item_type::way:
+                changed_ways.push_back(static_cast<const osmium::Way*>(&object));
+                break;
+            case osmium::item_type::relation:
+                changed_relations.push_back(static_cast<const osmium::Relation*>(&object));
+                break;
+            default:
+                break;
+        }
+    }
+
+    // The areas of all changed ways and of all ways with changed nodes
+    // have to be rebuilt.
+    std::vector<osmium::object_id_type> affected_ways;
+    {
+        const NodeWaysIndex node_ways{state_file(directory, node_ways_file_name)};
+        for (const auto id : changed_nodes) {
+            node_ways.for_each_way(id, [&](osmium::object_id_type way_id) {
+                affected_ways.push_back(way_id);
+            });
+        }
+    }
+    for (const auto* way : changed_ways) {
+        affected_ways.push_back(way->id());
+    }
+    sort_unique(affected_ways);
+
+    // Apply the relation changes. Changed relations which are not area
+    // relations (any more) are removed, but their old areas still have to
+    // be removed from the database.
+    osmium::memory::Buffer relations{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+    {
+        const auto handle_relation = [&](const osmium::Relation& relation, bool changed) {
+            if (changed) {
+                result.relations.push_back(relation.id());
+                if (!relation.visible() || !filter(relation)) {
+                    return;
+                }
+            }
+            relations.add_item(relation);
+            relations.commit();
+        };
+
+        const auto old_relations = read_file(state_file(directory, relations_file_name));
+        ChangeMerger<osmium::Relation> merger{changed_relations};
+        for (const auto& relation : old_relations.select<osmium::Relation>()) {
+            merger.next(relation, handle_relation);
+        }
+        merger.finish(handle_relation);
+    }
+
+    // Find all relations with changed members. All members of affected
+    // relations are needed to rebuild them.
+    const auto changed_relation_ids = result.relations;
+    IdBitmap member_ways;
+    std::vector<osmium::object_id_type> needed_ways = affected_ways;
+    std::vector<const osmium::Relation*> affected_relations;
+    {
+        osmium::io::Writer writer{osmium::io::File{state_file(directory, relations_file_name) + new_suffix, "pbf"}, osmium::io::overwrite::allow};
+        for (const auto& relation : relations.select<osmium::Relation>()) {
+            writer(relation);
+            bool affected = contains(changed_relation_ids, relation.id());
+            for (const auto& member : relation.members()) {
+                if (member.type() == osmium::item_type::way) {
+                    member_ways.set(member.ref());
+                    affected = affected || contains(affected_ways, member.ref());
+                }
+            }
+            if (affected) {
+                affected_relations.push_back(&relation);
+                result.relations.push_back(relation.id());
+                for (const auto& member : relation.members()) {
+                    if (member.type() == osmium::item_type::way) {
+                        needed_ways.push_back(member.ref());
+                    }
+                }
+            }
+        }
+        writer.close();
+    }
+    sort_unique(result.relations);
+    sort_unique(needed_ways);
+
+    // Unchanged members of affected relations are written into the update
+    // file, too, and their own areas are rebuilt, so their old areas have
+    // to go.
+    result.ways = needed_ways;
+
+    // Apply the way changes and collect the needed ways. Needed ways are
+    // added to the node to way index, ways that are not needed any more
+    // just stay in there, they are ignored when rebuilding areas.
+    osmium::memory::Buffer needed{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+    {
+        NodeWaysWriter node_ways{state_file(directory, node_ways_file_name) + new_suffix};
+        osmium::io::Writer writer{osmium::io::File{state_file(directory, ways_file_name) + new_suffix, "pbf"}, osmium::io::overwrite::allow};
+
+        const auto handle_way = [&](const osmium::Way& way, bool /*changed*/) {
+            if (!way.visible()) {
+                return;
+            }
+            writer(way);
+            if (contains(needed_ways, way.id())) {
+                needed.add_item(way);
+                needed.commit();
+                if (is_needed_way(way, member_ways)) {
+                    node_ways.add(way);
+                }
+            }
+        };
+
+        osmium::io::Reader reader{state_file(directory, ways_file_name)};
+        ChangeMerger<osmium::Way> merger{changed_ways};
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            for (const auto& way : buffer.select<osmium::Way>()) {
+                merger.next(way, handle_way);
+            }
+        }
+        merger.finish(handle_way);
+        reader.close();
+        writer.close();
+
+        node_ways.close({state_file(directory, node_ways_file_name)});
+    }
+
+    // Write everything needed to rebuild the areas into a normal OSM file
+    // with locations on ways, so it can be processed without location
+    // index.
+    for (auto& way : needed.select<osmium::Way>()) {
+        for (auto& node_ref : way.nodes()) {
+            node_ref.set_location(locations.get(node_ref.ref()));
+        }
+    }
+
+    osmium::io::Writer writer{osmium::io::File{output_filename, "pbf,locations_on_ways=true"}, osmium::io::overwrite::allow};
+    writer(std::move(needed));
+    for (const auto* relation : affected_relations) {
+        writer(*relation);
+    }
+    writer.close();
+
+    return result;
+}
+
+void merge_update(const std::string& database_name,
+                  const std::string& update_database_name,
+                  const update_result& update) {
+    Sqlite::Database db{database_name, SQLITE_OPEN_READWRITE};
+    load_spatialite(db);
+
+    db.exec("ATTACH DATABASE " + quote(update_database_name, '\'') + " AS upd;");
+
+    std::vector<std::string> tables;
+    {
+        Sqlite::Statement query{db, "SELECT name FROM main.sqlite_master WHERE type = 'table';"};
+        while (query.read()) {
+            tables.push_back(query.get_text(0));
+        }
+    }
+
+    // Areas are identified by the source and orig_id columns, problems by
+    // obj_type and obj_id. All other tables are left alone.
+    db.begin_transaction();
+    for (const auto& table : tables) {
+        const auto columns = table_columns(db, "main", table);
+        if (has_column(columns, "source") && has_column(columns, "orig_id")) {
+            delete_rows(db, table, "source", "orig_id", update);
+        } else if (has_column(columns, "obj_type") && has_column(columns, "obj_id")) {
+            delete_rows(db, table, "obj_type", "obj_id", update);
+        } else {
+            continue;
+        }
+        copy_rows(db, table);
+    }
+    db.commit();
+
+    db.exec("DETACH DATABASE upd;");
+}
+
+void commit_update(const std::string& directory) {
+    for (const char* name : {ways_file_name, relations_file_name, node_ways_file_name}) {
+        const auto filename = state_file(directory, name);
+        if (std::rename((filename + new_suffix).c_str(), filename.c_str()) != 0) {
+            throw std::system_error{errno, std::system_category(), "Can not rename '" + filename + new_suffix + "'"};
+        }
+    }
+}
@@ -0,0 +1,217 @@
+#ifndef UPDATE_STATE_HPP
+#define UPDATE_STATE_HPP
+
+#include "id_bitmap.hpp"
+#include "needed_nodes.hpp"
+
+#include <osmium/handler.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace osmium {
+    namespace io {
+        class Writer;
+    } // namespace io
+} // namespace osmium
+
+/*
+ * The update state is a directory with everything needed to update an
+ * area database from OSM change files without reading the full input
+ * file again:
+ *
+ * ways.osm.pbf      - all ways (without locations)
+ * relations.osm.pbf - all area relations
+ * node_ways.idx     - sorted (node ID, way ID) pairs for all ways needed
+ *                     for assembling areas (see is_needed_way())
+ * locations.idx     - node locations as dense array
+ * filter            - the --filter expression used (an update has to use
+ *                     the same filter)
+ *
+ * The way to relation lookup is done on the relations file which is small
+ * enough to be read into memory completely.
+ */
+
+/**
+ * Is a relation an area relation? Usually implemented with the
+ * new_relation() function of the multipolygon manager.
+ */
+using relation_filter_type = std::function<bool(const osmium::Relation&)>;
+
+/**
+ * Node locations stored as a dense array in a file which is mapped into
+ * memory read-write. The file grows as needed. Parts of the file that were
+ * never written don't use any disk space on file systems supporting sparse
+ * files, because an undefined location is stored as all zeros.
+ */
+class DenseLocationFile {
+
+    struct stored_location {
+        int32_t x;
+        int32_t y;
+    };
+
+    int m_fd = -1;
+    stored_location* m_data = nullptr;
+    std::size_t m_size = 0;
+
+    void grow(std::size_t min_size);
+
+public:
+
+    explicit DenseLocationFile(const std::string& filename);
+
+    DenseLocationFile(const DenseLocationFile&) = delete;
+    DenseLocationFile& operator=(const DenseLocationFile&) = delete;
+
+    DenseLocationFile(DenseLocationFile&&) = delete;
+    DenseLocationFile& operator=(DenseLocationFile&&) = delete;
+
+    ~DenseLocationFile() noexcept;
+
+    void set(osmium::object_id_type id, osmium::Location location);
+
+    osmium::Location get(osmium::object_id_type id) const noexcept;
+
+}; // class DenseLocationFile
+
+/**
+ * Entry in the node to way index.
+ */
+struct node_way {
+    uint64_t node;
+    uint64_t way;
+};
+
+inline bool operator==(const node_way& lhs, const node_way& rhs) noexcept {
+    return lhs.node == rhs.node && lhs.way == rhs.way;
+}
+
+inline bool operator<(const node_way& lhs, const node_way& rhs) noexcept {
+    return std::tie(lhs.node, lhs.way) < std::tie(rhs.node, rhs.way);
+}
+
+/**
+ * Collects (node ID, way ID) pairs and writes them sorted and without
+ * duplicates into a file. If there are too many pairs to sort in memory,
+ * sorted runs are written to temporary files and merged at the end.
+ */
+class NodeWaysWriter {
+
+    std::string m_filename;
+    std::vector<node_way> m_pairs;
+    std::vector<std::string> m_runs;
+
+    void write_run();
+
+public:
+
+    explicit NodeWaysWriter(std::string filename);
+
+    void add(const osmium::Way& way);
+
+    /**
+     * Write out the file. The contents of the (sorted) files in
+     * extra_inputs are merged into the output file.
+     */
+    void close(const std::vector<std::string>& extra_inputs = {});
+
+}; // class NodeWaysWriter
+
+/**
+ * Handler writing the update state during a full run. It has to see all
+ * nodes and ways in the second pass. Until open() is called it does
+ * nothing.
+ */
+class StateWriter : public osmium::handler::Handler {
+
+    IdBitmap m_member_ways;
+    std::unique_ptr<DenseLocationFile> m_locations;
+    std::unique_ptr<osmium::io::Writer> m_ways;
+    std::unique_ptr<NodeWaysWriter> m_node_ways;
+
+    void open(const std::string& directory, const osmium::io::File& input_file, const std::string& filter_expression, const relation_filter_type& filter);
+
+public:
+
+    StateWriter();
+
+    StateWriter(const StateWriter&) = delete;
+    StateWriter& operator=(const StateWriter&) = delete;
+
+    StateWriter(StateWriter&&) = delete;
+    StateWriter& operator=(StateWriter&&) = delete;
+
+    ~StateWriter() noexcept;
+
+    /**
+     * Create the state directory and write the relations file. Call this
+     * after the first pass. This reads the relations in the input file
+     * again.
+     */
+    template <typename TManager>
+    void open(const std::string& directory, const osmium::io::File& input_file, const std::string& filter_expression, TManager& manager) {
+        add_member_ways(manager, m_member_ways);
+        open(directory, input_file, filter_expression, [&manager](const osmium::Relation& relation) {
+            return manager.new_relation(relation);
+        });
+    }
+
+    void node(const osmium::Node& node);
+
+    void way(const osmium::Way& way);
+
+    void close();
+
+}; // class StateWriter
+
+/**
+ * The objects whose areas have to be replaced in the database. These are
+ * all objects written into the update file, so all their areas and
+ * problems are created again.
+ */
+struct update_result {
+    std::vector<osmium::object_id_type> ways;
+    std::vector<osmium::object_id_type> relations;
+    std::size_t changes = 0;
+};
+
+/**
+ * Apply the changes in change_files to the state in directory and write
+ * all ways and relations needed to rebuild the affected areas into
+ * output_filename (with locations on ways). The node locations are
+ * updated in place, the other state files are only replaced when
+ * commit_update() is called. Throws if the state was written with a
+ * different filter expression.
+ */
+update_result prepare_update(const std::string& directory,
+                             const std::vector<std::string>& change_files,
+                             const std::string& output_filename,
+                             const std::string& filter_expression,
+                             const relation_filter_type& filter);
+
+/**
+ * Replace the areas and problems of all objects in the update result in
+ * the database by the ones from the update database.
+ */
+void merge_update(const std::string& database_name,
+                  const std::string& update_database_name,
+                  const update_result& update);
+
+/**
+ * Replace the state files with the versions written by prepare_update().
+ */
+void commit_update(const std::string& directory);
+
+#endif // UPDATE_STATE_HPP